@@ -63,12 +63,7 @@ constexpr int BUF_MASK = 7;
 // Lipshitz's minimally audible FIR
 const float SHAPED_BS[] = { 2.033f, -2.165f, 1.959f, -1.590f, 0.6149f };
 
-// Dither state
-struct State {
-    int mPhase;
-    float mTriangleState;
-    float mBuffer[8 /* = BUF_SIZE */];
-} mState;
+using State = Dither::State;
 
 using Ditherer = float (*)(State &, float);
 
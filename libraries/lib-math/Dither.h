@@ -44,6 +44,17 @@ public:
                unsigned int len,
                unsigned int sourceStride = 1,
                unsigned int destStride = 1);
+
+    /// State of the noise shaping, kept in each object, so that objects may
+    /// be used in different threads at once
+    struct State {
+        int mPhase;
+        float mTriangleState;
+        float mBuffer[8 /* = BUF_SIZE */];
+    };
+
+private:
+    State mState;
 };
 
 #endif /* __AUDACITY_DITHER_H__ */
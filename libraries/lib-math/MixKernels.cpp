@@ -0,0 +1,387 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file MixKernels.cpp
+@brief Vectorized accumulation of samples with gains, for mixing
+
+**********************************************************************/
+
+#include "MixKernels.h"
+
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MIX_KERNELS_X86
+#include <immintrin.h>
+// Detection of the instruction sets is shared with the summaries
+#include "SummaryKernels.h"
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MIX_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// As in SummaryKernels.cpp:  GCC and Clang compile intrinsics only in
+// functions declared for the instruction set
+#if defined(__GNUC__) || defined(__clang__)
+#define MIX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MIX_TARGET(isa)
+#endif
+
+namespace MixKernels {
+
+namespace {
+
+template< bool HasEnvelope >
+void ScalarMix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len )
+{
+   for (size_t ii = 0; ii < len; ++ii) {
+      auto sample = src[ii];
+      if constexpr (HasEnvelope)
+         sample *= env[ii];
+      dst[ii * stride] += sample * gain;
+   }
+}
+
+template< bool HasEnvelope >
+void ScalarMixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len )
+{
+   for (size_t ii = 0; ii < len; ++ii) {
+      auto sample = src[ii];
+      if constexpr (HasEnvelope)
+         sample *= env[ii];
+      dst[2 * ii] += sample * leftGain;
+      dst[2 * ii + 1] += sample * rightGain;
+   }
+}
+
+void ScalarMultiply( float *buffer, const float *env, size_t len )
+{
+   for (size_t ii = 0; ii < len; ++ii)
+      buffer[ii] *= env[ii];
+}
+
+#ifdef MIX_KERNELS_X86
+
+template< bool HasEnvelope >
+MIX_TARGET("sse2")
+void Sse2Mix( float *dst, const float *src, const float *env,
+   float gain, size_t len )
+{
+   const auto vgain = _mm_set1_ps(gain);
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4) {
+      auto sample = _mm_loadu_ps(src + ii);
+      if constexpr (HasEnvelope)
+         sample = _mm_mul_ps(sample, _mm_loadu_ps(env + ii));
+      _mm_storeu_ps(dst + ii,
+         _mm_add_ps(_mm_loadu_ps(dst + ii), _mm_mul_ps(sample, vgain)));
+   }
+   ScalarMix<HasEnvelope>(
+      dst + ii, 1, src + ii, HasEnvelope ? env + ii : env, gain, len - ii);
+}
+
+template< bool HasEnvelope >
+MIX_TARGET("sse2")
+void Sse2MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len )
+{
+   const auto vgains = _mm_setr_ps(leftGain, rightGain, leftGain, rightGain);
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4) {
+      auto sample = _mm_loadu_ps(src + ii);
+      if constexpr (HasEnvelope)
+         sample = _mm_mul_ps(sample, _mm_loadu_ps(env + ii));
+      // Duplicate each sample for the two channels
+      const auto lo = _mm_unpacklo_ps(sample, sample);
+      const auto hi = _mm_unpackhi_ps(sample, sample);
+      const auto out = dst + 2 * ii;
+      _mm_storeu_ps(out,
+         _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(lo, vgains)));
+      _mm_storeu_ps(out + 4,
+         _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(hi, vgains)));
+   }
+   ScalarMixToStereo<HasEnvelope>(
+      dst + 2 * ii, src + ii, HasEnvelope ? env + ii : env,
+      leftGain, rightGain, len - ii);
+}
+
+MIX_TARGET("sse2")
+void Sse2Multiply( float *buffer, const float *env, size_t len )
+{
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4)
+      _mm_storeu_ps(buffer + ii,
+         _mm_mul_ps(_mm_loadu_ps(buffer + ii), _mm_loadu_ps(env + ii)));
+   ScalarMultiply(buffer + ii, env + ii, len - ii);
+}
+
+template< bool HasEnvelope >
+MIX_TARGET("avx2")
+void Avx2Mix( float *dst, const float *src, const float *env,
+   float gain, size_t len )
+{
+   const auto vgain = _mm256_set1_ps(gain);
+   size_t ii = 0;
+   for (; ii + 8 <= len; ii += 8) {
+      auto sample = _mm256_loadu_ps(src + ii);
+      if constexpr (HasEnvelope)
+         sample = _mm256_mul_ps(sample, _mm256_loadu_ps(env + ii));
+      _mm256_storeu_ps(dst + ii, _mm256_add_ps(
+         _mm256_loadu_ps(dst + ii), _mm256_mul_ps(sample, vgain)));
+   }
+   // Avoid the penalty of mixing AVX with legacy SSE code that follows
+   _mm256_zeroupper();
+   ScalarMix<HasEnvelope>(
+      dst + ii, 1, src + ii, HasEnvelope ? env + ii : env, gain, len - ii);
+}
+
+template< bool HasEnvelope >
+MIX_TARGET("avx2")
+void Avx2MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len )
+{
+   const auto vgains = _mm256_setr_ps(leftGain, rightGain, leftGain,
+      rightGain, leftGain, rightGain, leftGain, rightGain);
+   size_t ii = 0;
+   for (; ii + 8 <= len; ii += 8) {
+      auto sample = _mm256_loadu_ps(src + ii);
+      if constexpr (HasEnvelope)
+         sample = _mm256_mul_ps(sample, _mm256_loadu_ps(env + ii));
+      // Unpacking works within each half, giving samples 0 0 1 1 4 4 5 5
+      // and 2 2 3 3 6 6 7 7; then exchange halves to restore the order
+      const auto lo = _mm256_unpacklo_ps(sample, sample);
+      const auto hi = _mm256_unpackhi_ps(sample, sample);
+      const auto first = _mm256_permute2f128_ps(lo, hi, 0x20);
+      const auto second = _mm256_permute2f128_ps(lo, hi, 0x31);
+      const auto out = dst + 2 * ii;
+      _mm256_storeu_ps(out, _mm256_add_ps(
+         _mm256_loadu_ps(out), _mm256_mul_ps(first, vgains)));
+      _mm256_storeu_ps(out + 8, _mm256_add_ps(
+         _mm256_loadu_ps(out + 8), _mm256_mul_ps(second, vgains)));
+   }
+   _mm256_zeroupper();
+   ScalarMixToStereo<HasEnvelope>(
+      dst + 2 * ii, src + ii, HasEnvelope ? env + ii : env,
+      leftGain, rightGain, len - ii);
+}
+
+MIX_TARGET("avx2")
+void Avx2Multiply( float *buffer, const float *env, size_t len )
+{
+   size_t ii = 0;
+   for (; ii + 8 <= len; ii += 8)
+      _mm256_storeu_ps(buffer + ii, _mm256_mul_ps(
+         _mm256_loadu_ps(buffer + ii), _mm256_loadu_ps(env + ii)));
+   _mm256_zeroupper();
+   ScalarMultiply(buffer + ii, env + ii, len - ii);
+}
+
+#endif
+
+#ifdef MIX_KERNELS_NEON
+
+template< bool HasEnvelope >
+void NeonMix( float *dst, const float *src, const float *env,
+   float gain, size_t len )
+{
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4) {
+      auto sample = vld1q_f32(src + ii);
+      if constexpr (HasEnvelope)
+         sample = vmulq_f32(sample, vld1q_f32(env + ii));
+      vst1q_f32(dst + ii,
+         vaddq_f32(vld1q_f32(dst + ii), vmulq_n_f32(sample, gain)));
+   }
+   ScalarMix<HasEnvelope>(
+      dst + ii, 1, src + ii, HasEnvelope ? env + ii : env, gain, len - ii);
+}
+
+template< bool HasEnvelope >
+void NeonMixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len )
+{
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4) {
+      auto sample = vld1q_f32(src + ii);
+      if constexpr (HasEnvelope)
+         sample = vmulq_f32(sample, vld1q_f32(env + ii));
+      // Structured load and store separate and rejoin the channels
+      const auto out = dst + 2 * ii;
+      auto channels = vld2q_f32(out);
+      channels.val[0] =
+         vaddq_f32(channels.val[0], vmulq_n_f32(sample, leftGain));
+      channels.val[1] =
+         vaddq_f32(channels.val[1], vmulq_n_f32(sample, rightGain));
+      vst2q_f32(out, channels);
+   }
+   ScalarMixToStereo<HasEnvelope>(
+      dst + 2 * ii, src + ii, HasEnvelope ? env + ii : env,
+      leftGain, rightGain, len - ii);
+}
+
+void NeonMultiply( float *buffer, const float *env, size_t len )
+{
+   size_t ii = 0;
+   for (; ii + 4 <= len; ii += 4)
+      vst1q_f32(buffer + ii,
+         vmulq_f32(vld1q_f32(buffer + ii), vld1q_f32(env + ii)));
+   ScalarMultiply(buffer + ii, env + ii, len - ii);
+}
+
+#endif
+
+template< bool HasEnvelope >
+void DoMix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len,
+   InstructionSet set )
+{
+   // Only contiguous destinations are vectorized; the two channels of
+   // interleaved stereo are better done together by MixToStereo
+   if (stride == 1) {
+      switch (set) {
+#ifdef MIX_KERNELS_X86
+      case InstructionSet::AVX2:
+         return Avx2Mix<HasEnvelope>(dst, src, env, gain, len);
+      case InstructionSet::SSE2:
+         return Sse2Mix<HasEnvelope>(dst, src, env, gain, len);
+#endif
+#ifdef MIX_KERNELS_NEON
+      case InstructionSet::NEON:
+         return NeonMix<HasEnvelope>(dst, src, env, gain, len);
+#endif
+      default:
+         break;
+      }
+   }
+   ScalarMix<HasEnvelope>(dst, stride, src, env, gain, len);
+}
+
+template< bool HasEnvelope >
+void DoMixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len, InstructionSet set )
+{
+   switch (set) {
+#ifdef MIX_KERNELS_X86
+   case InstructionSet::AVX2:
+      return Avx2MixToStereo<HasEnvelope>(
+         dst, src, env, leftGain, rightGain, len);
+   case InstructionSet::SSE2:
+      return Sse2MixToStereo<HasEnvelope>(
+         dst, src, env, leftGain, rightGain, len);
+#endif
+#ifdef MIX_KERNELS_NEON
+   case InstructionSet::NEON:
+      return NeonMixToStereo<HasEnvelope>(
+         dst, src, env, leftGain, rightGain, len);
+#endif
+   default:
+      return ScalarMixToStereo<HasEnvelope>(
+         dst, src, env, leftGain, rightGain, len);
+   }
+}
+
+}
+
+bool IsAvailable( InstructionSet set )
+{
+   switch (set) {
+   case InstructionSet::Scalar:
+      return true;
+#ifdef MIX_KERNELS_X86
+   case InstructionSet::SSE2:
+      return SummaryKernels::IsAvailable(
+         SummaryKernels::InstructionSet::SSE2);
+   case InstructionSet::AVX2:
+      return SummaryKernels::IsAvailable(
+         SummaryKernels::InstructionSet::AVX2);
+#endif
+#ifdef MIX_KERNELS_NEON
+   case InstructionSet::NEON:
+      // Part of the architecture, where the build targets it
+      return true;
+#endif
+   default:
+      return false;
+   }
+}
+
+InstructionSet Best()
+{
+   static const InstructionSet result = []{
+      for (auto set : { InstructionSet::NEON,
+         InstructionSet::AVX2, InstructionSet::SSE2 })
+         if (IsAvailable(set))
+            return set;
+      return InstructionSet::Scalar;
+   }();
+   return result;
+}
+
+const char *Name( InstructionSet set )
+{
+   switch (set) {
+   case InstructionSet::SSE2:
+      return "SSE2";
+   case InstructionSet::AVX2:
+      return "AVX2";
+   case InstructionSet::NEON:
+      return "NEON";
+   default:
+      return "Scalar";
+   }
+}
+
+void Mix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len )
+{
+   Mix(dst, stride, src, env, gain, len, Best());
+}
+
+void Mix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len,
+   InstructionSet set )
+{
+   if (env)
+      DoMix<true>(dst, stride, src, env, gain, len, set);
+   else
+      DoMix<false>(dst, stride, src, env, gain, len, set);
+}
+
+void MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len )
+{
+   MixToStereo(dst, src, env, leftGain, rightGain, len, Best());
+}
+
+void MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len, InstructionSet set )
+{
+   if (env)
+      DoMixToStereo<true>(dst, src, env, leftGain, rightGain, len, set);
+   else
+      DoMixToStereo<false>(dst, src, env, leftGain, rightGain, len, set);
+}
+
+void Multiply( float *buffer, const float *env, size_t len )
+{
+   switch (Best()) {
+#ifdef MIX_KERNELS_X86
+   case InstructionSet::AVX2:
+      return Avx2Multiply(buffer, env, len);
+   case InstructionSet::SSE2:
+      return Sse2Multiply(buffer, env, len);
+#endif
+#ifdef MIX_KERNELS_NEON
+   case InstructionSet::NEON:
+      return NeonMultiply(buffer, env, len);
+#endif
+   default:
+      return ScalarMultiply(buffer, env, len);
+   }
+}
+
+}
@@ -0,0 +1,71 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file MixKernels.h
+@brief Vectorized accumulation of samples with gains, for mixing
+
+**********************************************************************/
+
+#ifndef __AUDACITY_MIX_KERNELS__
+#define __AUDACITY_MIX_KERNELS__
+
+#include <cstddef>
+
+//! Add samples of one channel, with gain, into a mix
+/*!
+ Envelope values, where given, multiply each sample before the gain.
+ Every instruction set multiplies and adds in the same order as the scalar
+ code, but the compiler may fuse the scalar multiplications and additions,
+ so results may differ in the last bit.
+
+ The best instruction set that the build and the processor support is
+ chosen at run time.
+ */
+namespace MixKernels {
+
+//! Implementations, in increasing order of preference
+enum class InstructionSet : unsigned {
+   Scalar,
+   SSE2,
+   AVX2,
+   NEON,
+};
+
+//! Whether the build and the processor support the instruction set
+MATH_API bool IsAvailable( InstructionSet set );
+
+//! The most preferred available instruction set
+MATH_API InstructionSet Best();
+
+//! A name for the instruction set, not translated
+MATH_API const char *Name( InstructionSet set );
+
+//! Add `src[ii] * env[ii] * gain` to `dst[ii * stride]`, for ii below len
+/*! @param env may be null, in place of all ones */
+MATH_API void Mix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len );
+
+//! Mix() with the given instruction set
+/*! @pre IsAvailable(set) */
+MATH_API void Mix( float *dst, size_t stride,
+   const float *src, const float *env, float gain, size_t len,
+   InstructionSet set );
+
+//! Add `src[ii] * env[ii]` times each gain to both channels of interleaved
+//! stereo `dst`, for ii below len
+/*! @param env may be null, in place of all ones */
+MATH_API void MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len );
+
+//! MixToStereo() with the given instruction set
+/*! @pre IsAvailable(set) */
+MATH_API void MixToStereo( float *dst, const float *src, const float *env,
+   float leftGain, float rightGain, size_t len, InstructionSet set );
+
+//! Multiply `buffer[ii]` by `env[ii]`, for ii below len
+MATH_API void Multiply( float *buffer, const float *env, size_t len );
+
+}
+
+#endif
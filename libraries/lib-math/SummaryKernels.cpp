@@ -0,0 +1,354 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SummaryKernels.cpp
+@brief Vectorized minimum, maximum and sum of squares of samples
+
+**********************************************************************/
+
+#include "SummaryKernels.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SUMMARY_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile intrinsics only in functions declared for the
+// instruction set, so that the rest of the library still runs on any
+// processor; MSVC always compiles them
+#if defined(__GNUC__) || defined(__clang__)
+#define SUMMARY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SUMMARY_TARGET(isa)
+#endif
+
+namespace SummaryKernels {
+
+namespace {
+
+// Sums of squares are accumulated in float over at most this many samples,
+// then in double, limiting the loss of precision in long runs.
+// A multiple of all vector widths.
+constexpr size_t ChunkSize = 4096;
+
+constexpr float Int16Scale = 1.0f / (1 << 15);
+constexpr float Int24Scale = 1.0f / (1 << 23);
+
+template< typename Type >
+Result ScalarKernel( const Type *src, size_t len, float scale )
+{
+   Result result;
+   float min = FLT_MAX;
+   float max = -FLT_MAX;
+   while (len > 0) {
+      const auto count = std::min(len, ChunkSize);
+      float sumsq = 0;
+      for (size_t ii = 0; ii < count; ++ii) {
+         const float sample = src[ii] * scale;
+         if (sample < min)
+            min = sample;
+         if (sample > max)
+            max = sample;
+         sumsq += sample * sample;
+      }
+      result.sumsq += sumsq;
+      src += count;
+      len -= count;
+   }
+   result.min = min;
+   result.max = max;
+   return result;
+}
+
+#ifdef SUMMARY_KERNELS_X86
+
+// Loaders convert eight samples to two vectors of float
+struct Sse2Float {
+   using Type = float;
+   SUMMARY_TARGET("sse2")
+   static void Load( const float *src, __m128, __m128 &a, __m128 &b )
+   {
+      a = _mm_loadu_ps(src);
+      b = _mm_loadu_ps(src + 4);
+   }
+};
+
+struct Sse2Int24 {
+   using Type = int;
+   SUMMARY_TARGET("sse2")
+   static void Load( const int *src, __m128 scale, __m128 &a, __m128 &b )
+   {
+      const auto p = reinterpret_cast<const __m128i*>(src);
+      a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(p)), scale);
+      b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(p + 1)), scale);
+   }
+};
+
+struct Sse2Int16 {
+   using Type = short;
+   SUMMARY_TARGET("sse2")
+   static void Load( const short *src, __m128 scale, __m128 &a, __m128 &b )
+   {
+      const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+      // Sign-extend to 32 bits, by duplicating each value into the high
+      // halves and shifting arithmetically
+      const auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      const auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      a = _mm_mul_ps(_mm_cvtepi32_ps(lo), scale);
+      b = _mm_mul_ps(_mm_cvtepi32_ps(hi), scale);
+   }
+};
+
+template< typename Loader >
+SUMMARY_TARGET("sse2")
+Result Sse2Kernel( const typename Loader::Type *src, size_t len, float scale )
+{
+   constexpr size_t Width = 8;
+   const auto vscale = _mm_set1_ps(scale);
+   auto vmin = _mm_set1_ps(FLT_MAX);
+   auto vmax = _mm_set1_ps(-FLT_MAX);
+
+   Result result;
+   const size_t vectorLen = len - len % Width;
+   size_t ii = 0;
+   while (ii < vectorLen) {
+      const auto end = std::min(vectorLen, ii + ChunkSize);
+      // Two accumulators hide the latency of addition
+      auto sum0 = _mm_setzero_ps();
+      auto sum1 = _mm_setzero_ps();
+      for (; ii < end; ii += Width) {
+         __m128 a, b;
+         Loader::Load(src + ii, vscale, a, b);
+         vmin = _mm_min_ps(vmin, _mm_min_ps(a, b));
+         vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+         sum0 = _mm_add_ps(sum0, _mm_mul_ps(a, a));
+         sum1 = _mm_add_ps(sum1, _mm_mul_ps(b, b));
+      }
+      float sums[4];
+      _mm_storeu_ps(sums, _mm_add_ps(sum0, sum1));
+      result.sumsq += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+   }
+
+   float mins[4], maxs[4];
+   _mm_storeu_ps(mins, vmin);
+   _mm_storeu_ps(maxs, vmax);
+   result.min = std::min({ mins[0], mins[1], mins[2], mins[3] });
+   result.max = std::max({ maxs[0], maxs[1], maxs[2], maxs[3] });
+
+   result += ScalarKernel(src + ii, len - ii, scale);
+   return result;
+}
+
+// Loaders convert sixteen samples to two vectors of float
+struct Avx2Float {
+   using Type = float;
+   SUMMARY_TARGET("avx2")
+   static void Load( const float *src, __m256, __m256 &a, __m256 &b )
+   {
+      a = _mm256_loadu_ps(src);
+      b = _mm256_loadu_ps(src + 8);
+   }
+};
+
+struct Avx2Int24 {
+   using Type = int;
+   SUMMARY_TARGET("avx2")
+   static void Load( const int *src, __m256 scale, __m256 &a, __m256 &b )
+   {
+      const auto p = reinterpret_cast<const __m256i*>(src);
+      a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(p)), scale);
+      b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(p + 1)), scale);
+   }
+};
+
+struct Avx2Int16 {
+   using Type = short;
+   SUMMARY_TARGET("avx2")
+   static void Load( const short *src, __m256 scale, __m256 &a, __m256 &b )
+   {
+      const auto p = reinterpret_cast<const __m128i*>(src);
+      const auto lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(p));
+      const auto hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(p + 1));
+      a = _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale);
+      b = _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale);
+   }
+};
+
+template< typename Loader >
+SUMMARY_TARGET("avx2")
+Result Avx2Kernel( const typename Loader::Type *src, size_t len, float scale )
+{
+   constexpr size_t Width = 16;
+   const auto vscale = _mm256_set1_ps(scale);
+   auto vmin = _mm256_set1_ps(FLT_MAX);
+   auto vmax = _mm256_set1_ps(-FLT_MAX);
+
+   Result result;
+   const size_t vectorLen = len - len % Width;
+   size_t ii = 0;
+   while (ii < vectorLen) {
+      const auto end = std::min(vectorLen, ii + ChunkSize);
+      auto sum0 = _mm256_setzero_ps();
+      auto sum1 = _mm256_setzero_ps();
+      for (; ii < end; ii += Width) {
+         __m256 a, b;
+         Loader::Load(src + ii, vscale, a, b);
+         vmin = _mm256_min_ps(vmin, _mm256_min_ps(a, b));
+         vmax = _mm256_max_ps(vmax, _mm256_max_ps(a, b));
+         sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(a, a));
+         sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(b, b));
+      }
+      float sums[8];
+      _mm256_storeu_ps(sums, _mm256_add_ps(sum0, sum1));
+      result.sumsq += ((sums[0] + sums[1]) + (sums[2] + sums[3])) +
+         ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+   }
+
+   float mins[8], maxs[8];
+   _mm256_storeu_ps(mins, vmin);
+   _mm256_storeu_ps(maxs, vmax);
+   result.min = *std::min_element(mins, mins + 8);
+   result.max = *std::max_element(maxs, maxs + 8);
+
+   // Avoid the penalty of mixing AVX with legacy SSE code that follows
+   _mm256_zeroupper();
+
+   result += ScalarKernel(src + ii, len - ii, scale);
+   return result;
+}
+
+bool ProcessorHasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+   // Part of the 64 bit architecture
+   return true;
+#elif defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 1);
+   return (info[3] & (1 << 26)) != 0;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool ProcessorHasAvx2()
+{
+#if defined(_MSC_VER)
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return false;
+   // The operating system must also save the wide registers
+   __cpuid(info, 1);
+   const bool osxsave = (info[2] & (1 << 27)) != 0;
+   const bool avx = (info[2] & (1 << 28)) != 0;
+   if (!(osxsave && avx) || (_xgetbv(0) & 6) != 6)
+      return false;
+   __cpuidex(info, 7, 0);
+   return (info[1] & (1 << 5)) != 0;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+}
+
+bool IsAvailable( InstructionSet set )
+{
+   switch (set) {
+   case InstructionSet::Scalar:
+      return true;
+#ifdef SUMMARY_KERNELS_X86
+   case InstructionSet::SSE2: {
+      static const bool result = ProcessorHasSse2();
+      return result;
+   }
+   case InstructionSet::AVX2: {
+      static const bool result = ProcessorHasAvx2();
+      return result;
+   }
+#endif
+   default:
+      return false;
+   }
+}
+
+InstructionSet Best()
+{
+   static const InstructionSet result = []{
+      for (auto set : { InstructionSet::AVX2, InstructionSet::SSE2 })
+         if (IsAvailable(set))
+            return set;
+      return InstructionSet::Scalar;
+   }();
+   return result;
+}
+
+const char *Name( InstructionSet set )
+{
+   switch (set) {
+   case InstructionSet::SSE2:
+      return "SSE2";
+   case InstructionSet::AVX2:
+      return "AVX2";
+   default:
+      return "Scalar";
+   }
+}
+
+Result Compute( constSamplePtr src, sampleFormat format, size_t numsamples )
+{
+   return Compute(src, format, numsamples, Best());
+}
+
+Result Compute( constSamplePtr src, sampleFormat format,
+   size_t numsamples, InstructionSet set )
+{
+   const auto pInt16 = reinterpret_cast<const short*>(src);
+   const auto pInt24 = reinterpret_cast<const int*>(src);
+   const auto pFloat = reinterpret_cast<const float*>(src);
+
+   switch (set) {
+#ifdef SUMMARY_KERNELS_X86
+   case InstructionSet::AVX2:
+      switch (format) {
+      case int16Sample:
+         return Avx2Kernel<Avx2Int16>(pInt16, numsamples, Int16Scale);
+      case int24Sample:
+         return Avx2Kernel<Avx2Int24>(pInt24, numsamples, Int24Scale);
+      default:
+         return Avx2Kernel<Avx2Float>(pFloat, numsamples, 1.0f);
+      }
+   case InstructionSet::SSE2:
+      switch (format) {
+      case int16Sample:
+         return Sse2Kernel<Sse2Int16>(pInt16, numsamples, Int16Scale);
+      case int24Sample:
+         return Sse2Kernel<Sse2Int24>(pInt24, numsamples, Int24Scale);
+      default:
+         return Sse2Kernel<Sse2Float>(pFloat, numsamples, 1.0f);
+      }
+#endif
+   default:
+      switch (format) {
+      case int16Sample:
+         return ScalarKernel(pInt16, numsamples, Int16Scale);
+      case int24Sample:
+         return ScalarKernel(pInt24, numsamples, Int24Scale);
+      default:
+         return ScalarKernel(pFloat, numsamples, 1.0f);
+      }
+   }
+}
+
+}
@@ -0,0 +1,77 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SummaryKernels.h
+@brief Vectorized minimum, maximum and sum of squares of samples
+
+**********************************************************************/
+
+#ifndef __AUDACITY_SUMMARY_KERNELS__
+#define __AUDACITY_SUMMARY_KERNELS__
+
+#include "SampleFormat.h"
+
+#include <cfloat>
+
+//! Compute the statistics of runs of samples that summaries are made of
+/*!
+ Integer samples are treated as converted to float, as by SamplesToFloats,
+ without making the conversion in a separate pass.
+
+ The best instruction set that the processor supports is chosen at run time.
+ Results of different instruction sets agree exactly in minimum and maximum,
+ unless float samples include NaN, which instruction sets treat differently.
+ The sums of squares may differ in rounding, because the order of additions
+ differs.
+ */
+namespace SummaryKernels {
+
+//! Extremes and sum of squares of a run of samples
+struct Result
+{
+   //! As for an empty run
+   float min = FLT_MAX;
+   float max = -FLT_MAX;
+   double sumsq = 0;
+
+   //! Combine with the result for another run
+   Result &operator +=( const Result &other )
+   {
+      if (other.min < min)
+         min = other.min;
+      if (other.max > max)
+         max = other.max;
+      sumsq += other.sumsq;
+      return *this;
+   }
+};
+
+//! Implementations, in increasing order of preference
+enum class InstructionSet : unsigned {
+   Scalar,
+   SSE2,
+   AVX2,
+};
+
+//! Whether the build and the processor support the instruction set
+MATH_API bool IsAvailable( InstructionSet set );
+
+//! The most preferred available instruction set
+MATH_API InstructionSet Best();
+
+//! A name for the instruction set, not translated
+MATH_API const char *Name( InstructionSet set );
+
+//! Compute statistics of numsamples samples, using Best()
+MATH_API Result Compute(
+   constSamplePtr src, sampleFormat format, size_t numsamples );
+
+//! Compute statistics of numsamples samples with the given instruction set
+/*! @pre IsAvailable(set) */
+MATH_API Result Compute( constSamplePtr src, sampleFormat format,
+   size_t numsamples, InstructionSet set );
+
+}
+
+#endif
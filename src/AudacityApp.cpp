@@ -1417,6 +1417,9 @@ bool AudacityApp::InitPart2()
       Sequence::SetMaxDiskBlockSize(lval);
    }
 
+   Sequence::SetAdaptiveBlockSize(
+      gPrefs->ReadBool(wxT("/Performance/AdaptiveBlockSize"), true));
+
    wxString fileName;
    if (parser->Found(wxT("j"), &fileName))
       Journal::SetInputFileName( fileName );
@@ -460,7 +460,10 @@ time warp info and AudioIOListener and whether the playback is looped.
 #include "DBConnection.h"
 #include "ProjectFileIO.h"
 #include "ProjectWindows.h"
+#include "RecordingWriter.h"
+#include "SampleBlock.h"
 #include "WaveTrack.h"
+#include "WorkerPool.h"
 
 #include "effects/RealtimeEffectManager.h"
 #include "QualitySettings.h"
@@ -613,6 +616,21 @@ enum {
 
 constexpr size_t TimeQueueGrainSize = 2000;
 
+//! How many threads may run the mixers of playback tracks at once; zero, the
+//! default, allows as many as the shared WorkerPool has, and one mixes all
+//! tracks on the audio thread
+static IntSetting PlaybackMixThreads{ L"/Performance/PlaybackMixThreads", 0 };
+
+//! Whether to buffer playback only as far ahead as the load of the project
+//! requires, adjusting while playing, instead of filling all of the buffer
+static BoolSetting AdaptivePlaybackBuffering{
+   L"/Performance/AdaptivePlaybackBuffering", false };
+
+//! Least playback, in seconds, that adaptive buffering keeps queued
+constexpr double MinAdaptiveBufferSecs = 0.1;
+//! Fills without trouble before adaptive buffering tries less
+constexpr unsigned AdaptiveQuietFills = 20;
+
 #ifdef EXPERIMENTAL_SCRUBBING_SUPPORT
 
 #ifdef __WXGTK__
@@ -1128,6 +1146,9 @@ AudioIO::AudioIO()
    mThread = std::make_unique<AudioThread>();
    mThread->Create();
 
+   mRecordingWriter = std::make_unique<RecordingWriter>(
+      [this]( RecordedSamples &samples ){ WriteRecordedSamples( samples ); } );
+
 #if defined(USE_PORTMIXER)
    mPortMixer = NULL;
    mPreviousHWPlaythrough = -1.0;
@@ -1177,6 +1198,8 @@ AudioIO::~AudioIO()
 
    mThread->Delete();
    mThread.reset();
+
+   mRecordingWriter.reset();
 }
 
 void AudioIO::SetMixer(int inputSource, float recordVolume,
@@ -1814,6 +1837,7 @@ int AudioIO::StartStream(const TransportTracks &tracks,
    // audio thread call TrackBufferExchange here makes the code more predictable, since
    // TrackBufferExchange will ALWAYS get called from the Audio thread.
    mAudioThreadShouldCallTrackBufferExchangeOnce = true;
+   WakeAudioThread();
 
    while( mAudioThreadShouldCallTrackBufferExchangeOnce ) {
       auto interval = 50ull;
@@ -1858,6 +1882,8 @@ int AudioIO::StartStream(const TransportTracks &tracks,
       mAudioThreadTrackBufferExchangeLoopRunning = true;
       mForceFadeOut.store(false, std::memory_order_relaxed);
 
+      mStreamStartClock = std::chrono::steady_clock::now();
+
       // Now start the PortAudio stream!
       PaError err;
       err = Pa_StartStream( mPortStreamV19 );
@@ -2002,7 +2028,8 @@ bool AudioIO::AllocateBuffers(
             auto playbackBufferSize =
                (size_t)lrint(mRate * mPlaybackRingBufferSecs);
 
-            mPlaybackBuffers.reinit(mPlaybackTracks.size());
+            mPlaybackBuffers = std::make_unique<MultiRingBuffer>(
+               floatSample, mPlaybackTracks.size(), playbackBufferSize);
             mPlaybackMixers.reinit(mPlaybackTracks.size());
 
             const Mixer::WarpOptions &warpOptions =
@@ -2032,8 +2059,6 @@ bool AudioIO::AllocateBuffers(
                mPlaybackTracks[i]->SetOldChannelGain(0, 0.0);
                mPlaybackTracks[i]->SetOldChannelGain(1, 0.0);
 
-               mPlaybackBuffers[i] =
-                  std::make_unique<RingBuffer>(floatSample, playbackBufferSize);
                const auto timeQueueSize = 1 +
                   (playbackBufferSize + TimeQueueGrainSize - 1)
                      / TimeQueueGrainSize;
@@ -2092,6 +2117,13 @@ bool AudioIO::AllocateBuffers(
             mResample.reinit(mCaptureTracks.size());
             mFactor = sampleRate / mRate;
 
+            // Let the queue of samples awaiting storage hold some seconds
+            // more than the ring buffers, to ride out a slow disk
+            const double RecordingQueueSecs = 20.0;
+            mRecordingWriter->SetLimit( mCaptureTracks.size() *
+               size_t(mRate * RecordingQueueSecs) * SAMPLE_SIZE(floatSample) );
+            mRecordingWriter->ResetStatistics();
+
             for( unsigned int i = 0; i < mCaptureTracks.size(); i++ )
             {
                mCaptureBuffers[i] = std::make_unique<RingBuffer>(
@@ -2124,7 +2156,40 @@ bool AudioIO::AllocateBuffers(
          }
       }
    } while(!bDone);
-   
+
+   // The callback wakes the audio thread as soon as TrackBufferExchange
+   // would find something to do.  Allow for the few samples that
+   // GetCommonlyFreePlayback() holds back.
+   mPlaybackWakeWatermark = mPlaybackSamplesToCopy + 10;
+   mCaptureWakeWatermark =
+      std::max<size_t>(1, lrint(mMinCaptureSecsToCopy * mRate));
+   mWakeupStatistics = {};
+
+   mnBufferEvents.store(0, std::memory_order_relaxed);
+   mPlaybackUnderruns.store(0, std::memory_order_relaxed);
+   mPlaybackSupplyEnded.store(false, std::memory_order_relaxed);
+   mAdaptiveBuffering = {};
+   if (!scrubbing && !mPlaybackTracks.empty() &&
+       AdaptivePlaybackBuffering.Read()) {
+      // Start low, and let the audio thread grow it as needed
+      auto &adaptive = mAdaptiveBuffering;
+      adaptive.capacity = (size_t)lrint(mRate * mPlaybackRingBufferSecs);
+      // Batches of half the limit must fit the buffers of the mixers
+      adaptive.maxLimit = std::min(adaptive.capacity,
+         2 * std::max(mPlaybackSamplesToCopy, mPlaybackQueueMinimum));
+      adaptive.minLimit = std::min(adaptive.maxLimit,
+         std::max<size_t>(2, lrint(MinAdaptiveBufferSecs * mRate)));
+      adaptive.lowestLimit = adaptive.maxLimit;
+      SetPlaybackFillLimit(std::min(adaptive.maxLimit, 4 * adaptive.minLimit));
+   }
+
+   const auto concurrency = WorkerPool::Get().GetConcurrency();
+   const auto mixThreads = PlaybackMixThreads.Read();
+   mPlaybackMixThreads = mixThreads > 0
+      ? std::min<size_t>(mixThreads, concurrency)
+      : concurrency;
+   mMixStatistics = {};
+
    success = true;
    return true;
 }
@@ -2449,6 +2514,7 @@ void AudioIO::StopStream()
       // call TrackBufferExchange one last time (it normally would not do so since
       // Pa_GetStreamActive() would now return false
       mAudioThreadShouldCallTrackBufferExchangeOnce = true;
+      WakeAudioThread();
 
       while( mAudioThreadShouldCallTrackBufferExchangeOnce )
       {
@@ -2457,6 +2523,22 @@ void AudioIO::StopStream()
          wxMilliSleep( 50 );
       }
 
+      // Then wait for the writer to append all of that to the tracks
+      while( !mRecordingWriter->IsIdle() )
+      {
+         wxTheApp->Yield(true);
+         wxMilliSleep( 50 );
+      }
+
+      if (mCaptureTracks.size() > 0) {
+         auto stats = mRecordingWriter->GetStatistics();
+         wxLogInfo(
+            "Recording writer: greatest queue depth %lu (%lu bytes), "
+            "%llu deferrals",
+            (unsigned long) stats.maxDepth, (unsigned long) stats.maxBytes,
+            stats.deferrals);
+      }
+
       //
       // Everything is taken care of.  Now, just free all the resources
       // we allocated in StartStream()
@@ -2543,6 +2625,53 @@ void AudioIO::StopStream()
 
    mInputMeter.reset();
    mOutputMeter.reset();
+
+   if (mOwningProject && mNumPlaybackChannels > 0) {
+      auto stats = WaveTrackFactory::Get( *mOwningProject )
+         .GetSampleBlockFactory()->GetPrefetchStatistics();
+      if (stats.requested > 0)
+         wxLogInfo(
+            "Sample block read-ahead: %llu requested, %llu completed, "
+            "%llu stalls, greatest queue depth %lu",
+            stats.requested, stats.completed, stats.stalls,
+            (unsigned long) stats.maxDepth);
+   }
+   if (mWakeupStatistics.wakeups > 0)
+      wxLogInfo(
+         "Audio thread: %llu wakeups, %llu timeouts, "
+         "wakeup to refill latency mean %.2f ms, max %.2f ms",
+         mWakeupStatistics.wakeups, mWakeupStatistics.timeouts,
+         mWakeupStatistics.totalLatencyMs / mWakeupStatistics.wakeups,
+         mWakeupStatistics.maxLatencyMs);
+   if (mMixStatistics.slices > 0)
+      wxLogInfo(
+         "Playback mixing: %llu slices of %lu tracks on %lu threads, "
+         "mean %.2f ms, max %.2f ms",
+         mMixStatistics.slices, (unsigned long) mPlaybackTracks.size(),
+         (unsigned long) std::min(mPlaybackMixThreads, mPlaybackTracks.size()),
+         mMixStatistics.totalMs / mMixStatistics.slices,
+         mMixStatistics.maxMs);
+   if (const auto nEvents = mnBufferEvents.load(std::memory_order_acquire)) {
+      wxLogInfo("Audio buffers: %llu playback underruns, %lu events",
+         mPlaybackUnderruns.load(std::memory_order_relaxed),
+         (unsigned long) nEvents);
+      for (size_t ii = 0; ii < std::min(nEvents, MaxBufferEvents); ++ii) {
+         const auto &event = mBufferEvents[ii];
+         wxLogInfo("%s at %.3f s, track time %.3f s: %lu samples",
+            event.type == BufferEvent::PlaybackUnderrun
+               ? "Playback underrun" : "Capture overrun",
+            event.streamTime, event.trackTime,
+            (unsigned long) event.samples);
+      }
+   }
+   if (mAdaptiveBuffering.limit > 0)
+      wxLogInfo(
+         "Adaptive playback buffering: %llu grows, %llu shrinks, "
+         "between %.3f s and %.3f s, finally %.3f s",
+         mAdaptiveBuffering.grows, mAdaptiveBuffering.shrinks,
+         mAdaptiveBuffering.lowestLimit / mRate,
+         mAdaptiveBuffering.highestLimit / mRate,
+         mAdaptiveBuffering.limit / mRate);
    mOwningProject = nullptr;
 
    if (pListener && mNumCaptureChannels > 0)
@@ -2753,24 +2882,49 @@ AudioThread::ExitCode AudioThread::Entry()
       auto loopPassStart = Clock::now();
       const auto interval = ScrubPollInterval_ms;
 
+      // Take the wakeup request before the exchange, so that one made
+      // during the exchange is not lost
+      const bool woken = gAudioIO->mAudioThreadWakePending.exchange(false);
+      const Clock::time_point wakeTime{ Clock::duration{
+         gAudioIO->mAudioThreadWakeTime.load(std::memory_order_relaxed) } };
+      bool exchanged = false;
+
       // Set LoopActive outside the tests to avoid race condition
       gAudioIO->mAudioThreadTrackBufferExchangeLoopActive = true;
       if( gAudioIO->mAudioThreadShouldCallTrackBufferExchangeOnce )
       {
          gAudioIO->TrackBufferExchange();
          gAudioIO->mAudioThreadShouldCallTrackBufferExchangeOnce = false;
+         exchanged = true;
       }
       else if( gAudioIO->mAudioThreadTrackBufferExchangeLoopRunning )
       {
          gAudioIO->TrackBufferExchange();
+         exchanged = true;
       }
       gAudioIO->mAudioThreadTrackBufferExchangeLoopActive = false;
 
-      if ( gAudioIO->mPlaybackSchedule.Interactive() )
-         std::this_thread::sleep_until(
-            loopPassStart + std::chrono::milliseconds( interval ) );
-      else
-         Sleep(10);
+      if (exchanged) {
+         auto &stats = gAudioIO->mWakeupStatistics;
+         if (woken) {
+            const std::chrono::duration<double, std::milli> latency =
+               Clock::now() - wakeTime;
+            ++stats.wakeups;
+            stats.totalLatencyMs += latency.count();
+            stats.maxLatencyMs = std::max(stats.maxLatencyMs, latency.count());
+         }
+         else
+            ++stats.timeouts;
+      }
+
+      // Sleep until the PortAudio callback finds work for us, but no longer
+      // than the old polling interval, which remains as a fallback
+      const auto deadline = gAudioIO->mPlaybackSchedule.Interactive()
+         ? loopPassStart + std::chrono::milliseconds( interval )
+         : Clock::now() + std::chrono::milliseconds( 10 );
+      std::unique_lock<std::mutex> lock{ gAudioIO->mAudioThreadWakeMutex };
+      gAudioIO->mAudioThreadWakeCondition.wait_until( lock, deadline,
+         [gAudioIO]{ return gAudioIO->mAudioThreadWakePending.load(); } );
    }
 
    return 0;
@@ -2779,10 +2933,14 @@ AudioThread::ExitCode AudioThread::Entry()
 
 size_t AudioIO::GetCommonlyFreePlayback()
 {
-   auto commonlyAvail = mPlaybackBuffers[0]->AvailForPut();
-   for (unsigned i = 1; i < mPlaybackTracks.size(); ++i)
-      commonlyAvail = std::min(commonlyAvail,
-         mPlaybackBuffers[i]->AvailForPut());
+   // All tracks share the positions in the buffer
+   auto commonlyAvail = mPlaybackBuffers->AvailForPut();
+   if (const auto limit = mAdaptiveBuffering.limit) {
+      // Adaptive mode fills only up to the limit
+      const auto ready = mPlaybackBuffers->AvailForGet();
+      commonlyAvail =
+         std::min(commonlyAvail, limit - std::min(limit, ready));
+   }
    // MB: subtract a few samples because the code in TrackBufferExchange has rounding
    // errors
    return commonlyAvail - std::min(size_t(10), commonlyAvail);
@@ -2793,11 +2951,7 @@ size_t AudioIoCallback::GetCommonlyReadyPlayback()
    if (mPlaybackTracks.empty())
       return 0;
 
-   auto commonlyAvail = mPlaybackBuffers[0]->AvailForGet();
-   for (unsigned i = 1; i < mPlaybackTracks.size(); ++i)
-      commonlyAvail = std::min(commonlyAvail,
-         mPlaybackBuffers[i]->AvailForGet());
-   return commonlyAvail;
+   return mPlaybackBuffers->AvailForGet();
 }
 
 size_t AudioIO::GetCommonlyAvailCapture()
@@ -2823,6 +2977,8 @@ void AudioIO::FillPlayBuffers()
    if (mPlaybackTracks.empty())
       return;
 
+   AdaptPlaybackBuffering();
+
    // Though extremely unlikely, it is possible that some buffers
    // will have more samples available than others.  This could happen
    // if we hit this code during the PortAudio callback.  To keep
@@ -2861,6 +3017,12 @@ void AudioIO::FillPlayBuffers()
    do {
       const auto [frames, toProduce, progress] = GetPlaybackSlice(available);
 
+      // Tell the callback, before it can consume the last samples, that
+      // running dry after them is the end of play and not an underrun
+      if (!mPlaybackSchedule.Looping() && !mPlaybackSchedule.Interactive() &&
+          mPlaybackSchedule.RealTimeRemaining() <= 0)
+         mPlaybackSupplyEnded.store(true, std::memory_order_relaxed);
+
       // Update the time queue.  This must be done before writing to the
       // ring buffers of samples, for proper synchronization with the
       // consumer side in the PortAudio thread, which reads the time
@@ -2870,25 +3032,14 @@ void AudioIO::FillPlayBuffers()
          (mPlaybackSchedule.Interactive() ? mScrubSpeed : 1.0),
          frames);
 
-      for (size_t i = 0; i < mPlaybackTracks.size(); i++)
-      {
-         // The mixer here isn't actually mixing: it's just doing
-         // resampling, format conversion, and possibly time track
-         // warping
-         if (frames > 0)
-         {
-            size_t produced = 0;
-            if ( toProduce )
-               produced = mPlaybackMixers[i]->Process( toProduce );
-            //wxASSERT(processed <= toProduce);
-            auto warpedSamples = mPlaybackMixers[i]->GetBuffer();
-            const auto put = mPlaybackBuffers[i]->Put(
-               warpedSamples, floatSample, produced, frames - produced);
-            // wxASSERT(put == frames);
-            // but we can't assert in this thread
-            wxUnusedVar(put);
-         }
-      }
+      if (frames > 0)
+         MixPlaybackTracks(frames, toProduce);
+
+      // Publish the samples of all tracks at once
+      const auto put = mPlaybackBuffers->Commit(frames);
+      // wxASSERT(put == frames);
+      // but we can't assert in this thread
+      wxUnusedVar(put);
 
       available -= frames;
       wxASSERT(available >= 0);
@@ -2897,6 +3048,110 @@ void AudioIO::FillPlayBuffers()
    } while (!done);
 }
 
+void AudioIO::MixPlaybackTracks(const size_t frames, const size_t toProduce)
+{
+   using Clock = std::chrono::steady_clock;
+   const auto sliceStart = Clock::now();
+
+   const auto mixOne = [&](size_t i){
+      // The mixer here isn't actually mixing: it's just doing
+      // resampling, format conversion, and possibly time track
+      // warping
+      size_t produced = 0;
+      if ( toProduce )
+         produced = mPlaybackMixers[i]->Process( toProduce );
+      //wxASSERT(processed <= toProduce);
+      auto warpedSamples = mPlaybackMixers[i]->GetBuffer();
+      // Each track has its own channel in the buffer, so the tracks
+      // may be written in parallel; all are published together after
+      mPlaybackBuffers->Put(i,
+         warpedSamples, floatSample, produced, frames - produced);
+   };
+
+   const auto nTracks = mPlaybackTracks.size();
+   const auto nSlots = std::min(nTracks, mPlaybackMixThreads);
+   if (nSlots <= 1)
+      for (size_t i = 0; i < nTracks; ++i)
+         mixOne(i);
+   else {
+      // Each thread takes the next track not yet taken, so that threads
+      // that drew cheap tracks take on more of the others.  Playback has a
+      // deadline, so the workers take this before jobs of the main thread.
+      std::atomic<size_t> next{ 0 };
+      WorkerPool::Get().Run(nSlots, [&](size_t){
+         for (size_t i; (i = next++) < nTracks;)
+            mixOne(i);
+      }, WorkerPool::Priority::Urgent);
+   }
+
+   const std::chrono::duration<double, std::milli> elapsed =
+      Clock::now() - sliceStart;
+   ++mMixStatistics.slices;
+   mMixStatistics.totalMs += elapsed.count();
+   mMixStatistics.maxMs = std::max(mMixStatistics.maxMs, elapsed.count());
+   mMixStatistics.lastMs = elapsed.count();
+}
+
+void AudioIO::AdaptPlaybackBuffering()
+{
+   auto &adaptive = mAdaptiveBuffering;
+   if (adaptive.limit == 0)
+      return;
+
+   auto limit = adaptive.limit;
+   const auto underruns = mPlaybackUnderruns.load(std::memory_order_relaxed);
+   if (underruns != adaptive.underrunsSeen) {
+      // The callback ran dry; recover quickly
+      adaptive.underrunsSeen = underruns;
+      limit *= 2;
+   }
+   else if (mMixStatistics.slices == adaptive.slicesSeen)
+      // Nothing new to judge by
+      return;
+   else {
+      adaptive.slicesSeen = mMixStatistics.slices;
+      // A fill starts when half the limit remains queued
+      const auto queuedMs = 500.0 * limit / mRate;
+      if (mMixStatistics.lastMs > queuedMs / 2)
+         // One slow fill more could run dry
+         limit += limit / 2;
+      else if (++adaptive.quietFills >= AdaptiveQuietFills &&
+               mMixStatistics.lastMs < queuedMs / 8)
+         limit -= limit / 4;
+      else
+         return;
+   }
+
+   limit = std::clamp(limit, adaptive.minLimit, adaptive.maxLimit);
+   if (limit == adaptive.limit) {
+      adaptive.quietFills = 0;
+      return;
+   }
+   if (limit > adaptive.limit)
+      ++adaptive.grows;
+   else
+      ++adaptive.shrinks;
+   SetPlaybackFillLimit(limit);
+}
+
+void AudioIO::SetPlaybackFillLimit(size_t limit)
+{
+   auto &adaptive = mAdaptiveBuffering;
+   adaptive.limit = limit;
+   adaptive.quietFills = 0;
+   adaptive.lowestLimit = std::min(adaptive.lowestLimit, limit);
+   adaptive.highestLimit = std::max(adaptive.highestLimit, limit);
+
+   mPlaybackSamplesToCopy = std::max<size_t>(1, limit / 2);
+   mPlaybackQueueMinimum = mPlaybackSamplesToCopy;
+
+   // Wake when the queue falls to the limit less one batch; the callback
+   // compares against all the free space, not only that below the limit
+   mPlaybackWakeWatermark.store(
+      adaptive.capacity - limit + mPlaybackSamplesToCopy + 10,
+      std::memory_order_relaxed);
+}
+
 PlaybackSlice AudioIO::GetPlaybackSlice(const size_t available)
 {
    // How many samples to produce for each channel.
@@ -3050,26 +3305,21 @@ void AudioIO::DrainRecordBuffers()
 
       double deltat = avail / mRate;
 
+      // If the writer is behind, leave the samples in the ring buffers for
+      // now, unless this is the last exchange
       if (mAudioThreadShouldCallTrackBufferExchangeOnce ||
-          deltat >= mMinCaptureSecsToCopy)
+          (deltat >= mMinCaptureSecsToCopy && !mRecordingWriter->IsFull()))
       {
-         // This scope may combine many appendings of wave tracks,
-         // and also an autosave, into one transaction,
-         // lessening the number of checkpoints
-         Optional<TransactionScope> pScope;
-         if (mOwningProject) {
-            auto &pIO = ProjectFileIO::Get(*mOwningProject);
-            pScope.emplace(pIO.GetConnection(), "Recording");
-         }
-
-         bool newBlocks = false;
-
-         // Append captured samples to the end of the WaveTracks.
-         // The WaveTracks have their own buffering for efficiency.
+         // Gather captured samples for the end of the WaveTracks.
+         // The writer appends them, and the WaveTracks have their own
+         // buffering for efficiency.
          auto numChannels = mCaptureTracks.size();
+         RecordedSamples recorded;
+         recorded.channels.resize(numChannels);
 
          for( size_t i = 0; i < numChannels; i++ )
          {
+            auto &runs = recorded.channels[i];
             sampleFormat trackFormat = mCaptureTracks[i]->GetSampleFormat();
 
             size_t discarded = 0;
@@ -3081,9 +3331,9 @@ void AudioIO::DrainRecordBuffers()
                   // Once only (per track per recording), insert some initial
                   // silence.
                   size_t size = floor( correction * mRate * mFactor);
-                  SampleBuffer temp(size, trackFormat);
-                  ClearSamples(temp.ptr(), trackFormat, 0, size);
-                  mCaptureTracks[i]->Append(temp.ptr(), trackFormat, size, 1);
+                  ArrayOf<char> temp{ size * SAMPLE_SIZE(trackFormat) };
+                  ClearSamples((samplePtr)temp.get(), trackFormat, 0, size);
+                  runs.push_back({ std::move(temp), trackFormat, size });
                }
                else {
                   // Leftward shift
@@ -3120,7 +3370,7 @@ void AudioIO::DrainRecordBuffers()
 
             wxASSERT(discarded <= avail);
             size_t toGet = avail - discarded;
-            SampleBuffer temp;
+            ArrayOf<char> temp;
             size_t size;
             sampleFormat format;
             if( mFactor == 1.0 )
@@ -3132,9 +3382,9 @@ void AudioIO::DrainRecordBuffers()
                   format = floatSample;
                else
                   format = trackFormat;
-               temp.Allocate(size, format);
-               const auto got =
-                  mCaptureBuffers[i]->Get(temp.ptr(), format, toGet);
+               temp.reinit(size * SAMPLE_SIZE(format));
+               const auto got = mCaptureBuffers[i]->Get(
+                  (samplePtr)temp.get(), format, toGet);
                // wxASSERT(got == toGet);
                // but we can't assert in this thread
                wxUnusedVar(got);
@@ -3146,7 +3396,7 @@ void AudioIO::DrainRecordBuffers()
                size = lrint(toGet * mFactor);
                format = floatSample;
                SampleBuffer temp1(toGet, floatSample);
-               temp.Allocate(size, format);
+               temp.reinit(size * SAMPLE_SIZE(format));
                const auto got =
                   mCaptureBuffers[i]->Get(temp1.ptr(), floatSample, toGet);
                // wxASSERT(got == toGet);
@@ -3161,7 +3411,7 @@ void AudioIO::DrainRecordBuffers()
                      toGet = floor(remainingSamples);
                   const auto results =
                   mResample[i]->Process(mFactor, (float *)temp1.ptr(), toGet,
-                                        !IsStreamActive(), (float *)temp.ptr(), size);
+                                        !IsStreamActive(), (float *)temp.get(), size);
                   size = results.second;
                }
             }
@@ -3172,7 +3422,7 @@ void AudioIO::DrainRecordBuffers()
                if (crossfadeLength) {
                   auto ratio = double(crossfadeStart) / totalCrossfadeLength;
                   auto ratioStep = 1.0 / totalCrossfadeLength;
-                  auto pCrossfadeDst = (float*)temp.ptr();
+                  auto pCrossfadeDst = (float*)temp.get();
 
                   // Crossfade loop here
                   for (size_t ii = 0; ii < crossfadeLength; ++ii) {
@@ -3183,22 +3433,15 @@ void AudioIO::DrainRecordBuffers()
                }
             }
 
-            // Now append
-            // see comment in second handler about guarantee
-            newBlocks = mCaptureTracks[i]->Append(temp.ptr(), format, size, 1)
-               || newBlocks;
+            runs.push_back({ std::move(temp), format, size });
          } // end loop over capture channels
 
+         // Now hand off for appending
+         mRecordingWriter->Post(std::move(recorded));
+
          // Now update the recording schedule position
          mRecordingSchedule.mPosition += avail / mRate;
          mRecordingSchedule.mLatencyCorrected = latencyCorrected;
-
-         auto pListener = GetListener();
-         if (pListener && newBlocks)
-            pListener->OnAudioIONewBlocks(&mCaptureTracks);
-
-         if (pScope)
-            pScope->Commit();
       }
       // end of record buffering
    },
@@ -3217,6 +3460,60 @@ void AudioIO::DrainRecordBuffers()
    delayedHandler );
 }
 
+void AudioIO::WriteRecordedSamples( RecordedSamples &samples )
+{
+   if (mRecordingException)
+      // Discard what remains queued after a failure
+      return;
+
+   GuardedCall( [&] {
+      // This scope may combine many appendings of wave tracks,
+      // and also an autosave, into one transaction,
+      // lessening the number of checkpoints
+      Optional<TransactionScope> pScope;
+      if (mOwningProject) {
+         auto &pIO = ProjectFileIO::Get(*mOwningProject);
+         pScope.emplace(pIO.GetConnection(), "Recording");
+      }
+
+      bool newBlocks = false;
+
+      const auto numChannels =
+         std::min(samples.channels.size(), mCaptureTracks.size());
+      for (size_t i = 0; i < numChannels; ++i) {
+         for (auto &run : samples.channels[i])
+            // see comment in second handler about guarantee
+            newBlocks = mCaptureTracks[i]->Append(
+               (samplePtr)run.samples.get(), run.format, run.length, 1)
+               || newBlocks;
+      }
+
+      auto pListener = GetListener();
+      if (pListener && newBlocks)
+         pListener->OnAudioIONewBlocks(&mCaptureTracks);
+
+      if (pScope)
+         pScope->Commit();
+   },
+   // handler
+   [this] ( AudacityException *pException ) {
+      if ( pException ) {
+         // So that we don't attempt to append again
+         // before the main thread stops recording
+         SetRecordingException();
+         return ;
+      }
+      else
+         // Don't want to intercept other exceptions (?)
+         throw;
+   },
+   // delayed handler, in the main thread; see DrainRecordBuffers
+   [this] ( AudacityException * pException ) {
+      StopStream();
+      DefaultDelayedHandlerAction{}( pException );
+   } );
+}
+
 void AudioIoCallback::SetListener(
    const std::shared_ptr< AudioIOListener > &listener)
 {
@@ -3953,10 +4250,12 @@ bool AudioIoCallback::FillOutputBuffers(
    // These are small structures.
    WaveTrack **chans = (WaveTrack **) alloca(numPlaybackChannels * sizeof(WaveTrack *));
    float **tempBufs = (float **) alloca(numPlaybackChannels * sizeof(float *));
+   float **scratchBufs =
+      (float **) alloca(numPlaybackChannels * sizeof(float *));
 
    // And these are larger structures....
    for (unsigned int c = 0; c < numPlaybackChannels; c++)
-      tempBufs[c] = (float *) alloca(framesPerBuffer * sizeof(float));
+      scratchBufs[c] = (float *) alloca(framesPerBuffer * sizeof(float));
    // ------ End of MEMORY ALLOCATION ---------------
 
    auto & em = RealtimeEffectManager::Get();
@@ -3970,6 +4269,14 @@ bool AudioIoCallback::FillOutputBuffers(
    const auto toGet =
       std::min<size_t>(framesPerBuffer, GetCommonlyReadyPlayback());
 
+   // Running dry before the audio thread has produced all of the play is
+   // an underrun
+   if (toGet < framesPerBuffer && numPlaybackTracks > 0 &&
+       !mPlaybackSchedule.Interactive() &&
+       !mPlaybackSupplyEnded.load(std::memory_order_relaxed))
+      RecordBufferEvent(BufferEvent::PlaybackUnderrun,
+         framesPerBuffer - toGet);
+
    // The drop and dropQuickly booleans are so named for historical reasons.
    // JKC: The original code attempted to be faster by doing nothing on silenced audio.
    // This, IMHO, is 'premature optimisation'.  Instead clearer and cleaner code would
@@ -4004,6 +4311,8 @@ bool AudioIoCallback::FillOutputBuffers(
       if ( firstChannel )
       {
          selected = vt->GetSelected();
+         // The previous track may have been read in place
+         std::copy(scratchBufs, scratchBufs + numPlaybackChannels, tempBufs);
          // IF mono THEN clear 'the other' channel.
          if ( lastChannel && (numPlaybackChannels>1)) {
             // TODO: more-than-two-channels
@@ -4020,16 +4329,22 @@ bool AudioIoCallback::FillOutputBuffers(
 
       if (dropQuickly)
       {
-         len = mPlaybackBuffers[t]->Discard(toGet);
+         // Samples are discarded for all tracks at once, below
+         len = toGet;
          // keep going here.  
          // we may still need to issue a paComplete.
       }
       else
       {
-         len = mPlaybackBuffers[t]->Get((samplePtr)tempBufs[chanCnt],
-                                                   floatSample,
-                                                   toGet);
-         // wxASSERT( len == toGet );
+         len = toGet;
+         // Realtime effects apply only to selected tracks, so others can be
+         // mixed from the buffer in place, if it doesn't wrap around here
+         const auto spans = mPlaybackBuffers->GetSpans(t, len);
+         if (!selected && spans[1].length == 0 && len == framesPerBuffer)
+            tempBufs[chanCnt] = reinterpret_cast<float*>(spans[0].data);
+         else
+            mPlaybackBuffers->Get(t, (samplePtr)tempBufs[chanCnt],
+               floatSample, len);
          if (len < framesPerBuffer)
             // This used to happen normally at the end of non-looping
             // plays, but it can also be an anomalous case where the
@@ -4093,6 +4408,10 @@ bool AudioIoCallback::FillOutputBuffers(
       chanCnt = 0;
    }
 
+   // Consume the samples of all tracks, now that they are mixed
+   if (numPlaybackTracks > 0)
+      mPlaybackBuffers->Discard(toGet);
+
    // Poke: If there are no playback tracks, then the earlier check
    // about the time indicator being past the end won't happen;
    // do it here instead (but not if looping or scrubbing)
@@ -4197,6 +4516,7 @@ void AudioIoCallback::DrainInputBuffers(
 
    if (len < framesPerBuffer)
    {
+      RecordBufferEvent(BufferEvent::CaptureOverrun, framesPerBuffer - len);
       mLostSamples += (framesPerBuffer - len);
       wxPrintf(wxT("lost %d samples\n"), (int)(framesPerBuffer - len));
    }
@@ -4586,9 +4906,56 @@ int AudioIoCallback::AudioCallback(
 
    SendVuOutputMeterData( outputMeterFloats, framesPerBuffer);
 
+   CheckAudioThreadWatermarks();
+
    return mCallbackReturn;
 }
 
+void AudioIoCallback::WakeAudioThread()
+{
+   // Don't lock the mutex:  this is called from the PortAudio callback.
+   // The notification may then, rarely, reach the audio thread just before
+   // it waits, and it wakes at its timeout as it did before.
+   if (!mAudioThreadWakePending.load(std::memory_order_acquire)) {
+      mAudioThreadWakeTime.store(
+         std::chrono::steady_clock::now().time_since_epoch().count(),
+         std::memory_order_relaxed);
+      mAudioThreadWakePending.store(true, std::memory_order_release);
+      mAudioThreadWakeCondition.notify_one();
+   }
+}
+
+void AudioIoCallback::RecordBufferEvent(
+   BufferEvent::Type type, size_t samples)
+{
+   if (type == BufferEvent::PlaybackUnderrun)
+      mPlaybackUnderruns.fetch_add(1, std::memory_order_relaxed);
+
+   // This thread is the only writer
+   const auto nEvents = mnBufferEvents.load(std::memory_order_relaxed);
+   if (nEvents < MaxBufferEvents) {
+      const std::chrono::duration<double> streamTime =
+         std::chrono::steady_clock::now() - mStreamStartClock;
+      mBufferEvents[nEvents] = {
+         type, streamTime.count(), mPlaybackSchedule.GetTrackTime(), samples };
+   }
+   mnBufferEvents.store(nEvents + 1, std::memory_order_release);
+}
+
+void AudioIoCallback::CheckAudioThreadWatermarks()
+{
+   if (mAudioThreadWakePending.load(std::memory_order_relaxed))
+      return;
+
+   // One buffer of each kind stands for all, as in the exchange
+   if ((!mPlaybackTracks.empty() &&
+         mPlaybackBuffers->AvailForPut() >=
+            mPlaybackWakeWatermark.load(std::memory_order_relaxed)) ||
+       (!mCaptureTracks.empty() &&
+         mCaptureBuffers[0]->AvailForGet() >= mCaptureWakeWatermark))
+      WakeAudioThread();
+}
+
 int AudioIoCallback::CallbackDoSeek()
 {
    const int token = mStreamToken;
@@ -4619,17 +4986,19 @@ int AudioIoCallback::CallbackDoSeek()
    {
       const bool skipping = true;
       mPlaybackMixers[i]->Reposition( time, skipping );
-      const auto toDiscard =
-         mPlaybackBuffers[i]->AvailForGet();
-      const auto discarded =
-         mPlaybackBuffers[i]->Discard( toDiscard );
+   }
+   if (numPlaybackTracks > 0) {
+      const auto toDiscard = mPlaybackBuffers->AvailForGet();
+      const auto discarded = mPlaybackBuffers->Discard( toDiscard );
       // wxASSERT( discarded == toDiscard );
       // but we can't assert in this thread
       wxUnusedVar(discarded);
    }
 
    // Reload the ring buffers
+   mPlaybackSupplyEnded.store(false, std::memory_order_relaxed);
    mAudioThreadShouldCallTrackBufferExchangeOnce = true;
+   WakeAudioThread();
    while( mAudioThreadShouldCallTrackBufferExchangeOnce )
    {
       wxMilliSleep( 50 );
@@ -18,6 +18,10 @@
 #include "AudioIOBase.h" // to inherit
 #include "PlaybackSchedule.h" // member variable
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -34,9 +38,12 @@ class wxArrayString;
 class AudioIOBase;
 class AudioIO;
 class RingBuffer;
+class MultiRingBuffer;
 class Mixer;
 class Resample;
 class AudioThread;
+class RecordingWriter;
+struct RecordedSamples;
 class SelectedRegion;
 
 class AudacityProject;
@@ -387,11 +394,15 @@ public:
 #endif
 
    std::unique_ptr<AudioThread> mThread;
+   //! Appends drained samples to mCaptureTracks, so the audio thread never
+   //! waits for the project file
+   std::unique_ptr<RecordingWriter> mRecordingWriter;
 
    ArrayOf<std::unique_ptr<Resample>> mResample;
    ArrayOf<std::unique_ptr<RingBuffer>> mCaptureBuffers;
    WaveTrackArray      mCaptureTracks;
-   ArrayOf<std::unique_ptr<RingBuffer>> mPlaybackBuffers;
+   //! One channel for each of mPlaybackTracks
+   std::unique_ptr<MultiRingBuffer> mPlaybackBuffers;
    WaveTrackArray      mPlaybackTracks;
 
    ArrayOf<std::unique_ptr<Mixer>> mPlaybackMixers;
@@ -424,6 +435,91 @@ public:
 
    std::atomic<bool>   mForceFadeOut{ false };
 
+   //! Wake the audio thread early, rather than let it sleep out its poll
+   //! interval; safe to call from the PortAudio callback, which never locks
+   void WakeAudioThread();
+   //! Called by the PortAudio callback; wakes the audio thread when the
+   //! free playback space or the captured samples pass their watermarks
+   void CheckAudioThreadWatermarks();
+
+   //! Time from a wakeup request to completion of the exchange it caused
+   struct WakeupStatistics {
+      unsigned long long wakeups{ 0 };
+      //! Passes of the audio thread that ended by timeout instead
+      unsigned long long timeouts{ 0 };
+      double totalLatencyMs{ 0 };
+      double maxLatencyMs{ 0 };
+   };
+
+   std::mutex          mAudioThreadWakeMutex;
+   std::condition_variable mAudioThreadWakeCondition;
+   std::atomic<bool>   mAudioThreadWakePending{ false };
+   //! When the pending wakeup was requested
+   std::atomic<std::chrono::steady_clock::rep> mAudioThreadWakeTime{ 0 };
+   /// Free playback space, in samples, that wakes the audio thread
+   std::atomic<size_t> mPlaybackWakeWatermark{ 0 };
+   /// Captured samples that wake the audio thread
+   size_t              mCaptureWakeWatermark{ 0 };
+   //! Written only by the audio thread, read after it has stopped
+   WakeupStatistics    mWakeupStatistics;
+
+   //! Time spent by the mixers of all playback tracks in each slice
+   struct MixStatistics {
+      unsigned long long slices{ 0 };
+      double totalMs{ 0 };
+      double maxMs{ 0 };
+      double lastMs{ 0 };
+   };
+
+   /// How many threads may run the playback mixers at once
+   size_t              mPlaybackMixThreads{ 1 };
+   //! Written only by the audio thread, read after it has stopped
+   MixStatistics       mMixStatistics;
+
+   //! A shortage of playback samples, or of capture space, in the callback
+   struct BufferEvent {
+      enum Type : unsigned char { PlaybackUnderrun, CaptureOverrun } type;
+      //! Seconds since the stream started
+      double streamTime;
+      //! Position in the tracks when it happened
+      double trackTime;
+      //! Samples replaced with silence, or lost
+      size_t samples;
+   };
+   static constexpr size_t MaxBufferEvents = 256;
+
+   //! Called only by the PortAudio callback; doesn't allocate
+   void RecordBufferEvent(BufferEvent::Type type, size_t samples);
+
+   std::chrono::steady_clock::time_point mStreamStartClock;
+   //! Events beyond MaxBufferEvents are counted but not kept
+   std::array<BufferEvent, MaxBufferEvents> mBufferEvents;
+   std::atomic<size_t> mnBufferEvents{ 0 };
+   std::atomic<unsigned long long> mPlaybackUnderruns{ 0 };
+   //! Set by the audio thread when it has produced the last of the play, so
+   //! that the callback doesn't count the draining of the buffer as underrun
+   std::atomic<bool>   mPlaybackSupplyEnded{ false };
+
+   //! Bounds of the occupancy of the playback buffer, in adaptive mode
+   struct AdaptiveBuffering {
+      //! Occupancy to fill up to; zero when not adapting
+      size_t limit{ 0 };
+      size_t minLimit{ 0 };
+      size_t maxLimit{ 0 };
+      //! Of the whole buffer
+      size_t capacity{ 0 };
+      //! Fills since the last change of limit
+      unsigned quietFills{ 0 };
+      unsigned long long slicesSeen{ 0 };
+      unsigned long long underrunsSeen{ 0 };
+      unsigned long long grows{ 0 };
+      unsigned long long shrinks{ 0 };
+      size_t lowestLimit{ 0 };
+      size_t highestLimit{ 0 };
+   };
+   //! Used only by the audio thread, and read after it has stopped
+   AdaptiveBuffering   mAdaptiveBuffering;
+
    wxLongLong          mLastPlaybackTimeMillis;
 
    volatile double     mLastRecordingOffset;
@@ -731,6 +827,18 @@ private:
 
    //! First part of TrackBufferExchange
    void FillPlayBuffers();
+   //! Called by FillPlayBuffers in adaptive mode, to grow the buffered
+   //! playback after underruns or slow fills, or shrink it after a quiet time
+   void AdaptPlaybackBuffering();
+   //! Fill the playback buffer only up to limit samples, and refill in
+   //! batches of half as many
+   void SetPlaybackFillLimit(size_t limit);
+   //! Called by FillPlayBuffers for each slice; runs the mixers of
+   //! several tracks at once, if so configured
+   void MixPlaybackTracks(
+      size_t frames, //!< how many samples to buffer for each track
+      size_t toProduce //!< how many of them come from the mixers
+   );
    //! Called one or more times by FillPlayBuffers
    PlaybackSlice GetPlaybackSlice(
       size_t available //!< how many more samples may be buffered
@@ -744,6 +852,8 @@ private:
 
    //! Second part of TrackBufferExchange
    void DrainRecordBuffers();
+   //! Called by mRecordingWriter in its own thread with what DrainRecordBuffers posted
+   void WriteRecordedSamples( RecordedSamples &samples );
 
    /** \brief Get the number of audio samples free in all of the playback
    * buffers.
@@ -18,6 +18,10 @@ of sample block storage.
 
 #include "Benchmark.h"
 
+#include <cmath>
+#include <initializer_list>
+#include <type_traits>
+
 #include <wx/app.h>
 #include <wx/log.h>
 #include <wx/textctrl.h>
@@ -34,11 +38,15 @@ of sample block storage.
 #include <wx/intl.h>
 
 #include "SampleBlock.h"
+#include "SampleBlockCache.h"
 #include "ShuttleGui.h"
 #include "Project.h"
 #include "WaveClip.h"
 #include "WaveTrack.h"
 #include "Sequence.h"
+#include "MixKernels.h"
+#include "SummaryKernels.h"
+#include "WorkerPool.h"
 #include "Prefs.h"
 #include "ProjectRate.h"
 #include "ViewInfo.h"
@@ -64,6 +72,12 @@ public:
 private:
    // WDR: handler declarations
    void OnRun( wxCommandEvent &event );
+   void OnRunKernels( wxCommandEvent &event );
+   void OnRunReads( wxCommandEvent &event );
+   void OnRunBlockSizing( wxCommandEvent &event );
+   void OnRunSameFormat( wxCommandEvent &event );
+   void OnRunConversion( wxCommandEvent &event );
+   void OnRunMixing( wxCommandEvent &event );
    void OnSave( wxCommandEvent &event );
    void OnClear( wxCommandEvent &event );
    void OnClose( wxCommandEvent &event );
@@ -72,6 +86,18 @@ private:
    void HoldPrint(bool hold);
    void FlushPrint();
 
+   struct TestTracks
+   {
+      SampleBlockFactoryPtr pFactory;
+      std::vector< std::shared_ptr<WaveTrack> > tracks;
+   };
+   //! Make a track of each format with one new factory, and append the same
+   //! numSamples samples to all, in chunks, in one batch of inserts
+   /*! @param generate returns each sample, as short or float */
+   template< typename Generate >
+   TestTracks MakeTestTracks( std::initializer_list<sampleFormat> formats,
+      size_t numSamples, const Generate &generate );
+
    AudacityProject &mProject;
    const ProjectRate &mRate;
 
@@ -85,6 +111,7 @@ private:
 
    bool      mBlockDetail;
    bool      mEditDetail;
+   bool      mBatchInserts;
 
    wxTextCtrl  *mText;
 
@@ -127,11 +154,23 @@ enum {
    BlockSizeID,
    DataSizeID,
    NumEditsID,
-   RandSeedID
+   RandSeedID,
+   KernelsID,
+   ReadsID,
+   BlockSizingID,
+   SameFormatID,
+   ConversionID,
+   MixingID
 };
 
 BEGIN_EVENT_TABLE(BenchmarkDialog, wxDialogWrapper)
    EVT_BUTTON( RunID,   BenchmarkDialog::OnRun )
+   EVT_BUTTON( KernelsID, BenchmarkDialog::OnRunKernels )
+   EVT_BUTTON( ReadsID, BenchmarkDialog::OnRunReads )
+   EVT_BUTTON( BlockSizingID, BenchmarkDialog::OnRunBlockSizing )
+   EVT_BUTTON( SameFormatID, BenchmarkDialog::OnRunSameFormat )
+   EVT_BUTTON( ConversionID, BenchmarkDialog::OnRunConversion )
+   EVT_BUTTON( MixingID, BenchmarkDialog::OnRunMixing )
    EVT_BUTTON( BSaveID,  BenchmarkDialog::OnSave )
    EVT_BUTTON( ClearID, BenchmarkDialog::OnClear )
    EVT_BUTTON( wxID_CANCEL, BenchmarkDialog::OnClose )
@@ -157,6 +196,7 @@ BenchmarkDialog::BenchmarkDialog(
 
    mBlockDetail = false;
    mEditDetail = false;
+   mBatchInserts = true;
 
    HoldPrint(false);
 
@@ -225,6 +265,11 @@ void BenchmarkDialog::MakeBenchmarkDialog()
          .AddCheckBox(XXO("Show detailed info about each editing operation"),
                            false);
 
+      //
+      S.Validator<wxGenericValidator>(&mBatchInserts)
+         .AddCheckBox(XXO("Batch the insertion of sample blocks"),
+                           true);
+
       //
       mText = S.Id(StaticTextID)
          /* i18n-hint noun */
@@ -240,6 +285,12 @@ void BenchmarkDialog::MakeBenchmarkDialog()
          S.StartHorizontalLay(wxALIGN_LEFT, false);
          {
             S.Id(RunID).AddButton(XXO("Run"), wxALIGN_CENTRE, true);
+            S.Id(KernelsID).AddButton(XXO("Summary Kernels"));
+            S.Id(ReadsID).AddButton(XXO("Read Paths"));
+            S.Id(BlockSizingID).AddButton(XXO("Block Sizing"));
+            S.Id(SameFormatID).AddButton(XXO("Same-Format Reads"));
+            S.Id(ConversionID).AddButton(XXO("Format Conversion"));
+            S.Id(MixingID).AddButton(XXO("Mix Kernels"));
             S.Id(BSaveID).AddButton(XXO("Save"));
             /* i18n-hint verb; to empty or erase */
             S.Id(ClearID).AddButton(XXO("Clear"));
@@ -320,6 +371,39 @@ void BenchmarkDialog::FlushPrint()
    mToPrint = wxT("");
 }
 
+template< typename Generate >
+auto BenchmarkDialog::MakeTestTracks(
+   std::initializer_list<sampleFormat> formats,
+   size_t numSamples, const Generate &generate ) -> TestTracks
+{
+   using Sample = decltype(generate());
+   static_assert(std::is_same<Sample, short>::value ||
+      std::is_same<Sample, float>::value, "Samples must be short or float");
+   constexpr auto chunkFormat =
+      std::is_same<Sample, float>::value ? floatSample : int16Sample;
+
+   TestTracks result;
+   result.pFactory = SampleBlockFactory::New( mProject );
+   WaveTrackFactory factory{ mRate, result.pFactory };
+   for (auto format : formats)
+      result.tracks.push_back(factory.NewWaveTrack(format));
+
+   SampleBlockBatch batch{ *result.pFactory };
+   ArrayOf<Sample> chunk{ 65536 };
+   for (size_t done = 0; done < numSamples;) {
+      const auto count = std::min<size_t>(65536, numSamples - done);
+      for (size_t ii = 0; ii < count; ++ii)
+         chunk[ii] = generate();
+      for (const auto &t : result.tracks)
+         t->Append((samplePtr)chunk.get(), chunkFormat, count);
+      done += count;
+   }
+   for (const auto &t : result.tracks)
+      t->Flush();
+
+   return result;
+}
+
 void BenchmarkDialog::OnRun( wxCommandEvent & WXUNUSED(event))
 {
    TransferDataFromWindow();
@@ -360,11 +444,15 @@ void BenchmarkDialog::OnRun( wxCommandEvent & WXUNUSED(event))
    gPrefs->Flush();
 
    // Remember the old blocksize, so that we can restore it later.
+   // Test the given size, not one adapted to the edits.
    auto oldBlockSize = Sequence::GetMaxDiskBlockSize();
+   auto oldAdaptive = Sequence::GetAdaptiveBlockSize();
    Sequence::SetMaxDiskBlockSize(blockSize * 1024);
+   Sequence::SetAdaptiveBlockSize(false);
 
    const auto cleanup = finally( [&] {
       Sequence::SetMaxDiskBlockSize(oldBlockSize);
+      Sequence::SetAdaptiveBlockSize(oldAdaptive);
       gPrefs->Write(wxT("/GUI/EditClipCanMove"), editClipCanMove);
       gPrefs->Flush();
    } );
@@ -417,15 +505,25 @@ void BenchmarkDialog::OnRun( wxCommandEvent & WXUNUSED(event))
    wxString tempStr;
    wxStopWatch timer;
 
-   for (uint64_t i = 0; i < nChunks; i++) {
-      v = SampleType(rand());
-      small1[i] = v;
-      for (uint64_t b = 0; b < chunkSize; b++)
-         block[b] = v;
+   {
+      Optional<SampleBlockBatch> batch;
+      if (mBatchInserts)
+         batch.emplace(*t->GetSampleBlockFactory());
+
+      for (uint64_t i = 0; i < nChunks; i++) {
+         v = SampleType(rand());
+         small1[i] = v;
+         for (uint64_t b = 0; b < chunkSize; b++)
+            block[b] = v;
 
-      t->Append((samplePtr)block.get(), SampleFormat, chunkSize);
+         t->Append((samplePtr)block.get(), SampleFormat, chunkSize);
+      }
+      t->Flush();
    }
-   t->Flush();
+
+   elapsed = timer.Time();
+   Printf( XO("Time to append %.1f MB: %ld ms\n")
+      .Format( nChunks*chunkSize*sizeof(SampleType)/1048576.0, elapsed ) );
 
    // This forces the WaveTrack to flush all of the appends (which is
    // only necessary if you want to access the Sequence class directly,
@@ -582,3 +680,572 @@ void BenchmarkDialog::OnRun( wxCommandEvent & WXUNUSED(event))
    Printf( XO("Benchmark completed successfully.\n") );
    HoldPrint(false);
 }
+
+void BenchmarkDialog::OnRunKernels( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long randSeed;
+   mRandSeedStr.ToLong(&randSeed);
+   srand(randSeed);
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   // Scan a buffer repeatedly, rather than allocate the whole gigabyte
+   constexpr size_t bufferBytes = 16 * 1048576;
+   constexpr size_t totalBytes = 1024 * 1048576;
+   constexpr auto passes = totalBytes / bufferBytes;
+   ArrayOf<char> buffer{ bufferBytes };
+
+   using namespace SummaryKernels;
+
+   Printf( XO("Computing min, max and RMS of %.1f MB of each sample format.\n")
+      .Format( totalBytes / 1048576.0 ) );
+   Printf( XO("Best instruction set is %s.\n").Format( Name( Best() ) ) );
+
+   bool bad = false;
+   for (auto format : { int16Sample, int24Sample, floatSample }) {
+      const auto numSamples = bufferBytes / SAMPLE_SIZE(format);
+      for (size_t ii = 0; ii < numSamples; ++ii) {
+         switch (format) {
+         case int16Sample:
+            ((short *)buffer.get())[ii] = short(rand());
+            break;
+         case int24Sample:
+            ((int *)buffer.get())[ii] = int(
+               ((unsigned(rand()) << 12) ^ unsigned(rand())) % 8388608u) *
+               ((ii & 1) ? -1 : 1);
+            break;
+         default:
+            ((float *)buffer.get())[ii] = 2.0f * rand() / RAND_MAX - 1.0f;
+            break;
+         }
+      }
+
+      Printf( XO("%s:\n").Format( GetSampleFormatStr( format ) ) );
+
+      Result expected;
+      for (auto set :
+         { InstructionSet::Scalar, InstructionSet::SSE2, InstructionSet::AVX2 }
+      ) {
+         if (!IsAvailable(set))
+            continue;
+
+         wxTheApp->Yield();
+         wxStopWatch timer;
+         Result result;
+         for (size_t pass = 0; pass < passes; ++pass)
+            result = Compute(buffer.get(), format, numSamples, set);
+         const auto elapsed = std::max(1L, timer.Time());
+
+         if (set == InstructionSet::Scalar)
+            expected = result;
+         else if (result.min != expected.min ||
+            result.max != expected.max ||
+            fabs(result.sumsq - expected.sumsq) > 1e-4 * expected.sumsq) {
+            Printf( XO("   %s results differ from scalar results!\n")
+               .Format( Name( set ) ) );
+            bad = true;
+         }
+
+         Printf( XO("   %s: %ld ms, %.2f GB/s\n")
+            .Format( Name( set ), elapsed,
+               totalBytes / 1073741824.0 / (elapsed / 1000.0) ) );
+      }
+      FlushPrint();
+   }
+
+   if (bad)
+      Printf( XO("TEST FAILED!!!\n") );
+   else
+      Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
+
+void BenchmarkDialog::OnRunReads( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long dataSize, randSeed;
+   mDataSizeStr.ToLong(&dataSize);
+   mRandSeedStr.ToLong(&randSeed);
+
+   if (dataSize < 1 || dataSize > 2000) {
+      AudacityMessageBox(
+         XO("Test data size should be in the range 1 - 2000 MB.") );
+      return;
+   }
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   // Measure reads from the database, not from the cache of block contents.
+   // Each broadcast of preferences restores the budget of the cache, so
+   // empty it again after each.
+   auto &cache = SampleBlockCache::Get(mProject);
+   const auto directReadsKey = wxT("/Performance/DirectSampleReads");
+   bool directReads = true;
+   gPrefs->Read(directReadsKey, &directReads);
+   auto setDirectReads = [&](bool direct){
+      gPrefs->Write(directReadsKey, direct);
+      gPrefs->Flush();
+      PrefsListener::Broadcast();
+      cache.SetBudget(0);
+   };
+   const auto cleanup = finally( [&] {
+      gPrefs->Write(directReadsKey, directReads);
+      gPrefs->Flush();
+      PrefsListener::Broadcast();
+   } );
+   cache.SetBudget(0);
+
+   srand(randSeed);
+
+   const size_t numSamples = dataSize * 1048576ull / sizeof(SampleType);
+   Printf( XO("Preparing %.1f MB of %s samples...\n")
+      .Format( numSamples * sizeof(SampleType) / 1048576.0,
+         GetSampleFormatStr( SampleFormat ) ) );
+   wxTheApp->Yield();
+   FlushPrint();
+
+   const auto test = MakeTestTracks( { SampleFormat }, numSamples,
+      []{ return SampleType(rand()); } );
+   const auto &pFactory = test.pFactory;
+   const auto &t = test.tracks[0];
+
+   // Read as the audio thread does for playback: float, in small pieces
+   const auto rate = mRate.GetRate();
+   const auto seconds = numSamples / rate;
+   constexpr size_t readSize = 4096;
+   Floats buffer{ readSize };
+   Printf( XO("Reading %.1f seconds at %.0f Hz as float, %d samples at a time.\n")
+      .Format( seconds, rate, (int)readSize ) );
+
+   for (bool direct : { false, true }) {
+      setDirectReads(direct);
+      wxTheApp->Yield();
+
+      const auto before = pFactory->GetReadStatistics();
+      wxStopWatch timer;
+      for (size_t start = 0; start < numSamples; start += readSize) {
+         const auto len = std::min(readSize, numSamples - start);
+         t->GetFloats(buffer.get(), start, len);
+      }
+      const auto elapsed = std::max(1L, timer.Time());
+      const auto after = pFactory->GetReadStatistics();
+
+      const auto staged = after.staged - before.staged;
+      const auto delivered = after.delivered - before.delivered;
+      Printf( XO("%s: %ld ms, %.1f KB copied per played second (%.1f staged, %.1f delivered)\n")
+         .Format( direct ? wxT("Blob handles") : wxT("Statements"),
+            elapsed,
+            (staged + delivered) / 1024.0 / seconds,
+            staged / 1024.0 / seconds,
+            delivered / 1024.0 / seconds ) );
+      FlushPrint();
+   }
+
+   Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
+
+void BenchmarkDialog::OnRunBlockSizing( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long numEdits, dataSize, randSeed;
+   mNumEditsStr.ToLong(&numEdits);
+   mDataSizeStr.ToLong(&dataSize);
+   mRandSeedStr.ToLong(&randSeed);
+
+   if (numEdits < 1 || numEdits > 10000) {
+      AudacityMessageBox(
+         XO("Number of edits should be in the range 1 - 10000.") );
+      return;
+   }
+
+   if (dataSize < 1 || dataSize > 2000) {
+      AudacityMessageBox(
+         XO("Test data size should be in the range 1 - 2000 MB.") );
+      return;
+   }
+
+   bool editClipCanMove = true;
+   gPrefs->Read(wxT("/GUI/EditClipCanMove"), &editClipCanMove);
+   gPrefs->Write(wxT("/GUI/EditClipCanMove"), false);
+   gPrefs->Flush();
+
+   // Read from the database, not from the cache of block contents
+   auto &cache = SampleBlockCache::Get(mProject);
+   const auto oldAdaptive = Sequence::GetAdaptiveBlockSize();
+   const auto cleanup = finally( [&] {
+      Sequence::SetAdaptiveBlockSize(oldAdaptive);
+      gPrefs->Write(wxT("/GUI/EditClipCanMove"), editClipCanMove);
+      gPrefs->Flush();
+      PrefsListener::Broadcast();
+   } );
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   const auto rate = mRate.GetRate();
+   const size_t numSamples = dataSize * 1048576ull / sizeof(SampleType);
+   const auto seconds = numSamples / rate;
+   Printf( XO("Editing %.1f seconds at %.0f Hz with %ld short cuts and pastes,\n then reading it all as float.\n")
+      .Format( seconds, rate, numEdits ) );
+
+   constexpr size_t readSize = 4096;
+   Floats buffer{ readSize };
+
+   for (bool adaptive : { false, true }) {
+      Sequence::SetAdaptiveBlockSize(adaptive);
+
+      // Both passes make the same edits of the same data
+      srand(randSeed);
+      const auto test = MakeTestTracks( { SampleFormat }, numSamples,
+         []{ return SampleType(rand()); } );
+      const auto &t = test.tracks[0];
+      wxTheApp->Yield();
+
+      // Move pieces of a tenth to a half second, as in editing speech
+      long maxEdit = 0;
+      wxStopWatch timer;
+      for (long z = 0; z < numEdits; ++z) {
+         const double len = 0.1 + 0.4 * rand() / RAND_MAX;
+         const double t0 = (seconds - len) * rand() / RAND_MAX;
+         const double t1 = (seconds - len) * rand() / RAND_MAX;
+         const auto before = timer.Time();
+         auto tmp = t->Cut(t0, t0 + len);
+         t->Paste(t1, tmp.get());
+         maxEdit = std::max(maxEdit, timer.Time() - before);
+      }
+      const auto editElapsed = std::max(1L, timer.Time());
+
+      const auto &blocks =
+         t->GetClipByIndex(0)->GetSequence()->GetBlockArray();
+      const auto numBlocks = blocks.size();
+
+      cache.SetBudget(0);
+      timer.Start();
+      for (size_t start = 0; start < numSamples; start += readSize) {
+         const auto len = std::min(readSize, numSamples - start);
+         t->GetFloats(buffer.get(), start, len);
+      }
+      const auto readElapsed = std::max(1L, timer.Time());
+      PrefsListener::Broadcast();
+
+      Printf( XO("%s: %llu blocks, average %.2f seconds\n")
+         .Format( adaptive ? wxT("Adaptive") : wxT("Fixed"),
+            (unsigned long long) numBlocks,
+            seconds / std::max<size_t>(1, numBlocks) ) );
+      Printf( XO("   Edits: %ld ms, %.2f ms each, at most %ld ms\n")
+         .Format( editElapsed, double(editElapsed) / numEdits, maxEdit ) );
+      Printf( XO("   Reads: %ld ms, %.1f MB/s\n")
+         .Format( readElapsed,
+            numSamples * sizeof(SampleType) / 1048576.0 /
+               (readElapsed / 1000.0) ) );
+      FlushPrint();
+      wxTheApp->Yield();
+   }
+
+   Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
+
+void BenchmarkDialog::OnRunSameFormat( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long dataSize, randSeed;
+   mDataSizeStr.ToLong(&dataSize);
+   mRandSeedStr.ToLong(&randSeed);
+
+   if (dataSize < 1 || dataSize > 2000) {
+      AudacityMessageBox(
+         XO("Test data size should be in the range 1 - 2000 MB.") );
+      return;
+   }
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   // Reads in the stored format copy straight from the decoded contents held
+   // in the cache, so make room for all of the test data; each broadcast of
+   // preferences restores the budget
+   auto &cache = SampleBlockCache::Get(mProject);
+   const auto cleanup = finally( [&] {
+      PrefsListener::Broadcast();
+   } );
+
+   srand(randSeed);
+
+   const size_t numSamples = dataSize * 1048576ull / sizeof(SampleType);
+   const auto numBytes = numSamples * sizeof(SampleType);
+   cache.SetBudget(std::max(cache.GetBudget(), 2 * numBytes));
+
+   Printf( XO("Preparing %.1f MB of %s samples...\n")
+      .Format( numBytes / 1048576.0,
+         GetSampleFormatStr( SampleFormat ) ) );
+   wxTheApp->Yield();
+   FlushPrint();
+
+   // Sum of the samples, for checking each way of reading them
+   long long expected = 0;
+   const auto test = MakeTestTracks( { SampleFormat }, numSamples, [&]{
+      const auto sample = SampleType(rand());
+      expected += sample;
+      return sample;
+   } );
+   const auto &t = test.tracks[0];
+
+   const auto &sequence = *t->GetClipByIndex(0)->GetSequence();
+   constexpr size_t readSize = 4096;
+   Floats floats{ readSize };
+   ArrayOf<SampleType> samples{ readSize };
+
+   // Fill the cache as playback does, reading whole blocks through a
+   // WaveTrackCache; then time reads that all find their blocks there
+   {
+      WaveTrackCache trackCache{ t };
+      for (size_t start = 0; start < numSamples; start += readSize)
+         trackCache.GetFloats(start,
+            std::min(readSize, numSamples - start), true);
+   }
+
+   Printf( XO("Reading %.1f MB, %d samples at a time, from cached blocks.\n")
+      .Format( numBytes / 1048576.0, (int)readSize ) );
+
+   auto report = [&](const TranslatableString &name, long elapsed,
+      long long sum, long long expected)
+   {
+      elapsed = std::max(1L, elapsed);
+      Printf( XO("%s: %ld ms, %.1f MB/s\n")
+         .Format( name, elapsed,
+            numBytes / 1048576.0 / (elapsed / 1000.0) ) );
+      if (sum != expected)
+         Printf( XO("   Error: read samples differently\n") );
+      FlushPrint();
+      wxTheApp->Yield();
+   };
+
+   // Converting to float, as for playback and effects
+   long long floatSum = 0;
+   wxStopWatch timer;
+   for (size_t start = 0; start < numSamples; start += readSize) {
+      const auto len = std::min(readSize, numSamples - start);
+      t->GetFloats(floats.get(), start, len);
+      for (size_t ii = 0; ii < len; ++ii)
+         floatSum += lrintf(floats[ii] * 32768.0f);
+   }
+   report(XO("Convert to float"), timer.Time(), floatSum, expected);
+
+   // In the stored format, which copies
+   long long copySum = 0;
+   timer.Start();
+   for (size_t start = 0; start < numSamples; start += readSize) {
+      const auto len = std::min(readSize, numSamples - start);
+      sequence.Get(
+         (samplePtr)samples.get(), SampleFormat, start, len, true);
+      for (size_t ii = 0; ii < len; ++ii)
+         copySum += samples[ii];
+   }
+   report(XO("Copy stored format"), timer.Time(), copySum, expected);
+
+   Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
+
+void BenchmarkDialog::OnRunConversion( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long dataSize, randSeed;
+   mDataSizeStr.ToLong(&dataSize);
+   mRandSeedStr.ToLong(&randSeed);
+
+   if (dataSize < 1 || dataSize > 2000) {
+      AudacityMessageBox(
+         XO("Test data size should be in the range 1 - 2000 MB.") );
+      return;
+   }
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   // Read from the database, not from the cache of block contents
+   auto &cache = SampleBlockCache::Get(mProject);
+   const auto oldThreads = Sequence::GetConversionThreads();
+   const auto cleanup = finally( [&] {
+      Sequence::SetConversionThreads(oldThreads);
+      PrefsListener::Broadcast();
+   } );
+
+   srand(randSeed);
+
+   // Each source holds the same number of samples
+   const size_t numSamples = dataSize * 1048576ull / sizeof(float);
+   Printf( XO("Preparing %llu samples in each of two formats...\n")
+      .Format( (unsigned long long) numSamples ) );
+   wxTheApp->Yield();
+   FlushPrint();
+
+   const auto test = MakeTestTracks( { floatSample, int16Sample }, numSamples,
+      []{ return 2.0f * rand() / RAND_MAX - 1.0f; } );
+   const auto &floats = test.tracks[0];
+   const auto &shorts = test.tracks[1];
+   WaveTrackFactory factory{ mRate, test.pFactory };
+
+   // Double the threads each time, ending with all of them
+   const auto concurrency = WorkerPool::Get().GetConcurrency();
+   std::vector<size_t> threadCounts;
+   for (size_t nThreads = 1; nThreads < concurrency; nThreads *= 2)
+      threadCounts.push_back(nThreads);
+   threadCounts.push_back(concurrency);
+
+   struct Case {
+      const WaveTrack &source;
+      sampleFormat format;
+   } cases[] = {
+      { *floats, int16Sample },
+      { *shorts, floatSample },
+   };
+
+   for (const auto &theCase : cases) {
+      Printf( XO("Converting %s to %s:\n")
+         .Format( GetSampleFormatStr( theCase.source.GetSampleFormat() ),
+            GetSampleFormatStr( theCase.format ) ) );
+      long base = 0;
+      for (auto nThreads : threadCounts) {
+         Sequence::SetConversionThreads(nThreads);
+         const auto copy = factory.DuplicateWaveTrack(theCase.source);
+         cache.SetBudget(0);
+         wxTheApp->Yield();
+
+         wxStopWatch timer;
+         copy->ConvertToSampleFormat(theCase.format);
+         const auto elapsed = std::max(1L, timer.Time());
+         if (nThreads == 1)
+            base = elapsed;
+
+         Printf( XO("   %llu threads: %ld ms, %.2f times as fast as one\n")
+            .Format( (unsigned long long) nThreads, elapsed,
+               double(base) / elapsed ) );
+         FlushPrint();
+      }
+   }
+
+   Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
+
+void BenchmarkDialog::OnRunMixing( wxCommandEvent & WXUNUSED(event))
+{
+   TransferDataFromWindow();
+
+   if (!Validate())
+      return;
+
+   long randSeed;
+   mRandSeedStr.ToLong(&randSeed);
+   srand(randSeed);
+
+   wxBusyCursor busy;
+
+   HoldPrint(true);
+
+   // Mix the same blocks repeatedly, as a Mixer does for each slice
+   constexpr size_t numTracks = 128;
+   constexpr size_t blockLen = 4096;
+   constexpr double rate = 44100.0;
+   constexpr double audioSeconds = 120.0;
+   const auto passes = size_t(audioSeconds * rate / blockLen);
+
+   Floats sources{ numTracks * blockLen };
+   Floats envelope{ blockLen };
+   Floats gains{ 2 * numTracks };
+   for (size_t ii = 0; ii < numTracks * blockLen; ++ii)
+      sources[ii] = 2.0f * rand() / RAND_MAX - 1.0f;
+   // A fade, as from an envelope
+   for (size_t ii = 0; ii < blockLen; ++ii)
+      envelope[ii] = float(ii) / blockLen;
+   for (size_t ii = 0; ii < 2 * numTracks; ++ii)
+      gains[ii] = float(rand()) / RAND_MAX / numTracks;
+
+   using namespace MixKernels;
+
+   Printf( XO("Mixing %d mono tracks to stereo, %.0f s at %.0f Hz.\n")
+      .Format( int(numTracks), audioSeconds, rate ) );
+   Printf( XO("Best instruction set is %s.\n").Format( Name( Best() ) ) );
+
+   bool bad = false;
+   Floats expected{ 2 * blockLen };
+   Floats result{ 2 * blockLen };
+   for (bool withEnvelope : { false, true }) {
+      Printf( withEnvelope
+         ? XO("With envelope:\n")
+         : XO("Constant gains:\n") );
+      const float *env = withEnvelope ? envelope.get() : nullptr;
+
+      for (auto set : { InstructionSet::Scalar, InstructionSet::SSE2,
+         InstructionSet::AVX2, InstructionSet::NEON }
+      ) {
+         if (!IsAvailable(set))
+            continue;
+
+         wxTheApp->Yield();
+         wxStopWatch timer;
+         for (size_t pass = 0; pass < passes; ++pass) {
+            std::fill(result.get(), result.get() + 2 * blockLen, 0.0f);
+            for (size_t track = 0; track < numTracks; ++track)
+               MixToStereo(result.get(), sources.get() + track * blockLen,
+                  env, gains[2 * track], gains[2 * track + 1], blockLen, set);
+         }
+         const auto elapsed = std::max(1L, timer.Time());
+
+         if (set == InstructionSet::Scalar)
+            std::copy(result.get(), result.get() + 2 * blockLen,
+               expected.get());
+         else {
+            for (size_t ii = 0; ii < 2 * blockLen; ++ii)
+               if (fabs(result[ii] - expected[ii]) > 1e-5) {
+                  Printf( XO("   %s results differ from scalar results!\n")
+                     .Format( Name( set ) ) );
+                  bad = true;
+                  break;
+               }
+         }
+
+         Printf( XO("   %s: %ld ms, %.1f times real time\n")
+            .Format( Name( set ), elapsed,
+               audioSeconds / (elapsed / 1000.0) ) );
+      }
+      FlushPrint();
+   }
+
+   if (bad)
+      Printf( XO("TEST FAILED!!!\n") );
+   else
+      Printf( XO("Benchmark completed successfully.\n") );
+   HoldPrint(false);
+}
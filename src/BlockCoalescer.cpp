@@ -0,0 +1,179 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file BlockCoalescer.cpp
+@brief Implements BlockCoalescer
+
+**********************************************************************/
+
+#include "BlockCoalescer.h"
+
+#include <chrono>
+
+#include <wx/app.h>
+#include <wx/evtloop.h>
+#include <wx/log.h>
+#include <wx/utils.h>
+
+#include "AudacityException.h"
+#include "AudioIOBase.h"
+#include "Prefs.h"
+#include "Project.h"
+#include "ProjectHistory.h"
+#include "Sequence.h"
+#include "UndoManager.h"
+#include "WaveClip.h"
+#include "WaveTrack.h"
+
+//! Whether runs of small blocks are merged in idle time
+static BoolSetting CoalesceSampleBlocks{
+   L"/Performance/CoalesceSampleBlocks", true };
+
+namespace {
+// Wait this long after the last change of undo state, so that work does
+// not compete with a burst of editing
+constexpr int QuietMilliseconds = 2000;
+// Between slices, let other events through
+constexpr int SliceIntervalMilliseconds = 50;
+// Stop a slice after this long
+constexpr auto SliceDuration = std::chrono::milliseconds{ 20 };
+}
+
+static const AudacityProject::AttachedObjects::RegisteredFactory
+sBlockCoalescerKey{
+   []( AudacityProject &project ){
+      return std::make_shared< BlockCoalescer >( project );
+   }
+};
+
+BlockCoalescer &BlockCoalescer::Get( AudacityProject &project )
+{
+   return project.AttachedObjects::Get< BlockCoalescer >(
+      sBlockCoalescerKey );
+}
+
+const BlockCoalescer &BlockCoalescer::Get( const AudacityProject &project )
+{
+   return Get( const_cast< AudacityProject & >( project ) );
+}
+
+BlockCoalescer::BlockCoalescer( AudacityProject &project )
+   : mProject{ project }
+   , mTimer{ this }
+{
+   Bind( wxEVT_TIMER, &BlockCoalescer::OnTimer, this );
+   mProject.Bind( EVT_UNDO_PUSHED, &BlockCoalescer::OnUndoChange, this );
+   mProject.Bind( EVT_UNDO_OR_REDO, &BlockCoalescer::OnUndoChange, this );
+   mProject.Bind( EVT_UNDO_RESET, &BlockCoalescer::OnUndoChange, this );
+}
+
+BlockCoalescer::~BlockCoalescer()
+{
+   mProject.Unbind( EVT_UNDO_PUSHED, &BlockCoalescer::OnUndoChange, this );
+   mProject.Unbind( EVT_UNDO_OR_REDO, &BlockCoalescer::OnUndoChange, this );
+   mProject.Unbind( EVT_UNDO_RESET, &BlockCoalescer::OnUndoChange, this );
+}
+
+void BlockCoalescer::Stop()
+{
+   mStopped = true;
+   mTimer.Stop();
+}
+
+void BlockCoalescer::Schedule( int milliseconds )
+{
+   if (!mStopped)
+      mTimer.StartOnce( milliseconds );
+}
+
+void BlockCoalescer::OnUndoChange( wxCommandEvent &evt )
+{
+   evt.Skip();
+   // The new state, and its autosave, include any blocks coalesced so far
+   mPassModified = false;
+   // Restart the wait with each change
+   Schedule( QuietMilliseconds );
+}
+
+bool BlockCoalescer::CanRun() const
+{
+   // Not while playing or recording, when the audio thread reads the tracks
+   if (AudioIOBase::Get()->IsBusy())
+      return false;
+
+   // Only directly from the main event loop:  not in the nested loop of a
+   // modal dialog, nor while a long operation yields to show its progress,
+   // which might be in the middle of using the same tracks
+   auto loop = wxEventLoopBase::GetActive();
+   if (!loop || loop != wxTheApp->GetMainLoop() || loop->IsYielding())
+      return false;
+
+   return !::wxIsBusy() && !mProject.mbBusyImporting;
+}
+
+void BlockCoalescer::OnTimer( wxTimerEvent & )
+{
+   if (mStopped || !CoalesceSampleBlocks.Read())
+      return;
+
+   if (!CanRun()) {
+      Schedule( QuietMilliseconds );
+      return;
+   }
+
+   const auto start = std::chrono::steady_clock::now();
+   auto overtime = [&]{
+      return std::chrono::steady_clock::now() - start >= SliceDuration; };
+
+   size_t runs = 0;
+   unsigned long long samples = 0;
+   bool more = false;
+   bool failed = false;
+   try {
+      for (auto track : TrackList::Get( mProject ).Any< WaveTrack >()) {
+         for (auto clip : track->GetAllClips()) {
+            auto sequence = clip->GetSequence();
+            while (!(more = overtime())) {
+               const auto rewritten =
+                  sequence->CoalesceBlocks( sequence->GetMaxBlockSize() );
+               if (!rewritten)
+                  break;
+               ++runs;
+               samples += rewritten;
+            }
+            if (more)
+               break;
+         }
+         if (more)
+            break;
+      }
+
+      // Let the current undo state share the new blocks, so that the old
+      // ones can be freed; but write the autosave, which refers to them,
+      // only once when the pass ends, not after every slice
+      if (runs)
+         mPassModified = true;
+      if (runs || (!more && mPassModified)) {
+         ProjectHistory::Get( mProject ).ModifyState( !more );
+         if (!more)
+            mPassModified = false;
+      }
+   }
+   catch (const AudacityException &) {
+      // Perhaps the disk is full.  Changes are strongly guaranteed, so the
+      // tracks are whole; try again only after another edit.
+      failed = true;
+   }
+
+   if (runs) {
+      ++mStatistics.slices;
+      mStatistics.runs += runs;
+      mStatistics.samples += samples;
+      wxLogDebug(wxT("Coalesced %llu runs of small blocks, %llu samples"),
+         (unsigned long long) runs, samples);
+   }
+
+   if (more && !failed)
+      Schedule( SliceIntervalMilliseconds );
+}
@@ -0,0 +1,70 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file BlockCoalescer.h
+@brief Declare BlockCoalescer, which merges small sample blocks in idle time
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_COALESCER__
+#define __AUDACITY_BLOCK_COALESCER__
+
+#include <wx/event.h> // to inherit
+#include <wx/timer.h> // member variable
+
+#include "ClientData.h" // to inherit
+
+class AudacityProject;
+
+//! Rewrites runs of small sample blocks, as left by many cuts and pastes,
+//! as blocks of the ideal size, while the project is idle
+/*!
+ Work begins some time after the last change of undo state, and proceeds
+ in short slices on the main thread, between other events.  It pauses
+ during playback and recording, modal dialogs, and long operations that
+ yield to the event loop.  After each slice that changed any blocks, the
+ current undo state is modified, not pushed, to share the new blocks.
+ */
+class AUDACITY_DLL_API BlockCoalescer final
+   : public wxEvtHandler
+   , public ClientData::Base
+{
+public:
+   static BlockCoalescer &Get( AudacityProject &project );
+   static const BlockCoalescer &Get( const AudacityProject &project );
+
+   explicit BlockCoalescer( AudacityProject &project );
+   BlockCoalescer( const BlockCoalescer & ) PROHIBITED;
+   BlockCoalescer &operator=( const BlockCoalescer & ) PROHIBITED;
+   ~BlockCoalescer() override;
+
+   //! Cease all work, as when the project closes
+   void Stop();
+
+   //! Totals of work done for the project
+   struct Statistics
+   {
+      size_t slices = 0;
+      size_t runs = 0;
+      unsigned long long samples = 0;
+   };
+   const Statistics &GetStatistics() const { return mStatistics; }
+
+private:
+   void OnUndoChange( wxCommandEvent &evt );
+   void OnTimer( wxTimerEvent &evt );
+
+   bool CanRun() const;
+   void Schedule( int milliseconds );
+
+   AudacityProject &mProject;
+   wxTimer mTimer;
+   Statistics mStatistics;
+   bool mStopped{ false };
+   //! Whether slices of the current pass changed the tracks since the
+   //! autosave was written
+   bool mPassModified{ false };
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file BlockCursor.h
+@brief Declare BlockCursor, which speeds sequential reads of a Sequence
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_CURSOR__
+#define __AUDACITY_BLOCK_CURSOR__
+
+#include <cstddef>
+
+class Sequence;
+
+//! Remembers the block where the last read from a Sequence ended, so that
+//! a read continuing from there finds its block without a search
+/*! Each reader keeps its own, not shared among threads.  A cursor left by
+ another sequence, or by a sequence since edited, costs only a search */
+class BlockCursor {
+public:
+   void Reset() { mpSequence = nullptr; }
+
+private:
+   friend Sequence;
+   const Sequence *mpSequence{};
+   size_t mBlock{ 0 };
+};
+
+#endif
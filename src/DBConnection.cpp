@@ -13,6 +13,10 @@ Paul Licameli -- split from ProjectFileIO.cpp
 
 #include "sqlite3.h"
 
+#include <algorithm>
+#include <chrono>
+#include <string>
+
 #include <wx/string.h>
 
 #include "AudacityLogger.h"
@@ -21,6 +25,7 @@ Paul Licameli -- split from ProjectFileIO.cpp
 #include "Internat.h"
 #include "Project.h"
 #include "FileException.h"
+#include "Prefs.h"
 #include "wxFileNameWrapper.h"
 #include "SentryHelper.h"
 
@@ -32,6 +37,21 @@ static const char *SafeConfig =
    "PRAGMA <schema>.journal_mode = WAL;"
    "PRAGMA <schema>.wal_autocheckpoint = 0;";
 
+//! Megabytes of the project file that the primary connection may map into
+//! memory, letting reads of sample blobs copy from mapped pages instead of
+//! through the page cache.  Zero, the default, disables mapping: an I/O error
+//! in a mapped file, as on removal of a drive, becomes a signal rather than an
+//! error code.
+static IntSetting ProjectFileMapSize{ L"/Performance/ProjectFileMapMB", 0 };
+
+//! Pages of the write-ahead log not yet copied back into the database, that
+//! start a checkpoint at once; a smaller backlog waits for a pause in commits.
+//! Bounds the work left for closing the project.
+static IntSetting CheckpointPages{ L"/Performance/CheckpointPages", 1024 };
+
+//! A pause in commits this long counts as idle time
+static constexpr auto CheckpointIdleInterval = std::chrono::milliseconds(500);
+
 // Configuration to provide "Fast" connections
 static const char *FastConfig =
    "PRAGMA <schema>.busy_timeout = 5000;"
@@ -72,6 +92,29 @@ bool DBConnection::ShouldBypass()
    return mBypass;
 }
 
+void DBConnection::SetLegacySchema( bool legacy )
+{
+   mLegacySchema = legacy;
+}
+
+bool DBConnection::IsLegacySchema() const
+{
+   return mLegacySchema;
+}
+
+int DBConnection::GetTransactionDepth() const
+{
+   return mTransactionDepth;
+}
+
+auto DBConnection::GetCheckpointStatistics() const -> CheckpointStatistics
+{
+   std::lock_guard<std::mutex> guard(mCheckpointStatsMutex);
+   auto result = mCheckpointStats;
+   result.walPages = mWalPages;
+   return result;
+}
+
 void DBConnection::SetError(
    const TranslatableString &msg, const TranslatableString &libraryError, int errorCode)
 {
@@ -154,6 +197,8 @@ int DBConnection::Open(const FilePath fileName)
          mDB = nullptr;
       }
    }
+   else if (auto project = mpProject.lock())
+      ConnectionPtr::Get(*project).CallOpenCloseHooks(*this, true);
    return rc;
 }
 
@@ -184,6 +229,9 @@ int DBConnection::OpenStepByStep(const FilePath fileName)
       return rc;
    }
 
+   // Failure only loses the optimization, and is logged
+   MapMode();
+
    rc = sqlite3_open(name, &mCheckpointDB);
    if (rc != SQLITE_OK)
    {
@@ -204,6 +252,7 @@ int DBConnection::OpenStepByStep(const FilePath fileName)
    }
 
    auto db = mCheckpointDB;
+   mCheckpointPages = std::max(1, CheckpointPages.Read());
    mCheckpointThread = std::thread(
       [this, db, fileName]{ CheckpointThread(db, fileName); });
 
@@ -223,6 +272,11 @@ bool DBConnection::Close()
       return true;
    }
 
+   // Let other connections to the file close first, so that this one is the
+   // last, which checkpoints and removes the write-ahead log
+   if (auto project = mpProject.lock())
+      ConnectionPtr::Get(*project).CallOpenCloseHooks(*this, false);
+
    // Uninstall our checkpoint hook so that no additional checkpoints
    // are sent our way.  (Though this shouldn't really happen.)
    sqlite3_wal_hook(mDB, nullptr, nullptr);
@@ -266,7 +320,35 @@ bool DBConnection::Close()
       mCheckpointThread.join();
    }
 
-   // We're done with the prepared statements
+   {
+      const auto stats = GetCheckpointStatistics();
+      wxLogInfo("Checkpoints of %s: %llu, %llu log resets;"
+                " log at most %d pages, %d left;"
+                " last %.1f ms, longest %.1f ms",
+                sqlite3_db_filename(mDB, nullptr),
+                stats.checkpoints, stats.truncations,
+                stats.maxWalPages, stats.backlogPages,
+                stats.lastMilliseconds, stats.maxMilliseconds);
+   }
+
+   // Log the use of the pooled statements
+   {
+      const auto stats = GetStatementStatistics();
+      for (size_t id = 0; id < stats.size(); ++id)
+      {
+         const auto &stat = stats[id];
+         if (stat.acquisitions == 0)
+            continue;
+         wxLogInfo("Statement %s of %s: %llu prepared, %llu acquired,"
+                   " %llu contended; %llu steps, %llu rows in %.1f ms",
+                   stat.name, sqlite3_db_filename(mDB, nullptr),
+                   stat.prepares, stat.acquisitions, stat.contentions,
+                   stat.steps, stat.rows, stat.stepMilliseconds);
+      }
+   }
+
+   // We're done with the blob handles and the prepared statements
+   ReleaseIdleBlobs();
    {
       std::lock_guard<std::mutex> guard(mStatementMutex);
       for (auto stmt : mStatements)
@@ -343,6 +425,15 @@ int DBConnection::FastMode(const char *schema /* = "main" */)
    return ModeConfig(mDB, schema, FastConfig);
 }
 
+int DBConnection::MapMode(const char *schema /* = "main" */)
+{
+   const auto bytes =
+      std::max(0, ProjectFileMapSize.Read()) * 1048576LL;
+   const auto config =
+      "PRAGMA <schema>.mmap_size = " + std::to_string(bytes) + ";";
+   return ModeConfig(mDB, schema, config.c_str());
+}
+
 int DBConnection::ModeConfig(sqlite3 *db, const char *schema, const char *config)
 {
    // Ensure attached DB connection gets configured
@@ -391,7 +482,15 @@ const wxString DBConnection::GetLastMessage() const
 
 sqlite3_stmt *DBConnection::Prepare(enum StatementID id, const char *sql)
 {
-   std::lock_guard<std::mutex> guard(mStatementMutex);
+   auto &counters = mStatementCounters[id];
+   ++counters.acquisitions;
+
+   std::unique_lock<std::mutex> guard(mStatementMutex, std::try_to_lock);
+   if (!guard.owns_lock())
+   {
+      ++counters.contentions;
+      guard.lock();
+   }
 
    int rc;
    // See bug 2673
@@ -439,21 +538,143 @@ sqlite3_stmt *DBConnection::Prepare(enum StatementID id, const char *sql)
 
    // Remember the cached statement.
    mStatements.insert({ndx, stmt});
+   mStatementSQL[id] = sql;
+   ++mStatementPrepares[id];
 
    return stmt;
 }
 
+int DBConnection::AcquireBlob(long long blockID, sqlite3_blob **ppBlob)
+{
+   sqlite3_blob *blob = nullptr;
+   {
+      std::lock_guard<std::mutex> guard(mBlobMutex);
+      auto iter = mBlobs.find(std::this_thread::get_id());
+      if (iter != mBlobs.end())
+         std::swap(blob, iter->second);
+   }
+
+   int rc = SQLITE_OK;
+   if (blob)
+   {
+      // This fails for a handle expired by a change to its row; then open
+      // another
+      rc = sqlite3_blob_reopen(blob, blockID);
+      if (rc != SQLITE_OK)
+      {
+         sqlite3_blob_close(blob);
+         blob = nullptr;
+      }
+   }
+   if (!blob)
+      rc = sqlite3_blob_open(mDB, "main", "sampleblocks", "samples",
+         blockID, 0, &blob);
+
+   *ppBlob = (rc == SQLITE_OK) ? blob : nullptr;
+   return rc;
+}
+
+void DBConnection::ReleaseBlob(sqlite3_blob *blob, bool failed)
+{
+   if (!blob)
+      return;
+
+   if (!failed)
+   {
+      std::lock_guard<std::mutex> guard(mBlobMutex);
+      auto &pooled = mBlobs[std::this_thread::get_id()];
+      if (!pooled)
+      {
+         pooled = blob;
+         return;
+      }
+   }
+
+   // No need to check return code
+   sqlite3_blob_close(blob);
+}
+
+void DBConnection::ReleaseIdleBlobs()
+{
+   std::lock_guard<std::mutex> guard(mBlobMutex);
+   for (auto &pair : mBlobs)
+   {
+      if (pair.second)
+      {
+         // No need to check return code
+         sqlite3_blob_close(pair.second);
+      }
+   }
+   mBlobs.clear();
+}
+
+int DBConnection::Step(enum StatementID id, sqlite3_stmt *stmt)
+{
+   auto &counters = mStatementCounters[id];
+   const auto start = std::chrono::steady_clock::now();
+   const auto rc = sqlite3_step(stmt);
+   counters.stepNanoseconds += std::chrono::duration_cast<
+      std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+         .count();
+   ++counters.steps;
+   if (rc == SQLITE_ROW)
+      ++counters.rows;
+   return rc;
+}
+
+auto DBConnection::GetStatementStatistics() const
+   -> std::vector<StatementStatistics>
+{
+   // In the order of StatementID
+   static const char *const names[] = {
+      "GetSamples",
+      "GetSummary256",
+      "GetSummary64k",
+      "LoadSampleBlock",
+      "InsertSampleBlock",
+      "InsertLegacySampleBlock",
+      "DeleteSampleBlock",
+      "UpdateSampleBlockSummaries",
+      "GetRootPage",
+      "GetDBPage",
+   };
+   static_assert(sizeof(names) / sizeof(*names) == NumStatements,
+      "Name each StatementID");
+
+   std::vector<StatementStatistics> result(NumStatements);
+   std::lock_guard<std::mutex> guard(mStatementMutex);
+   for (size_t id = 0; id < NumStatements; ++id)
+   {
+      auto &stats = result[id];
+      const auto &counters = mStatementCounters[id];
+      stats.name = names[id];
+      if (mStatementSQL[id])
+         stats.sql = mStatementSQL[id];
+      stats.prepares = mStatementPrepares[id];
+      stats.acquisitions = counters.acquisitions;
+      stats.contentions = counters.contentions;
+      stats.steps = counters.steps;
+      stats.rows = counters.rows;
+      stats.stepMilliseconds = counters.stepNanoseconds / 1e6;
+   }
+   return result;
+}
+
 void DBConnection::CheckpointThread(sqlite3 *db, const FilePath &fileName)
 {
    int rc = SQLITE_OK;
    bool giveUp = false;
 
+   // Pages of the log copied back by the last checkpoint
+   int backfilled = 0;
+
    while (true)
    {
+      bool idle;
       {
-         // Wait for work or the stop signal
+         // Wait for a commit or the stop signal, or for commits to pause
          std::unique_lock<std::mutex> lock(mCheckpointMutex);
-         mCheckpointCondition.wait(lock,
+         idle = !mCheckpointCondition.wait_for(lock, CheckpointIdleInterval,
                                    [&]
                                    {
                                       return mCheckpointPending || mCheckpointStop;
@@ -464,25 +685,80 @@ void DBConnection::CheckpointThread(sqlite3 *db, const FilePath &fileName)
          {
             break;
          }
+         mCheckpointPending = false;
+
+         // Checkpoint when the backlog reaches the threshold, so that it
+         // stays bounded even while recording never pauses, or else in idle
+         // time; then also try to reset a long log
+         const int pages = mWalPages;
+         // The log restarts from its beginning after a complete checkpoint
+         const int backlog = pages >= backfilled ? pages - backfilled : pages;
+         if (giveUp ||
+             !(backlog >= mCheckpointPages ||
+               (idle && (backlog > 0 || pages >= mCheckpointPages))))
+         {
+            continue;
+         }
 
-         // Capture the number of pages that need checkpointing and reset
          mCheckpointActive = true;
-         mCheckpointPending = false;
       }
 
-      // And kick off the checkpoint. This may not checkpoint ALL frames
-      // in the WAL.  They'll be gotten the next time around.
+      // Idle blob handles would hold back the checkpoint; reads reopen them
+      ReleaseIdleBlobs();
+
+      // And kick off the checkpoint. A passive checkpoint does not wait for
+      // readers, so this may not checkpoint ALL frames in the WAL.  They'll
+      // be gotten the next time around.
       using namespace std::chrono;
+      const auto start = steady_clock::now();
+      int logPages = 0, checkpointedPages = 0;
       do {
-         rc = giveUp ? SQLITE_OK :
-            sqlite3_wal_checkpoint_v2(
-               db, nullptr, SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+         rc = sqlite3_wal_checkpoint_v2(db, nullptr,
+            SQLITE_CHECKPOINT_PASSIVE, &logPages, &checkpointedPages);
       }
       // Contentions for an exclusive lock on the database are possible,
       // even while the main thread is merely drawing the tracks, which
       // may perform reads
       while (rc == SQLITE_BUSY && (std::this_thread::sleep_for(1ms), true));
 
+      bool truncated = false;
+      if (rc == SQLITE_OK)
+      {
+         backfilled = checkpointedPages;
+
+         // When idle and all is copied back, restart the log and shrink its
+         // file, but don't wait for readers or writers
+         if (idle && logPages >= mCheckpointPages &&
+             checkpointedPages == logPages)
+         {
+            sqlite3_busy_timeout(db, 0);
+            truncated = SQLITE_OK == sqlite3_wal_checkpoint_v2(db, nullptr,
+               SQLITE_CHECKPOINT_TRUNCATE, nullptr, nullptr);
+            sqlite3_busy_timeout(db, 5000);
+            if (truncated)
+            {
+               backfilled = 0;
+               // No commit could intervene, while the truncation held the
+               // write lock, but one may have followed it
+               int expected = logPages;
+               mWalPages.compare_exchange_strong(expected, 0);
+            }
+         }
+      }
+
+      {
+         const auto elapsed =
+            duration<double, std::milli>(steady_clock::now() - start).count();
+         std::lock_guard<std::mutex> guard(mCheckpointStatsMutex);
+         auto &stats = mCheckpointStats;
+         ++stats.checkpoints;
+         if (truncated)
+            ++stats.truncations;
+         stats.backlogPages = truncated ? 0 : logPages - checkpointedPages;
+         stats.lastMilliseconds = elapsed;
+         stats.maxMilliseconds = std::max(stats.maxMilliseconds, elapsed);
+      }
+
       // Reset
       mCheckpointActive = false;
 
@@ -543,8 +819,14 @@ int DBConnection::CheckpointHook(void *data, sqlite3 *db, const char *schema, in
    // Get access to our object
    DBConnection *that = static_cast<DBConnection *>(data);
 
-   // Queue the database pointer for our checkpoint thread to process
+   // Tell our checkpoint thread the size of the log
+   {
+      std::lock_guard<std::mutex> guard(that->mCheckpointStatsMutex);
+      auto &stats = that->mCheckpointStats;
+      stats.maxWalPages = std::max(stats.maxWalPages, pages);
+   }
    std::lock_guard<std::mutex> guard(that->mCheckpointMutex);
+   that->mWalPages = pages;
    that->mCheckpointPending = true;
    that->mCheckpointCondition.notify_one();
 
@@ -629,7 +911,9 @@ TransactionScope::TransactionScope(
    mName(name)
 {
    mInTrans = TransactionStart(mName);
-   if ( !mInTrans )
+   if ( mInTrans )
+      ++mConnection.mTransactionDepth;
+   else
       // To do, improve the message
       throw SimpleMessageBoxException( ExceptionType::Internal,
          XO("Database error.  Sorry, but we don't have more details."), 
@@ -652,6 +936,7 @@ TransactionScope::~TransactionScope()
          // This has to be a no-fail cleanup that does the best that it can.
          wxLogMessage("Transaction active at scope destruction");
       }
+      --mConnection.mTransactionDepth;
    }
 }
 
@@ -666,6 +951,8 @@ bool TransactionScope::Commit()
    }
 
    mInTrans = !TransactionCommit(mName);
+   if ( !mInTrans )
+      --mConnection.mTransactionDepth;
 
    return mInTrans;
 }
@@ -679,6 +966,28 @@ ConnectionPtr::~ConnectionPtr()
    }
 }
 
+size_t ConnectionPtr::AddOpenCloseHook( OpenCloseHook hook )
+{
+   std::lock_guard<std::mutex> guard(mHooksMutex);
+   mHooks.emplace_back( mNextHookKey, std::move( hook ) );
+   return mNextHookKey++;
+}
+
+void ConnectionPtr::RemoveOpenCloseHook( size_t key )
+{
+   std::lock_guard<std::mutex> guard(mHooksMutex);
+   mHooks.erase( std::remove_if( mHooks.begin(), mHooks.end(),
+      [key]( const auto &pair ){ return pair.first == key; } ),
+      mHooks.end() );
+}
+
+void ConnectionPtr::CallOpenCloseHooks( DBConnection &connection, bool opened )
+{
+   std::lock_guard<std::mutex> guard(mHooksMutex);
+   for ( auto &pair : mHooks )
+      pair.second( connection, opened );
+}
+
 static const AudacityProject::AttachedObjects::RegisteredFactory
 sConnectionPtrKey{
    []( AudacityProject & ){
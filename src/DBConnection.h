@@ -12,18 +12,22 @@ Paul Licameli -- split from ProjectFileIO.h
 #ifndef __AUDACITY_DB_CONNECTION__
 #define __AUDACITY_DB_CONNECTION__
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "ClientData.h"
 #include "Identifier.h"
 
 struct sqlite3;
+struct sqlite3_blob;
 struct sqlite3_stmt;
 class wxString;
 class AudacityProject;
@@ -59,6 +63,8 @@ public:
 
    int SafeMode(const char *schema = "main");
    int FastMode(const char *schema = "main");
+   //! Apply the preferred size of memory mapping of the file
+   int MapMode(const char *schema = "main");
 
    bool Assign(sqlite3 *handle);
    sqlite3 *Detach();
@@ -75,15 +81,89 @@ public:
       GetSummary64k,
       LoadSampleBlock,
       InsertSampleBlock,
+      InsertLegacySampleBlock,
       DeleteSampleBlock,
+      UpdateSampleBlockSummaries,
       GetRootPage,
-      GetDBPage
+      GetDBPage,
+      NumStatements //!< Not an id; the count of them
    };
+
+   //! Get the pooled statement for id and the calling thread, preparing it
+   //! from sql at first use in the thread
+   /*! The statement must be used only in the calling thread.  It stays
+       prepared until the connection closes. */
    sqlite3_stmt *Prepare(enum StatementID id, const char *sql);
 
+   //! sqlite3_step() a statement from Prepare(), counting steps, rows and
+   //! time for id
+   int Step(enum StatementID id, sqlite3_stmt *stmt);
+
+   //! Get the pooled read-only handle of the calling thread on the samples
+   //! of main.sampleblocks, moved to the given row
+   /*! Like Prepare(), the handle is kept for the thread and moved by
+       sqlite3_blob_reopen(), not opened anew for each read.  Give it back
+       with ReleaseBlob() when done reading.
+       @return SQLite result code; on failure, *ppBlob is null */
+   int AcquireBlob(long long blockID, sqlite3_blob **ppBlob);
+   //! Give back a handle from AcquireBlob()
+   /*! @param failed if true, close the handle, as after a failed read */
+   void ReleaseBlob(sqlite3_blob *blob, bool failed = false);
+   //! Close the pooled blob handles not now in use
+   /*! Each open handle holds a read transaction, which would keep
+       checkpoints from copying back or restarting the write-ahead log */
+   void ReleaseIdleBlobs();
+
+   //! Use of one statement of the pool, summed over threads
+   struct StatementStatistics
+   {
+      //! Name of the StatementID
+      const char *name = "";
+      //! The SQL, or empty if never prepared
+      std::string sql;
+      //! Preparations, one in each thread that used it, and all calls
+      //! of Prepare() for it
+      unsigned long long prepares = 0;
+      unsigned long long acquisitions = 0;
+      //! Calls of Prepare() that waited while another thread used the pool
+      unsigned long long contentions = 0;
+      unsigned long long steps = 0;
+      unsigned long long rows = 0;
+      double stepMilliseconds = 0;
+   };
+   //! @return statistics indexed by StatementID
+   std::vector<StatementStatistics> GetStatementStatistics() const;
+
    void SetBypass( bool bypass );
    bool ShouldBypass();
 
+   //! Whether the file has only the sampleblocks columns that Audacity 3.0
+   //! knows, and a view supplies the others
+   /*! Then new blocks are stored raw and with summaries, needing no more */
+   void SetLegacySchema( bool legacy );
+   bool IsLegacySchema() const;
+
+   //! @return the number of TransactionScope objects now open on this
+   //! connection; when 1, releasing that one commits to the database
+   int GetTransactionDepth() const;
+
+   //! Measurements of the checkpointing of the write-ahead log
+   struct CheckpointStatistics
+   {
+      //! Pages now in the log, and not yet copied back into the database
+      int walPages = 0;
+      int backlogPages = 0;
+      //! Most pages in the log at once
+      int maxWalPages = 0;
+      unsigned long long checkpoints = 0;
+      //! Resets of the log in idle time, which shrink its file
+      unsigned long long truncations = 0;
+      //! Durations of the last and of the longest checkpoint
+      double lastMilliseconds = 0;
+      double maxMilliseconds = 0;
+   };
+   CheckpointStatistics GetCheckpointStatistics() const;
+
    //! Just set stored errors
    void SetError(
       const TranslatableString &msg,
@@ -114,16 +194,47 @@ private:
    std::atomic_bool mCheckpointStop{ false };
    std::atomic_bool mCheckpointPending{ false };
    std::atomic_bool mCheckpointActive{ false };
-
-   std::mutex mStatementMutex;
+   //! Pages in the log as of the last commit
+   std::atomic<int> mWalPages{ 0 };
+   //! Pages of backlog that start a checkpoint without waiting for idle time
+   int mCheckpointPages{ 1 };
+   mutable std::mutex mCheckpointStatsMutex;
+   CheckpointStatistics mCheckpointStats;
+
+   // The statement pool
+   mutable std::mutex mStatementMutex;
    using StatementIndex = std::pair<enum StatementID, std::thread::id>;
    std::map<StatementIndex, sqlite3_stmt *> mStatements;
+   //! Counters updated without the lock, as statements are used
+   struct StatementCounters
+   {
+      std::atomic<unsigned long long> acquisitions{ 0 };
+      std::atomic<unsigned long long> contentions{ 0 };
+      std::atomic<unsigned long long> steps{ 0 };
+      std::atomic<unsigned long long> rows{ 0 };
+      std::atomic<unsigned long long> stepNanoseconds{ 0 };
+   };
+   std::array<StatementCounters, NumStatements> mStatementCounters;
+   //! Guarded by mStatementMutex
+   std::array<const char *, NumStatements> mStatementSQL{};
+   std::array<unsigned long long, NumStatements> mStatementPrepares{};
+
+   // The blob handle pool, one per thread like statements; handles now in
+   // use are taken out of it
+   std::mutex mBlobMutex;
+   std::map<std::thread::id, sqlite3_blob *> mBlobs;
 
    std::shared_ptr<DBConnectionErrors> mpErrors;
    CheckpointFailureCallback mCallback;
 
    // Bypass transactions if database will be deleted after close
    bool mBypass;
+
+   // Blocks may be stored in other threads, as when recording
+   std::atomic<bool> mLegacySchema{ false };
+
+   friend class TransactionScope;
+   std::atomic<int> mTransactionDepth{ 0 };
 };
 
 //! RAII for a database transaction, possibly nested
@@ -166,7 +277,26 @@ public:
 
    ~ConnectionPtr() override;
 
+   //! Type of function called after any connection for the project opens,
+   //! and before it closes
+   using OpenCloseHook =
+      std::function< void(DBConnection &connection, bool opened) >;
+
+   //! Let other connections to the project's file, such as for reading
+   //! ahead, follow the opening and closing of its own
+   /*! @return a key for RemoveOpenCloseHook() */
+   size_t AddOpenCloseHook( OpenCloseHook hook );
+   void RemoveOpenCloseHook( size_t key );
+
+   //! Called by DBConnection
+   void CallOpenCloseHooks( DBConnection &connection, bool opened );
+
    Connection mpConnection;
+
+private:
+   std::mutex mHooksMutex;
+   std::vector< std::pair< size_t, OpenCloseHook > > mHooks;
+   size_t mNextHookKey{ 0 };
 };
 
 #endif
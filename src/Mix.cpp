@@ -36,6 +36,7 @@
 #include "Resample.h"
 #include "TimeTrack.h"
 #include "float_cast.h"
+#include "MixKernels.h"
 
 #include "widgets/ProgressDialog.h"
 
@@ -310,6 +311,8 @@ Mixer::Mixer(const WaveTrackConstArray &inputTracks,
 
    // For each queue, the number of available samples after the queue start.
    mQueueLen.reinit(mNumInputTracks);
+   mReadLen.reinit(mNumInputTracks);
+   mReadResults.reinit(mNumInputTracks);
    mResample.reinit(mNumInputTracks);
    mMinFactor.resize(mNumInputTracks);
    mMaxFactor.resize(mNumInputTracks);
@@ -360,30 +363,27 @@ void Mixer::Clear()
    }
 }
 
+//! @param env if not null, multiplies each sample of src before the gains
 static void MixBuffers(unsigned numChannels, int *channelFlags, float *gains,
-                const float *src, Floats *dests,
+                const float *src, const float *env, Floats *dests,
                 int len, bool interleaved)
 {
+   if (interleaved && numChannels == 2 && channelFlags[0] && channelFlags[1]) {
+      // Both channels of interleaved stereo in one pass
+      MixKernels::MixToStereo(
+         dests[0].get(), src, env, gains[0], gains[1], len);
+      return;
+   }
+
    for (unsigned int c = 0; c < numChannels; c++) {
       if (!channelFlags[c])
          continue;
 
-      float *dest;
-      unsigned skip;
-
-      if (interleaved) {
-         dest = dests[0].get() + c;
-         skip = numChannels;
-      } else {
-         dest = dests[c].get();
-         skip = 1;
-      }
-
-      float gain = gains[c];
-      for (int j = 0; j < len; j++) {
-         *dest += src[j] * gain;   // the actual mixing process
-         dest += skip;
-      }
+      if (interleaved)
+         MixKernels::Mix(
+            dests[0].get() + c, numChannels, src, env, gains[c], len);
+      else
+         MixKernels::Mix(dests[c].get(), 1, src, env, gains[c], len);
    }
 }
 
@@ -483,9 +483,7 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                *pos += getLen;
             }
 
-            for (decltype(getLen) i = 0; i < getLen; i++) {
-               queue[(*queueLen) + i] *= mEnvValues[i];
-            }
+            MixKernels::Multiply(&queue[*queueLen], mEnvValues.get(), getLen);
 
             if (backwards)
                ReverseSamples((samplePtr)&queue[0], floatSample,
@@ -555,6 +553,7 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
               channelFlags,
               mGains.get(),
               mFloatBuffer.get(),
+              nullptr,
               mTemp.get(),
               out,
               mInterleaved);
@@ -593,8 +592,7 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
       else
          memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
       track->GetEnvelopeValues(mEnvValues.get(), slen, t - (slen - 1) / mRate);
-      for(decltype(slen) i = 0; i < slen; i++)
-         mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+      MixKernels::Multiply(mFloatBuffer.get(), mEnvValues.get(), slen);
       ReverseSamples((samplePtr)mFloatBuffer.get(), floatSample, 0, slen);
 
       *pos -= slen;
@@ -605,9 +603,8 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
          memcpy(mFloatBuffer.get(), results, sizeof(float) * slen);
       else
          memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
+      // The envelope is applied while mixing, below
       track->GetEnvelopeValues(mEnvValues.get(), slen, t);
-      for(decltype(slen) i = 0; i < slen; i++)
-         mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
 
       *pos += slen;
    }
@@ -618,8 +615,10 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
       else
          mGains[c] = 1.0;
 
+   // Forwards, the envelope values still line up with the samples
    MixBuffers(mNumChannels, channelFlags, mGains.get(),
-              mFloatBuffer.get(), mTemp.get(), slen, mInterleaved);
+              mFloatBuffer.get(), backwards ? nullptr : mEnvValues.get(),
+              mTemp.get(), slen, mInterleaved);
 
    return slen;
 }
@@ -636,6 +635,31 @@ size_t Mixer::Process(size_t maxToProcess)
 
    mMaxOut = maxToProcess;
 
+   if (mNumInputTracks > 1 && mT0 <= mT1) {
+      // Read the next blocks of all tracks together; then the reads
+      // below find them in the caches.  Read no more of each track than
+      // this call can consume:  resampling and the time track change the
+      // ratio of input to output, bounded by mMinFactor, and the queue of a
+      // resampled track may already hold what it needs.  Nor read past the
+      // end of the mix or of the track, as MixSameRate() would not.
+      for (size_t i = 0; i < mNumInputTracks; ++i) {
+         const WaveTrack *const track = mInputTrack[i].GetTrack().get();
+         if (mbVariableRates || track->GetRate() != mRate) {
+            const auto needed = size_t(ceil(mMaxOut / mMinFactor[i]));
+            const auto queued = size_t(std::max(0, mQueueLen[i]));
+            mReadLen[i] = needed > queued ? needed - queued : 0;
+         }
+         else {
+            const double t = mSamplePos[i].as_double() / track->GetRate();
+            const double tEnd = std::min(track->GetEndTime(), mT1);
+            mReadLen[i] = t >= tEnd ? 0 : limitSampleBufferSize(mMaxOut,
+               sampleCount{ (tEnd - t) * track->GetRate() + 0.5 });
+         }
+      }
+      WaveTrackCache::GetFloats(mInputTrack.get(), mNumInputTracks,
+         mSamplePos.get(), mReadLen.get(), mReadResults.get(), mMayThrow);
+   }
+
    Clear();
    for(size_t i=0; i<mNumInputTracks; i++) {
       const WaveTrack *const track = mInputTrack[i].GetTrack().get();
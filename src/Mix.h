@@ -173,6 +173,9 @@ class AUDACITY_DLL_API Mixer {
    FloatBuffers     mSampleQueue;
    ArrayOf<int>     mQueueStart;
    ArrayOf<int>     mQueueLen;
+   // Lengths and results of the bulk read of all tracks in Process()
+   ArrayOf<size_t>  mReadLen;
+   ArrayOf<const float *> mReadResults;
    size_t           mProcessLen;
    MixerSpec        *mMixerSpec;
 
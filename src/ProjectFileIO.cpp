@@ -10,7 +10,11 @@ Paul Licameli split from AudacityProject.cpp
 
 #include "ProjectFileIO.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include <sqlite3.h>
 #include <wx/app.h>
 #include <wx/crt.h>
@@ -25,6 +29,7 @@ Paul Licameli split from AudacityProject.cpp
 #include "ProjectSerializer.h"
 #include "ProjectWindows.h"
 #include "SampleBlock.h"
+#include "SampleBlockCodec.h"
 #include "TempDirectory.h"
 #include "WaveTrack.h"
 #include "widgets/AudacityMessageBox.h"
@@ -72,7 +77,12 @@ static const int ProjectFileID = PACK('A', 'U', 'D', 'Y');
 // Note that this is NOT the "schema_version" that SQLite maintains. The value
 // specified here is stored in the "user_version" field of the SQLite database
 // header.
-static const int ProjectFileVersion = PACK(3, 0, 0, 0);
+static const int ProjectFileVersion = PACK(3, 1, 0, 0);
+
+// The version of files that have only the columns of sampleblocks up to
+// samples.  Such files are not upgraded unless new blocks need the later
+// columns, so that Audacity 3.0 can still open them.
+static const int LegacyProjectFileVersion = PACK(3, 0, 0, 0);
 
 // Navigation:
 //
@@ -140,9 +150,26 @@ static const char *ProjectFileSchema =
    // blockID is a 64 bit number.
    //
    // Rows are immutable -- never updated after addition, but may be
-   // deleted.
+   // deleted -- except that missing summaries may be filled in later.
    //
    // summin to summary64K are summaries at 3 distance scales.
+   //
+   // codec identifies the encoding of samples (see SampleBlockCodec.h);
+   // zero means raw samples.
+   //
+   // summaries is zero when summin to summary64k were deferred and are
+   // still missing; they are computed from the samples on demand.
+   //
+   // hash is a 64 bit digest of sampleformat and the decoded samples, used
+   // to find blocks of equal content; null when not computed.
+   //
+   // checksum is SampleBlockCodec::Checksum() of the stored samples blob,
+   // for detecting corruption; null in rows written by older versions.
+   //
+   // Columns after samples were added in later versions.  They are filled
+   // in from SampleBlockColumnUpgrades below, in the same order, so that rows
+   // of upgraded and of new files are interchangeable; and left out of files
+   // that Audacity 3.0 must still open.
    "CREATE TABLE IF NOT EXISTS <schema>.sampleblocks"
    "("
    "  blockid              INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -153,8 +180,23 @@ static const char *ProjectFileSchema =
    "  summary256           BLOB,"
    "  summary64k           BLOB,"
    "  samples              BLOB"
+   "%s"
    ");";
 
+// Columns of sampleblocks not present in files of LegacyProjectFileVersion,
+// added by UpgradeSchema(), or else supplied by a view of the legacy table
+// with the values that they have in rows of older files
+static const struct {
+   const char *name;
+   const char *definition;
+   const char *legacyValue;
+} SampleBlockColumnUpgrades[] = {
+   { "codec", "codec INTEGER DEFAULT 0", "0" },
+   { "summaries", "summaries INTEGER DEFAULT 1", "1" },
+   { "hash", "hash INTEGER", "NULL" },
+   { "checksum", "checksum INTEGER", "NULL" },
+};
+
 // This singleton handles initialization/shutdown of the SQLite library.
 // It is needed because our local SQLite is built with SQLITE_OMIT_AUTOINIT
 // defined.
@@ -629,6 +671,12 @@ bool ProjectFileIO::GetBlob(const char *sql, wxMemoryBuffer &buffer)
    return true;
 }
 
+// Whether preferences store new blocks in ways that Audacity 3.0 can't read
+static bool NeedLaterSampleBlockColumns()
+{
+   return CompressSampleBlocks.Read() || LazySampleBlockSummaries.Read();
+}
+
 bool ProjectFileIO::CheckVersion()
 {
    auto db = DB();
@@ -656,7 +704,13 @@ bool ProjectFileIO::CheckVersion()
    // must be a new project file.
    if (wxStrtol<char **>(result, nullptr, 10) == 0)
    {
-      return InstallSchema(db);
+      // Create a file that Audacity 3.0 can open, unless new blocks will
+      // need the later columns; as for an older file, a temporary view
+      // supplies those columns to reads
+      const bool legacy = !NeedLaterSampleBlockColumns();
+      if (!InstallSchema(db, "main", legacy))
+         return false;
+      return !legacy || UpgradeSchema();
    }
 
    // Check for our application ID
@@ -700,12 +754,19 @@ bool ProjectFileIO::CheckVersion()
    return true;
 }
 
-bool ProjectFileIO::InstallSchema(sqlite3 *db, const char *schema /* = "main" */)
+bool ProjectFileIO::InstallSchema(sqlite3 *db, const char *schema /* = "main" */,
+   bool legacy /* = false */)
 {
    int rc;
 
+   wxString columns;
+   if (!legacy)
+      for (const auto &column : SampleBlockColumnUpgrades)
+         columns += wxString::Format(",  %s", column.definition);
+
    wxString sql;
-   sql.Printf(ProjectFileSchema, ProjectFileID, ProjectFileVersion);
+   sql.Printf(ProjectFileSchema, ProjectFileID,
+      legacy ? LegacyProjectFileVersion : ProjectFileVersion, columns);
    sql.Replace("<schema>", schema);
 
    rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
@@ -722,7 +783,80 @@ bool ProjectFileIO::InstallSchema(sqlite3 *db, const char *schema /* = "main" */
 
 bool ProjectFileIO::UpgradeSchema()
 {
-   // To do
+   auto db = DB();
+   int rc;
+
+   // Find which of the later columns are already present
+   std::unordered_set<std::string> columns;
+   auto cb = [&columns](int cols, char **vals, char **){
+      // The second column of table_info is the column name
+      if (cols > 1 && vals[1])
+         columns.insert(vals[1]);
+      return 0;
+   };
+   if (!Query("PRAGMA main.table_info(sampleblocks);", cb))
+   {
+      // Error message already captured.
+      return false;
+   }
+
+   // Upgrading makes the file unreadable by Audacity 3.0, so do it only when
+   // new blocks will need the columns
+   if (NeedLaterSampleBlockColumns())
+   {
+      // Adding columns with constant defaults does not rewrite existing
+      // rows, so this is quick even for large projects
+      wxString sql = "BEGIN;";
+      for (const auto &column : SampleBlockColumnUpgrades)
+      {
+         if (columns.count(column.name))
+            continue;
+         sql += wxString::Format(
+            "ALTER TABLE main.sampleblocks ADD COLUMN %s;", column.definition);
+      }
+      sql += wxString::Format(
+         "PRAGMA main.user_version = %d;", ProjectFileVersion);
+      sql += "COMMIT;";
+
+      rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+      if (rc == SQLITE_OK)
+         return true;
+
+      // As when the file or its directory is read only; open the file
+      // without upgrading it
+      wxLogMessage("Failed to upgrade the project file %s: %d, %s",
+         sqlite3_db_filename(db, "main"), rc, sqlite3_errmsg(db));
+      if (!sqlite3_get_autocommit(db))
+         sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+   }
+
+   // Otherwise the later columns are supplied by a temporary view, which
+   // shadows the table for statements that don't name the main schema, and
+   // doesn't write to the file
+   wxString select = "blockid, sampleformat, summin, summax, sumrms,"
+      " summary256, summary64k, samples";
+   for (const auto &column : SampleBlockColumnUpgrades)
+      select += columns.count(column.name)
+         ? wxString::Format(", %s", column.name)
+         : wxString::Format(", %s AS %s", column.legacyValue, column.name);
+   const auto sql = wxString::Format(
+      "CREATE TEMP VIEW IF NOT EXISTS sampleblocks AS"
+      "  SELECT %s FROM main.sampleblocks;", select);
+
+   rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+   if (rc != SQLITE_OK)
+   {
+      ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
+      ADD_EXCEPTION_CONTEXT("sqlite3.context", "ProjectFileIO::UpgradeSchema");
+
+      SetDBError(
+         XO("Unable to upgrade the project file")
+      );
+      return false;
+   }
+
+   CurrConn()->SetLegacySchema(true);
+
    return true;
 }
 
@@ -768,7 +902,7 @@ bool ProjectFileIO::DeleteBlocks(const BlockIDs &blockids, bool complement)
    // This is the first command that writes to the database, and so we
    // do more informative error reporting than usual, if it fails.
    auto sql = wxString::Format(
-      "DELETE FROM sampleblocks WHERE %sinset(blockid);",
+      "DELETE FROM main.sampleblocks WHERE %sinset(blockid);",
       complement ? "NOT " : "" );
    rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
    if (rc != SQLITE_OK)
@@ -820,7 +954,8 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
    const TranslatableString &msg,
    bool isTemporary,
    bool prune /* = false */,
-   const std::vector<const TrackList *> &tracks /* = {} */)
+   const std::vector<const TrackList *> &tracks /* = {} */,
+   bool resumable /* = false */)
 {
    auto pConn = CurrConn().get();
    if (!pConn)
@@ -864,7 +999,7 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
    Connection destConn = nullptr;
    bool success = false;
    int rc = SQLITE_OK;
-   ProgressResult res = ProgressResult::Success;
+   bool keepPartial = false;
 
    // Cleanup in case things go awry
    auto cleanup = finally([&]
@@ -881,14 +1016,17 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
          // If this fails (probably due to memory or disk space), the transaction will
          // (presumably) stil be active, so further updates to the project file will
          // fail as well. Not really much we can do about it except tell the user.
-         auto result = sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+         // (A cancelled copy has committed its rows and has no transaction.)
+         auto result = sqlite3_get_autocommit(db)
+            ? SQLITE_OK
+            : sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
 
          // Only capture the error if there wasn't a previous error
          if (result != SQLITE_OK && (rc == SQLITE_DONE || rc == SQLITE_OK))
          {
             ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
             ADD_EXCEPTION_CONTEXT(
-               "sqlite3.context", "ProjectGileIO::CopyTo.cleanup");
+               "sqlite3.context", "ProjectFileIO::CopyTo.cleanup");
 
             SetDBError(
                XO("Failed to rollback transaction during import")
@@ -901,7 +1039,8 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
          sqlite3_exec(db, "DETACH DATABASE outbound;", nullptr, nullptr, nullptr);
 
          // RemoveProject not necessary to clean up attached database
-         wxRemoveFile(destpath);
+         if (!keepPartial)
+            wxRemoveFile(destpath);
       }
    });
 
@@ -935,110 +1074,256 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
    }
 
    // Install our schema into the new database
-   if (!InstallSchema(db, "outbound"))
+   // Keep the version of the source, so that copying a legacy file doesn't
+   // make it unreadable by older versions
+   if (!InstallSchema(db, "outbound", pConn->IsLegacySchema()))
    {
       // Message already set
       return false;
    }
 
+   // Rows left by an interrupted compaction can be kept, if they are still
+   // wanted and agree with the source, including the checksum of the samples,
+   // so that a file replaced since (say by Save As) can't contribute its rows;
+   // blocks without checksums are always copied again
+   mCopyStatistics = {};
+   if (resumable && !pConn->IsLegacySchema())
    {
-      // Ensure statement gets cleaned up
-      sqlite3_stmt *stmt = nullptr;
-      auto cleanup = finally([&]
+      std::vector<SampleBlockID> stale;
+      auto cb = [&](int cols, char **vals, char **){
+         SampleBlockID blockid;
+         wxString{ vals[0] }.ToLongLong(&blockid);
+         if (cols > 1 && vals[1] && blockids.erase(blockid))
+            mCopyStatistics.reused++;
+         else
+            stale.push_back(blockid);
+         return 0;
+      };
+      if (!Query(
+         "SELECT o.blockid, m.blockid FROM outbound.sampleblocks AS o"
+         "  LEFT JOIN main.sampleblocks AS m"
+         "    ON m.blockid = o.blockid"
+         "   AND m.sampleformat = o.sampleformat"
+         "   AND length(m.samples) = length(o.samples)"
+         "   AND m.checksum IS NOT NULL AND m.checksum = o.checksum;", cb))
       {
-         if (stmt)
+         // Error message already captured.
+         return false;
+      }
+
+      for (auto blockid : stale)
+      {
+         sql.Printf(
+            "DELETE FROM outbound.sampleblocks WHERE blockid = %lld;", blockid);
+         rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+         if (rc != SQLITE_OK)
          {
-            // No need to check return code
-            sqlite3_finalize(stmt);
+            SetDBError(
+               XO("Failed to update the project file.\nThe following command failed:\n\n%s").Format(sql)
+            );
+            return false;
          }
-      });
+      }
+   }
 
-      // Prepare the statement only once
-      rc = sqlite3_prepare_v2(db,
-                              "INSERT INTO outbound.sampleblocks"
-                              "  SELECT * FROM main.sampleblocks"
-                              "  WHERE blockid = ?;",
-                              -1,
-                              &stmt,
-                              nullptr);
-      if (rc != SQLITE_OK)
+   // Find the sizes of the blocks to copy, so that progress is by bytes
+   std::vector<std::pair<SampleBlockID, int64_t>> work;
+   int64_t total = 0;
+   {
+      auto cb = [&](int cols, char **vals, char **){
+         SampleBlockID blockid;
+         wxString{ vals[0] }.ToLongLong(&blockid);
+         if (blockids.count(blockid))
+         {
+            long long bytes = 0;
+            if (cols > 1 && vals[1])
+               wxString{ vals[1] }.ToLongLong(&bytes);
+            work.emplace_back(blockid, bytes);
+            total += bytes;
+         }
+         return 0;
+      };
+      if (!Query(
+         "SELECT blockid, length(samples) FROM main.sampleblocks;", cb))
       {
-         ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
-         ADD_EXCEPTION_CONTEXT(
-            "sqlite3.context", "ProjectGileIO::CopyTo.prepare");
-
-         SetDBError(
-            XO("Unable to prepare project file command:\n\n%s").Format(sql)
-         );
+         // Error message already captured.
          return false;
       }
+   }
 
-      /* i18n-hint: This title appears on a dialog that indicates the progress
-         in doing something.*/
-      ProgressDialog progress(XO("Progress"), msg, pdlgHideStopButton);
-      ProgressResult result = ProgressResult::Success;
-
-      wxLongLong_t count = 0;
-      wxLongLong_t total = blockids.size();
+   {
+      // Copy sample blocks from the main DB to the outbound DB in a worker
+      // thread, while this thread shows progress
+      struct CopyState
+      {
+         std::atomic<int64_t> bytes{ 0 };
+         std::atomic<size_t> blocks{ 0 };
+         std::atomic<bool> cancel{ false };
+         std::atomic<bool> done{ false };
+         int rc = SQLITE_OK;
+         const char *context = nullptr;
+         const char *command = "INSERT INTO outbound.sampleblocks";
+      } state;
+
+      const auto copyBlocks = [&]
+      {
+         auto finish = finally([&]{ state.done = true; });
 
-      // Start a transaction.  Since we're running without a journal,
-      // this really doesn't provide rollback.  It just prevents SQLite
-      // from auto committing after each step through the loop.
-      //
-      // Also note that we will have an open transaction if we fail
-      // while copying the blocks. This is fine since we're just going
-      // to delete the database anyway.
-      sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+         sqlite3_stmt *stmt = nullptr;
+         auto cleanup = finally([&]
+         {
+            if (stmt)
+            {
+               // No need to check return code
+               sqlite3_finalize(stmt);
+            }
+         });
 
-      // Copy sample blocks from the main DB to the outbound DB
-      for (auto blockid : blockids)
-      {
-         // Bind statement parameters
-         rc = sqlite3_bind_int64(stmt, 1, blockid);
+         // Prepare the statement only once
+         auto rc = sqlite3_prepare_v2(db,
+                                      "INSERT INTO outbound.sampleblocks"
+                                      "  SELECT * FROM main.sampleblocks"
+                                      "  WHERE blockid = ?;",
+                                      -1,
+                                      &stmt,
+                                      nullptr);
          if (rc != SQLITE_OK)
          {
-            ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
-            ADD_EXCEPTION_CONTEXT(
-               "sqlite3.context", "ProjectGileIO::CopyTo.bind");
-
-            SetDBError(
-               XO("Failed to bind SQL parameter")
-            );
-
-            return false;
+            state.rc = rc, state.context = "ProjectFileIO::CopyTo.prepare";
+            return;
          }
 
-         // Process it
-         rc = sqlite3_step(stmt);
-         if (rc != SQLITE_DONE)
+         // Commit after so many blocks or bytes, so that an interrupted copy
+         // keeps most of its work.  Since the outbound DB runs without a
+         // journal, these transactions can't be rolled back; they just
+         // prevent SQLite from auto committing after each step.
+         constexpr size_t ChunkBlocks = 256;
+         constexpr int64_t ChunkBytes = 64 * 1024 * 1024;
+         size_t chunkBlocks = 0;
+         int64_t chunkBytes = 0;
+         bool inTransaction = false;
+
+         // End a transaction that a failure leaves open, so that the
+         // connection can still detach outbound and begin others; the copy
+         // is then abandoned, so the state of its rows doesn't matter
+         auto endTransaction = finally([&]
          {
-            ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
-            ADD_EXCEPTION_CONTEXT(
-               "sqlite3.context", "ProjectGileIO::CopyTo.step");
+            if (inTransaction)
+            {
+               // No need to check return code
+               sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            }
+         });
 
-            SetDBError(
-               XO("Failed to update the project file.\nThe following command failed:\n\n%s").Format(sql)
-            );
-            return false;
-         }
+         const auto exec = [&](const char *sql, const char *context)
+         {
+            rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+            if (rc != SQLITE_OK)
+               state.rc = rc, state.context = context, state.command = sql;
+            return rc == SQLITE_OK;
+         };
 
-         // Reset statement to beginning
-         if (sqlite3_reset(stmt) != SQLITE_OK)
+         for (const auto &item : work)
          {
-            ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
-            ADD_EXCEPTION_CONTEXT(
-               "sqlite3.context", "ProjectGileIO::CopyTo.reset");
+            if (state.cancel)
+               break;
 
-            THROW_INCONSISTENCY_EXCEPTION;
+            if (!inTransaction)
+            {
+               if (!exec("BEGIN;", "ProjectFileIO::CopyTo.begin"))
+                  return;
+               inTransaction = true;
+            }
+
+            // Bind statement parameters
+            rc = sqlite3_bind_int64(stmt, 1, item.first);
+            if (rc != SQLITE_OK)
+            {
+               state.rc = rc, state.context = "ProjectFileIO::CopyTo.bind";
+               return;
+            }
+
+            // Process it
+            rc = sqlite3_step(stmt);
+            if (rc != SQLITE_DONE)
+            {
+               state.rc = rc, state.context = "ProjectFileIO::CopyTo.step";
+               return;
+            }
+
+            // Reset statement to beginning
+            rc = sqlite3_reset(stmt);
+            if (rc != SQLITE_OK)
+            {
+               state.rc = rc, state.context = "ProjectFileIO::CopyTo.reset";
+               return;
+            }
+
+            state.bytes += item.second;
+            ++state.blocks;
+            if (++chunkBlocks >= ChunkBlocks ||
+                (chunkBytes += item.second) >= ChunkBytes)
+            {
+               // A failed commit leaves the transaction open
+               if (!exec("COMMIT;", "ProjectFileIO::CopyTo.commit"))
+                  return;
+               inTransaction = false;
+               chunkBlocks = 0;
+               chunkBytes = 0;
+            }
          }
 
-         result = progress.Update(++count, total);
-         if (result != ProgressResult::Success)
+         // Also when cancelled, so that the rows copied so far stay whole
+         if (inTransaction)
          {
-            // Note that we're not setting success, so the finally
-            // block above will take care of cleaning up
-            return false;
+            if (!exec("COMMIT;", "ProjectFileIO::CopyTo.commit"))
+               return;
+            inTransaction = false;
          }
+      };
+
+      /* i18n-hint: This title appears on a dialog that indicates the progress
+         in doing something.*/
+      ProgressDialog progress(XO("Progress"), msg, pdlgHideStopButton);
+
+      const auto start = std::chrono::steady_clock::now();
+      std::thread worker{ copyBlocks };
+      while (!state.done)
+      {
+         wxMilliSleep(50);
+         auto result = progress.Update(
+            wxLongLong_t(state.bytes), wxLongLong_t(total));
+         if (result != ProgressResult::Success)
+            state.cancel = true;
+      }
+      worker.join();
+
+      mCopyStatistics.blocks = state.blocks;
+      mCopyStatistics.bytes = state.bytes;
+      mCopyStatistics.seconds = std::chrono::duration<double>(
+         std::chrono::steady_clock::now() - start).count();
+      mCopyStatistics.cancelled = state.cancel;
+
+      if (state.rc != SQLITE_OK)
+      {
+         rc = state.rc;
+         ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
+         ADD_EXCEPTION_CONTEXT("sqlite3.context", state.context);
+
+         SetDBError(
+            XO("Failed to update the project file.\nThe following command failed:\n\n%s")
+               .Format(state.command)
+         );
+         return false;
+      }
+
+      if (state.cancel)
+      {
+         // Note that we're not setting success, so the finally
+         // block above will take care of cleaning up, but the copied rows
+         // are whole and may be kept for another try
+         keepPartial = resumable;
+         return false;
       }
 
       // Write the doc.
@@ -1050,9 +1335,6 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
       {
          return false;
       }
-
-      // See BEGIN above...
-      sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
    }
 
    // Detach the destination database
@@ -1060,7 +1342,7 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
    if (rc != SQLITE_OK)
    {
       ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
-      ADD_EXCEPTION_CONTEXT("sqlite3.context", "ProjectGileIO::CopyTo::detach");
+      ADD_EXCEPTION_CONTEXT("sqlite3.context", "ProjectFileIO::CopyTo::detach");
 
       SetDBError(
          XO("Destination project could not be detached")
@@ -1075,6 +1357,13 @@ bool ProjectFileIO::CopyTo(const FilePath &destpath,
    return true;
 }
 
+void ProjectFileIO::RemoveCompactTemp(const FilePath &filename)
+{
+   const wxString tempName = filename + "_compact_temp";
+   if (wxFileExists(tempName))
+      wxRemoveFile(tempName);
+}
+
 bool ProjectFileIO::ShouldCompact(const std::vector<const TrackList *> &tracks)
 {
    SampleBlockIDSet active;
@@ -1334,6 +1623,9 @@ void ProjectFileIO::Compact(
             (void) AutoSaveDelete();
          }
 
+         // Nor keep what an interrupted compaction left behind
+         RemoveCompactTemp(mFileName);
+
          return;
       }
    }
@@ -1347,7 +1639,18 @@ void ProjectFileIO::Compact(
    // REVIEW: Compact can fail on the CopyTo with no error messages.  That's OK?
    // LLL: We could display an error message or just ignore the failure and allow
    // the file to be compacted the next time it's saved.
-   if (CopyTo(tempName, XO("Compacting project"), IsTemporary(), !tracks.empty(), tracks))
+   const bool copied = CopyTo(tempName, XO("Compacting project"),
+      IsTemporary(), !tracks.empty(), tracks, true);
+
+   const auto &stats = mCopyStatistics;
+   wxLogInfo(wxT("Compaction %s: %llu blocks (%llu kept from before), %.1f MB in %.1f s, %.1f MB/s"),
+      copied ? wxT("completed") : stats.cancelled ? wxT("cancelled") : wxT("failed"),
+      (unsigned long long)stats.blocks, (unsigned long long)stats.reused,
+      stats.bytes / 1048576.0, stats.seconds,
+      stats.bytes / 1048576.0 / std::max(stats.seconds, 0.001));
+   mCompactStatistics = stats;
+
+   if (copied)
    {
       // Must close the database to rename it
       if (CloseConnection())
@@ -1437,6 +1740,183 @@ void ProjectFileIO::Compact(
    return;
 }
 
+auto ProjectFileIO::GetCompactStatistics() const -> const CopyStatistics &
+{
+   return mCompactStatistics;
+}
+
+bool ProjectFileIO::VerifyBlocks(VerifyResult &result)
+{
+   result = {};
+
+   // Find the range of block ids, and the bytes to read for progress
+   SampleBlockID minId = 0, maxId = -1;
+   int64_t total = 0;
+   {
+      auto cb = [&](int cols, char **vals, char **){
+         if (cols > 2 && vals[0] && vals[1])
+         {
+            long long value;
+            wxString{ vals[0] }.ToLongLong(&value), minId = value;
+            wxString{ vals[1] }.ToLongLong(&value), maxId = value;
+            if (vals[2])
+               wxString{ vals[2] }.ToLongLong(&value), total = value;
+         }
+         return 0;
+      };
+      if (!Query("SELECT min(blockid), max(blockid), sum(length(samples))"
+                 "  FROM sampleblocks;", cb))
+      {
+         // Error message already captured.
+         return false;
+      }
+   }
+
+   const std::string path = mFileName.ToUTF8().data();
+   const bool legacy = CurrConn()->IsLegacySchema();
+
+   // Threads take slices of the id range in turn, so that they finish
+   // together however the blocks are distributed
+   constexpr SampleBlockID SliceIds = 256;
+   struct VerifyState
+   {
+      std::atomic<SampleBlockID> next;
+      std::atomic<int64_t> bytes{ 0 };
+      std::atomic<size_t> blocks{ 0 };
+      std::atomic<size_t> unverified{ 0 };
+      std::atomic<bool> cancel{ false };
+      std::atomic<unsigned> running{ 0 };
+      std::mutex mutex;
+      std::vector<SampleBlockID> damaged;
+      int rc = SQLITE_OK;
+   } state;
+   state.next = minId;
+
+   const auto verifySlices = [&]
+   {
+      auto finish = finally([&]{ --state.running; });
+
+      sqlite3 *db = nullptr;
+      sqlite3_stmt *stmt = nullptr;
+      auto cleanup = finally([&]
+      {
+         // No need to check return codes
+         if (stmt)
+            sqlite3_finalize(stmt);
+         if (db)
+            sqlite3_close(db);
+      });
+
+      auto fail = [&](int rc)
+      {
+         std::lock_guard<std::mutex> guard(state.mutex);
+         if (state.rc == SQLITE_OK)
+            state.rc = rc;
+         state.cancel = true;
+      };
+
+      // Verification must neither write to the file it checks, nor lock it
+      // against writing
+      int rc = sqlite3_open_v2(path.c_str(), &db,
+         SQLITE_OPEN_READONLY, nullptr);
+      if (rc == SQLITE_OK)
+         rc = sqlite3_busy_timeout(db, 5000);
+      // This connection lacks the view that supplies missing columns
+      if (rc == SQLITE_OK)
+         rc = sqlite3_prepare_v2(db, legacy
+            ? "SELECT blockid, NULL, samples FROM sampleblocks"
+              "  WHERE blockid BETWEEN ?1 AND ?2;"
+            : "SELECT blockid, checksum, samples FROM sampleblocks"
+              "  WHERE blockid BETWEEN ?1 AND ?2;",
+            -1, &stmt, nullptr);
+      if (rc != SQLITE_OK)
+         return fail(rc);
+
+      std::vector<SampleBlockID> damaged;
+      while (!state.cancel)
+      {
+         const SampleBlockID first = state.next.fetch_add(SliceIds);
+         if (first > maxId)
+            break;
+
+         sqlite3_bind_int64(stmt, 1, first);
+         sqlite3_bind_int64(stmt, 2, first + SliceIds - 1);
+         while (!state.cancel && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+         {
+            const auto blockid = sqlite3_column_int64(stmt, 0);
+            const void *samples = sqlite3_column_blob(stmt, 2);
+            const auto bytes = sqlite3_column_bytes(stmt, 2);
+            if (sqlite3_column_type(stmt, 1) == SQLITE_NULL)
+               ++state.unverified;
+            else if (uint64_t(sqlite3_column_int64(stmt, 1)) !=
+               SampleBlockCodec::Checksum(samples, bytes))
+               damaged.push_back(blockid);
+            ++state.blocks;
+            state.bytes += bytes;
+         }
+         if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+            return fail(rc);
+         sqlite3_reset(stmt);
+      }
+
+      std::lock_guard<std::mutex> guard(state.mutex);
+      state.damaged.insert(state.damaged.end(), damaged.begin(), damaged.end());
+   };
+
+   // Reading is mostly bound by the disk, and checksums are cheap, so a few
+   // threads suffice to keep it busy
+   const auto nThreads =
+      std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+
+   /* i18n-hint: This title appears on a dialog that indicates the progress
+      in doing something.*/
+   ProgressDialog progress(XO("Progress"), XO("Verifying project"));
+
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<std::thread> threads;
+   state.running = nThreads;
+   for (unsigned ii = 0; ii < nThreads; ++ii)
+      threads.emplace_back(verifySlices);
+   while (state.running)
+   {
+      wxMilliSleep(50);
+      auto update = progress.Update(
+         wxLongLong_t(state.bytes), wxLongLong_t(std::max<int64_t>(total, 1)));
+      if (update != ProgressResult::Success)
+         state.cancel = true;
+   }
+   for (auto &thread : threads)
+      thread.join();
+
+   std::sort(state.damaged.begin(), state.damaged.end());
+   result.damaged = std::move(state.damaged);
+   result.blocks = state.blocks;
+   result.unverified = state.unverified;
+   result.bytes = state.bytes;
+   result.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+   result.cancelled = state.cancel && state.rc == SQLITE_OK;
+
+   if (state.rc != SQLITE_OK)
+   {
+      ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(state.rc));
+      ADD_EXCEPTION_CONTEXT("sqlite3.context", "ProjectFileIO::VerifyBlocks");
+
+      SetDBError(
+         XO("Failed to read the sample blocks of the project")
+      );
+      return false;
+   }
+
+   wxLogInfo(wxT("Verified %llu blocks, %llu bytes in %.3f seconds: "
+                 "%llu damaged, %llu without checksums"),
+      (unsigned long long) result.blocks, result.bytes, result.seconds,
+      (unsigned long long) result.damaged.size(),
+      (unsigned long long) result.unverified);
+
+   return true;
+}
+
 bool ProjectFileIO::WasCompacted()
 {
    return mWasCompacted;
@@ -2180,6 +2660,10 @@ bool ProjectFileIO::CloseProject()
    // the recovery dialog upon next restart.
    if (CloseConnection())
    {
+      // Rows kept by a cancelled compaction are only reused while the
+      // project stays open
+      RemoveCompactTemp(filename);
+
       // If this is a temporary project, we no longer want to keep the
       // project file.
       if (IsTemporary())
@@ -2390,7 +2874,8 @@ int64_t ProjectFileIO::GetDiskUsage(DBConnection &conn, SampleBlockID blockid /*
    sqlite3_stmt *stmt =
       conn.Prepare(DBConnection::GetRootPage,
                     "SELECT rootpage FROM sqlite_master WHERE tbl_name = 'sampleblocks';");
-   if (stmt == nullptr || sqlite3_step(stmt) != SQLITE_ROW)
+   if (stmt == nullptr ||
+       conn.Step(DBConnection::GetRootPage, stmt) != SQLITE_ROW)
    {
       ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(sqlite3_errcode(conn.DB())));
       ADD_EXCEPTION_CONTEXT("sqlite3.context", "ProjectGileIO::GetDiskUsage");
@@ -2429,7 +2914,7 @@ int64_t ProjectFileIO::GetDiskUsage(DBConnection &conn, SampleBlockID blockid /*
          sqlite3_bind_int64(stmt, 1, pg.pgno);
 
          // And retrieve the page
-         if (sqlite3_step(stmt) != SQLITE_ROW)
+         if (conn.Step(DBConnection::GetDBPage, stmt) != SQLITE_ROW)
          {
             // REVIEW: Likely harmless failure - says size is zero on
             // this error.
@@ -42,6 +42,15 @@ using Connection = std::unique_ptr<DBConnection>;
 
 using BlockIDs = std::unordered_set<SampleBlockID>;
 
+// Preferences for the storage of sample blocks that need the columns of the
+// current project file version, defined in SqliteSampleBlock.cpp
+
+//! Whether new blocks are stored with lossless compression
+extern AUDACITY_DLL_API BoolSetting CompressSampleBlocks;
+
+//! Whether to defer computing the summaries of new blocks until first needed
+extern AUDACITY_DLL_API BoolSetting LazySampleBlockSummaries;
+
 // An event processed by the project in the main thread after a checkpoint
 // failure was detected in a worker thread
 wxDECLARE_EXPORTED_EVENT( AUDACITY_DLL_API,
@@ -184,6 +193,42 @@ public:
    // The last compact check found unused blocks in the project file
    bool HadUnused();
 
+   //! Measurements of copying sample blocks to another file
+   struct CopyStatistics
+   {
+      //! Blocks and bytes of samples copied
+      size_t blocks = 0;
+      unsigned long long bytes = 0;
+      //! Blocks found already copied by an interrupted compaction
+      size_t reused = 0;
+      double seconds = 0;
+      bool cancelled = false;
+   };
+
+   //! Measurements of the last compaction that copied blocks, whether or not
+   //! it completed
+   const CopyStatistics &GetCompactStatistics() const;
+
+   //! Outcome of VerifyBlocks()
+   struct VerifyResult
+   {
+      //! Blocks whose stored samples disagree with their checksum
+      std::vector<SampleBlockID> damaged;
+      //! Blocks examined, and how many of them had no checksum to compare
+      size_t blocks = 0;
+      size_t unverified = 0;
+      unsigned long long bytes = 0;
+      double seconds = 0;
+      bool cancelled = false;
+   };
+
+   //! Compare the samples of every block in the file with their checksums,
+   //! reading in several threads with connections of their own, while
+   //! showing progress
+   /*! Sees only what is committed to the file.
+    @return false, with the error set, if the file could not be read */
+   bool VerifyBlocks(VerifyResult &result);
+
    // In one SQL command, delete sample blocks with ids in the given set, or
    // (when complement is true), with ids not in the given set.
    bool DeleteBlocks(const BlockIDs &blockids, bool complement);
@@ -243,7 +288,13 @@ private:
    bool GetBlob(const char *sql, wxMemoryBuffer &buffer);
 
    bool CheckVersion();
-   bool InstallSchema(sqlite3 *db, const char *schema = "main");
+   //! @param legacy whether to make the sampleblocks table of files that
+   //! Audacity 3.0 can open
+   bool InstallSchema(sqlite3 *db, const char *schema = "main",
+      bool legacy = false);
+   //! Add later columns to an older file, or else make a view supplying them
+   /*! The file is left unchanged unless the preferences call for the new
+       columns, or when it can't be written */
    bool UpgradeSchema();
 
    // Write project or autosave XML (binary) documents
@@ -260,6 +311,10 @@ private:
       const std::vector<const TrackList *> &tracks = {} /*!<
          First track list (or if none, then the project's track list) are tracks to write into document blob;
          That list, plus any others, contain tracks whose sample blocks must be kept
+      */,
+      bool resumable = false /*!<
+         If true, blocks already in an existing destination are not copied
+         again, and if the user cancels, the blocks copied so far are kept
       */
    );
 
@@ -275,6 +330,9 @@ private:
 
    bool ShouldCompact(const std::vector<const TrackList *> &tracks);
 
+   //! Remove the file that a cancelled compaction of the project may have kept
+   static void RemoveCompactTemp(const FilePath &filename);
+
    // Gets values from SQLite B-tree structures
    static unsigned int get2(const unsigned char *ptr);
    static unsigned int get4(const unsigned char *ptr);
@@ -303,6 +361,10 @@ private:
    // Project was compacted last time Compact() ran
    bool mWasCompacted;
 
+   // Measurements of the last CopyTo() and of the last compaction
+   CopyStatistics mCopyStatistics;
+   CopyStatistics mCompactStatistics;
+
    // Project had unused blocks during last Compact()
    bool mHadUnused;
 
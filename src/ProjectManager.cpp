@@ -15,6 +15,7 @@ Paul Licameli split from AudacityProject.cpp
 #include "ActiveProject.h"
 #include "AdornedRulerPanel.h"
 #include "AudioIO.h"
+#include "BlockCoalescer.h"
 #include "Clipboard.h"
 #include "FileNames.h"
 #include "Menus.h"
@@ -557,6 +558,9 @@ AudacityProject *ProjectManager::New()
    
    projectHistory.InitialState();
    projectManager.RestartTimer();
+
+   // Begin merging small sample blocks after edits
+   BlockCoalescer::Get( project );
    
    if(bMaximized) {
       window.Maximize(true);
@@ -758,6 +762,9 @@ void ProjectManager::OnCloseWindow(wxCloseEvent & event)
    // TODO: Is there a Mac issue here??
    // SetMenuBar(NULL);
 
+   // No more rewriting of blocks in idle time
+   BlockCoalescer::Get( project ).Stop();
+
    // Compact the project.
    projectFileManager.CompactProjectOnClose();
 
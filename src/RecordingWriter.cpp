@@ -0,0 +1,118 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file RecordingWriter.cpp
+@brief Define RecordingWriter, a queue and worker thread that store recorded samples
+
+**********************************************************************/
+
+#include "RecordingWriter.h"
+
+#include <algorithm>
+
+size_t RecordedSamples::Bytes() const
+{
+   size_t result = 0;
+   for (auto &runs : channels)
+      for (auto &run : runs)
+         result += run.length * SAMPLE_SIZE(run.format);
+   return result;
+}
+
+RecordingWriter::RecordingWriter( Consumer consumer )
+   : mConsumer{ std::move( consumer ) }
+{
+   mThread = std::thread( [this]{ Thread(); } );
+}
+
+RecordingWriter::~RecordingWriter()
+{
+   {
+      std::lock_guard< std::mutex > guard{ mMutex };
+      mStop = true;
+   }
+   mCondition.notify_one();
+   if (mThread.joinable())
+      mThread.join();
+}
+
+void RecordingWriter::SetLimit( size_t bytes )
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   mLimit = bytes;
+}
+
+bool RecordingWriter::IsFull()
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   const bool full = mLimit > 0 && mStatistics.bytes >= mLimit;
+   if (full)
+      ++mStatistics.deferrals;
+   return full;
+}
+
+void RecordingWriter::Post( RecordedSamples samples )
+{
+   const auto bytes = samples.Bytes();
+   {
+      std::lock_guard< std::mutex > guard{ mMutex };
+      mQueue.push_back( std::move( samples ) );
+      auto &stats = mStatistics;
+      stats.depth = mQueue.size();
+      stats.maxDepth = std::max( stats.maxDepth, stats.depth );
+      stats.bytes += bytes;
+      stats.maxBytes = std::max( stats.maxBytes, stats.bytes );
+   }
+   mCondition.notify_one();
+}
+
+bool RecordingWriter::IsIdle() const
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   return mQueue.empty() && !mBusy;
+}
+
+auto RecordingWriter::GetStatistics() const -> Statistics
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   return mStatistics;
+}
+
+void RecordingWriter::ResetStatistics()
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   auto &stats = mStatistics;
+   stats.maxDepth = stats.depth;
+   stats.maxBytes = stats.bytes;
+   stats.deferrals = 0;
+}
+
+void RecordingWriter::Thread()
+{
+   while (true)
+   {
+      RecordedSamples samples;
+      {
+         std::unique_lock< std::mutex > lock{ mMutex };
+         mBusy = false;
+         mCondition.wait( lock, [this]{ return mStop || !mQueue.empty(); } );
+
+         // Requested to stop, so bail.  The owner drains the queue first,
+         // waiting for IsIdle()
+         if (mStop)
+            break;
+
+         samples = std::move( mQueue.front() );
+         mQueue.pop_front();
+         mBusy = true;
+      }
+
+      const auto bytes = samples.Bytes();
+      mConsumer( samples );
+
+      std::lock_guard< std::mutex > guard{ mMutex };
+      mStatistics.depth = mQueue.size();
+      mStatistics.bytes -= bytes;
+   }
+}
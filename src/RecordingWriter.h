@@ -0,0 +1,105 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file RecordingWriter.h
+@brief Declare RecordingWriter, a queue and worker thread that store recorded samples
+
+**********************************************************************/
+
+#ifndef __AUDACITY_RECORDING_WRITER__
+#define __AUDACITY_RECORDING_WRITER__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MemoryX.h"
+#include "SampleFormat.h"
+
+//! Samples drained from the capture buffers in one exchange
+struct RecordedSamples
+{
+   //! A contiguous run of samples to append to one track
+   struct Run
+   {
+      ArrayOf<char> samples;
+      sampleFormat format;
+      size_t length;
+   };
+
+   //! For each capture channel, runs in the order to append them
+   std::vector< std::vector< Run > > channels;
+
+   size_t Bytes() const;
+};
+
+//! Moves the appending of recorded samples to tracks off the audio thread
+/*!
+ Appending to a WaveTrack computes summaries and inserts sample blocks into the
+ project file, which may wait for a slow disk.  The audio thread only posts
+ samples here, never waiting; a worker thread passes them to the consumer in
+ order.
+
+ The queue is bounded.  When it is full, the audio thread should leave samples
+ in its ring buffers, until the worker catches up.
+ */
+class AUDACITY_DLL_API RecordingWriter
+{
+public:
+   //! Invoked in the worker thread; must not throw
+   using Consumer = std::function< void( RecordedSamples& ) >;
+
+   explicit RecordingWriter( Consumer consumer );
+   ~RecordingWriter();
+
+   RecordingWriter( const RecordingWriter& ) = delete;
+   RecordingWriter &operator=( const RecordingWriter& ) = delete;
+
+   //! Bound the bytes of samples queued; zero means no bound
+   void SetLimit( size_t bytes );
+
+   //! Whether the queue has reached its bound; counts a deferral if so
+   bool IsFull();
+
+   //! Queue samples for the consumer; never waits
+   void Post( RecordedSamples samples );
+
+   //! Whether all posted samples were consumed
+   bool IsIdle() const;
+
+   struct Statistics
+   {
+      //! Exchanges queued now, and the most at once
+      size_t depth = 0;
+      size_t maxDepth = 0;
+      //! Bytes queued now, and the most at once
+      size_t bytes = 0;
+      size_t maxBytes = 0;
+      //! Times IsFull() returned true
+      unsigned long long deferrals = 0;
+   };
+   Statistics GetStatistics() const;
+   void ResetStatistics();
+
+private:
+   void Thread();
+
+   const Consumer mConsumer;
+
+   mutable std::mutex mMutex;
+   std::condition_variable mCondition;
+   std::deque< RecordedSamples > mQueue;
+   size_t mLimit{ 0 };
+   //! Whether the worker is now consuming
+   bool mBusy{ false };
+   bool mStop{ false };
+   Statistics mStatistics;
+
+   std::thread mThread;
+};
+
+#endif
@@ -22,6 +22,18 @@
   AvailForPut and AvailForGet may underestimate but will never
   overestimate.
 
+*//****************************************************************//*!
+
+\class MultiRingBuffer
+\brief Holds streamed audio samples of several channels that advance
+together.
+
+  Like RingBuffer, but the writer fills each channel separately and then
+  publishes all at once, and the reader likewise consumes all at once.  That
+  is one pair of atomic operations per transfer, not one per channel, and
+  each channel's samples remain contiguous.  Either side may also work in
+  the storage directly, through spans, and skip a copy.
+
 *//*******************************************************************/
 
 
@@ -195,3 +207,127 @@ size_t RingBuffer::Discard(size_t samplesToDiscard)
 
    return samplesToDiscard;
 }
+
+MultiRingBuffer::MultiRingBuffer(
+   sampleFormat format, size_t nChannels, size_t size)
+   : mBufferSize{ std::max<size_t>(size, 64) }
+   , mnChannels{ nChannels }
+   , mFormat{ format }
+   , mBuffer{ mBufferSize * std::max<size_t>(nChannels, 1), mFormat }
+{
+}
+
+MultiRingBuffer::~MultiRingBuffer()
+{
+}
+
+size_t MultiRingBuffer::Filled( size_t start, size_t end )
+{
+   return (end + mBufferSize - start) % mBufferSize;
+}
+
+size_t MultiRingBuffer::Free( size_t start, size_t end )
+{
+   return std::max<size_t>(mBufferSize - Filled( start, end ), 4) - 4;
+}
+
+auto MultiRingBuffer::MakeSpans(
+   size_t channel, size_t pos, size_t samples ) -> Spans
+{
+   const auto sampleSize = SAMPLE_SIZE(mFormat);
+   const auto base = mBuffer.ptr() + channel * mBufferSize * sampleSize;
+   const auto first = std::min( samples, mBufferSize - pos );
+   return {{
+      { base + pos * sampleSize, first },
+      { base, samples - first }
+   }};
+}
+
+//
+// For the writer only:
+// The writer's acquiring of the start in AvailForPut() or Commit() makes
+// any reading done by the reader happen-before the reuse of the space.
+//
+
+size_t MultiRingBuffer::AvailForPut()
+{
+   auto start = mStart.load( std::memory_order_acquire );
+   auto end = mEnd.load( std::memory_order_relaxed );
+   return Free( start, end );
+}
+
+void MultiRingBuffer::Put(size_t channel, constSamplePtr buffer,
+   sampleFormat format, size_t samples, size_t padding)
+{
+   auto src = buffer;
+   for (auto &span : PutSpans( channel, samples + padding )) {
+      const auto toCopy = std::min( samples, span.length );
+      CopySamples(src, format, span.data, mFormat, toCopy, DitherType::none);
+      src += toCopy * SAMPLE_SIZE(format);
+      samples -= toCopy;
+      ClearSamples(span.data, mFormat, toCopy, span.length - toCopy);
+   }
+}
+
+auto MultiRingBuffer::PutSpans(size_t channel, size_t samples) -> Spans
+{
+   auto end = mEnd.load( std::memory_order_relaxed );
+   return MakeSpans( channel, end, samples );
+}
+
+size_t MultiRingBuffer::Commit(size_t samples)
+{
+   auto start = mStart.load( std::memory_order_acquire );
+   auto end = mEnd.load( std::memory_order_relaxed );
+   samples = std::min( samples, Free( start, end ) );
+
+   // Atomically update the end pointer with release, so the nonatomic writes
+   // to all channels don't get reordered after
+   mEnd.store((end + samples) % mBufferSize, std::memory_order_release);
+
+   return samples;
+}
+
+//
+// For the reader only:
+// The reader's acquiring of the end in AvailForGet() makes the writing of
+// the samples so published happen-before Get() or GetSpans().
+//
+
+size_t MultiRingBuffer::AvailForGet()
+{
+   auto end = mEnd.load( std::memory_order_acquire );
+   auto start = mStart.load( std::memory_order_relaxed );
+   return Filled( start, end );
+}
+
+void MultiRingBuffer::Get(size_t channel, samplePtr buffer,
+   sampleFormat format, size_t samples)
+{
+   // Same formats reduce to memcpy
+   auto dest = buffer;
+   for (auto &span : GetSpans( channel, samples )) {
+      CopySamples(span.data, mFormat, dest, format, span.length,
+         DitherType::none);
+      dest += span.length * SAMPLE_SIZE(format);
+   }
+}
+
+auto MultiRingBuffer::GetSpans(size_t channel, size_t samples) -> Spans
+{
+   auto start = mStart.load( std::memory_order_relaxed );
+   return MakeSpans( channel, start, samples );
+}
+
+size_t MultiRingBuffer::Discard(size_t samples)
+{
+   auto end = mEnd.load( std::memory_order_relaxed ); // get away with it here
+   auto start = mStart.load( std::memory_order_relaxed );
+   samples = std::min( samples, Filled( start, end ) );
+
+   // Communicate to writer that we have consumed some data,
+   // with nonrelaxed ordering
+   mStart.store((start + samples) % mBufferSize, std::memory_order_release);
+
+   return samples;
+}
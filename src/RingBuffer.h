@@ -12,6 +12,7 @@
 #define __AUDACITY_RING_BUFFER__
 
 #include "SampleFormat.h"
+#include <array>
 #include <atomic>
 
 class RingBuffer final : public NonInterferingBase {
@@ -52,4 +53,78 @@ class RingBuffer final : public NonInterferingBase {
    SampleBuffer  mBuffer;
 };
 
+//! Like RingBuffer, but for several channels written and read in step
+/*! All channels share one pair of positions, so that the writer publishes,
+ and the reader consumes, all of them with one atomic store */
+class MultiRingBuffer final : public NonInterferingBase {
+ public:
+   //! A contiguous piece of the storage of one channel
+   struct Span {
+      samplePtr data;
+      size_t length;
+   };
+   //! The second piece is nonempty only where the queue wraps around
+   using Spans = std::array<Span, 2>;
+
+   MultiRingBuffer(sampleFormat format, size_t nChannels, size_t size);
+   ~MultiRingBuffer();
+
+   size_t Channels() const { return mnChannels; }
+
+   //
+   // For the writer only:
+   //
+
+   size_t AvailForPut();
+   //! Write one channel after the published samples, without publishing
+   /*!
+    @pre `samples + padding <= AvailForPut()`
+    Does not apply dithering
+    */
+   void Put(size_t channel, constSamplePtr buffer, sampleFormat format,
+      size_t samples,
+      // optional number of trailing zeroes
+      size_t padding = 0);
+   //! Storage of one channel after the published samples, to be written
+   //! in place instead of by Put()
+   /*! @pre `samples <= AvailForPut()` */
+   Spans PutSpans(size_t channel, size_t samples);
+   //! Publish samples of all channels, written by Put() or into PutSpans()
+   size_t Commit(size_t samples);
+
+   //
+   // For the reader only:
+   //
+
+   size_t AvailForGet();
+   //! Copy samples of one channel, without consuming them
+   /*!
+    @pre `samples <= AvailForGet()`
+    Does not apply dithering
+    */
+   void Get(size_t channel, samplePtr buffer, sampleFormat format,
+      size_t samples);
+   //! The next samples of one channel, to be read in place instead of
+   //! copied by Get()
+   /*! @pre `samples <= AvailForGet()` */
+   Spans GetSpans(size_t channel, size_t samples);
+   //! Consume samples of all channels, whether read or not
+   size_t Discard(size_t samples);
+
+ private:
+   size_t Filled( size_t start, size_t end );
+   size_t Free( size_t start, size_t end );
+   Spans MakeSpans( size_t channel, size_t pos, size_t samples );
+
+   // Align the two atomics to avoid false sharing
+   NonInterfering< std::atomic<size_t> > mStart { 0 }, mEnd{ 0 };
+
+   const size_t  mBufferSize;
+   const size_t  mnChannels;
+
+   sampleFormat  mFormat;
+   //! Channels lie one after another, each of mBufferSize samples
+   SampleBuffer  mBuffer;
+};
+
 #endif /*  __AUDACITY_RING_BUFFER__ */
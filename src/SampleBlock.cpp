@@ -68,8 +68,35 @@ SampleBlockPtr SampleBlockFactory::CreateFromXML(
    return result;
 }
 
+void SampleBlockFactory::Prefetch( const SampleBlock & )
+{
+}
+
+auto SampleBlockFactory::GetPrefetchStatistics() const -> PrefetchStatistics
+{
+   return {};
+}
+
+auto SampleBlockFactory::GetReadStatistics() const -> ReadStatistics
+{
+   return {};
+}
+
+void SampleBlockFactory::BeginBatch()
+{
+}
+
+void SampleBlockFactory::EndBatch()
+{
+}
+
 SampleBlock::~SampleBlock() = default;
 
+auto SampleBlock::GetView() -> View
+{
+   return {};
+}
+
 size_t SampleBlock::GetSamples(samplePtr dest,
                    sampleFormat destformat,
                    size_t sampleoffset,
@@ -9,11 +9,13 @@ SampleBlock.h
 #ifndef __AUDACITY_SAMPLE_BLOCK__
 #define __AUDACITY_SAMPLE_BLOCK__
 
+#include "MemoryX.h"
 #include "SampleFormat.h"
 
 #include <functional>
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
 class AudacityProject;
 class ProjectFileIO;
@@ -59,6 +61,17 @@ public:
 
    virtual size_t GetSampleCount() const = 0;
 
+   //! Read-only contents of the whole block, in the sample format in which
+   //! the block was created
+   using View = std::shared_ptr<const ArrayOf<char>>;
+
+   //! Share the contents of the block without conversion or copying, if
+   //! they are already held in memory
+   /*! Non-throwing, and never reads storage.  The default returns null.
+    @return null if no view is available, as for silent blocks or blocks not
+    held in memory; then use GetSamples() */
+   virtual View GetView();
+
    //! Non-throwing, should fill with zeroes on failure
    virtual bool
       GetSummary256(float *dest, size_t frameoffset, size_t numframes) = 0;
@@ -142,6 +155,49 @@ public:
    virtual BlockDeletionCallback SetBlockDeletionCallback(
       BlockDeletionCallback callback ) = 0;
 
+   //! Hint that the given block will soon be read; successive calls give
+   //! the order of reading
+   /*! May be called in the audio thread, so must not wait for the reads,
+       nor lock, nor allocate.  Default implementation does nothing. */
+   virtual void Prefetch( const SampleBlock &block );
+
+   //! Counters describing how well Prefetch() keeps ahead of reading
+   struct PrefetchStatistics
+   {
+      //! Blocks queued for reading ahead
+      unsigned long long requested = 0;
+      //! Blocks read ahead and ready before use
+      unsigned long long completed = 0;
+      //! Synchronous reads of blocks that were still queued
+      unsigned long long stalls = 0;
+      //! Blocks now queued
+      size_t depth = 0;
+      //! Greatest number of blocks queued at once
+      size_t maxDepth = 0;
+   };
+
+   virtual PrefetchStatistics GetPrefetchStatistics() const;
+
+   //! Counters of the bytes moved to read samples from storage
+   struct ReadStatistics
+   {
+      //! Bytes copied out of storage into intermediate buffers
+      unsigned long long staged = 0;
+      //! Bytes written into the buffers of callers
+      unsigned long long delivered = 0;
+   };
+
+   virtual ReadStatistics GetReadStatistics() const;
+
+   //! Begin grouping the storage of newly created blocks
+   /*! Calls may nest, and must be balanced by EndBatch(), on the same thread;
+    prefer SampleBlockBatch.  Blocks are still fully stored when Create()
+    returns, but the implementation may share the cost of storing many of
+    them.  Default implementation does nothing. */
+   virtual void BeginBatch();
+   //! End the grouping begun by the matching BeginBatch(); must not throw
+   virtual void EndBatch();
+
 protected:
    // The override should throw more informative exceptions on error than the
    // default InconsistencyException thrown by Create
@@ -162,4 +218,25 @@ protected:
       const wxChar **attrs) = 0;
 };
 
+//! RAII for SampleBlockFactory::BeginBatch() and EndBatch()
+class SampleBlockBatch
+{
+public:
+   explicit SampleBlockBatch( SampleBlockFactory &factory )
+      : mFactory{ factory }
+   {
+      mFactory.BeginBatch();
+   }
+   ~SampleBlockBatch()
+   {
+      mFactory.EndBatch();
+   }
+
+   SampleBlockBatch( const SampleBlockBatch& ) = delete;
+   SampleBlockBatch &operator=( const SampleBlockBatch& ) = delete;
+
+private:
+   SampleBlockFactory &mFactory;
+};
+
 #endif
@@ -0,0 +1,135 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SampleBlockCache.cpp
+@brief Implements SampleBlockCache
+
+**********************************************************************/
+
+#include "SampleBlockCache.h"
+
+#include "Project.h"
+
+IntSetting SampleBlockCacheSize{ L"/Performance/SampleBlockCacheMB", 64 };
+
+static const AudacityProject::AttachedObjects::RegisteredFactory
+sSampleBlockCacheKey{
+   []( AudacityProject & ){
+      return std::make_shared< SampleBlockCache >();
+   }
+};
+
+SampleBlockCache &SampleBlockCache::Get( AudacityProject &project )
+{
+   return project.AttachedObjects::Get< SampleBlockCache >(
+      sSampleBlockCacheKey );
+}
+
+const SampleBlockCache &SampleBlockCache::Get( const AudacityProject &project )
+{
+   return Get( const_cast< AudacityProject & >( project ) );
+}
+
+SampleBlockCache::SampleBlockCache( size_t budget )
+   : mBudget{ budget }
+{
+}
+
+SampleBlockCache::~SampleBlockCache() = default;
+
+void SampleBlockCache::SetBudget( size_t budget )
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   mBudget = budget;
+   Evict( budget );
+}
+
+size_t SampleBlockCache::GetBudget() const
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   return mBudget;
+}
+
+bool SampleBlockCache::IsEnabled() const
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   return mBudget > 0;
+}
+
+auto SampleBlockCache::Find( SampleBlockID id ) -> Data
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   auto iter = mIndex.find( id );
+   if ( iter == mIndex.end() ) {
+      ++mStats.misses;
+      return {};
+   }
+   ++mStats.hits;
+   // Move to the front without reallocating
+   mList.splice( mList.begin(), mList, iter->second );
+   return iter->second->data;
+}
+
+bool SampleBlockCache::Contains( SampleBlockID id ) const
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   return mIndex.count( id ) > 0;
+}
+
+void SampleBlockCache::Insert( SampleBlockID id, Data data, size_t bytes )
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   if ( !data || bytes > mBudget )
+      return;
+
+   auto iter = mIndex.find( id );
+   if ( iter != mIndex.end() ) {
+      // Another thread got here first; contents of a block never change
+      mList.splice( mList.begin(), mList, iter->second );
+      return;
+   }
+
+   Evict( mBudget - bytes );
+   mList.push_front( { id, std::move( data ), bytes } );
+   mIndex.emplace( id, mList.begin() );
+   mStats.bytes += bytes;
+}
+
+void SampleBlockCache::Erase( SampleBlockID id )
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   auto iter = mIndex.find( id );
+   if ( iter == mIndex.end() )
+      return;
+   mStats.bytes -= iter->second->bytes;
+   mList.erase( iter->second );
+   mIndex.erase( iter );
+}
+
+auto SampleBlockCache::GetStatistics() const -> Statistics
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   auto result = mStats;
+   result.entries = mList.size();
+   result.budget = mBudget;
+   return result;
+}
+
+void SampleBlockCache::ResetStatistics()
+{
+   std::lock_guard< std::mutex > guard{ mMutex };
+   mStats.hits = mStats.misses = mStats.evictions = 0;
+}
+
+void SampleBlockCache::Evict( size_t budget )
+{
+   // Called with the mutex held
+   while ( mStats.bytes > budget && !mList.empty() ) {
+      auto &entry = mList.back();
+      mStats.bytes -= entry.bytes;
+      mIndex.erase( entry.id );
+      mList.pop_back();
+      ++mStats.evictions;
+   }
+}
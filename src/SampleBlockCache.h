@@ -0,0 +1,102 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SampleBlockCache.h
+@brief Declare SampleBlockCache, a bounded cache of sample block contents
+
+**********************************************************************/
+
+#ifndef __AUDACITY_SAMPLE_BLOCK_CACHE__
+#define __AUDACITY_SAMPLE_BLOCK_CACHE__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "ClientData.h" // to inherit
+#include "MemoryX.h"
+#include "Prefs.h"
+
+class AudacityProject;
+
+// From SampleBlock.h
+using SampleBlockID = long long;
+
+//! Size of the per-project cache of sample block contents, in megabytes
+extern AUDACITY_DLL_API IntSetting SampleBlockCacheSize;
+
+//! Least-recently-used cache of the contents of sample blocks, in their
+//! stored sample formats, shared by all the blocks of one project
+/*!
+ The total size of cached contents is kept within a budget; a budget of zero
+ disables the cache.  All member functions may be called concurrently, as
+ from the audio thread and the main thread.
+
+ Blocks enter the cache when prefetched and when read whole, as playback and
+ export do; smaller reads of blocks not cached don't fill it, nor do writes,
+ as by import or recording, which may be much larger than the budget.
+ */
+class AUDACITY_DLL_API SampleBlockCache final
+   : public ClientData::Base
+   , public std::enable_shared_from_this< SampleBlockCache >
+{
+public:
+   using Data = std::shared_ptr< const ArrayOf<char> >;
+
+   struct Statistics
+   {
+      unsigned long long hits = 0;
+      unsigned long long misses = 0;
+      unsigned long long evictions = 0;
+      size_t bytes = 0;
+      size_t entries = 0;
+      size_t budget = 0;
+   };
+
+   static SampleBlockCache &Get( AudacityProject &project );
+   static const SampleBlockCache &Get( const AudacityProject &project );
+
+   explicit SampleBlockCache( size_t budget = 0 );
+   ~SampleBlockCache() override;
+
+   //! Change the budget in bytes, evicting as needed
+   void SetBudget( size_t budget );
+   size_t GetBudget() const;
+   bool IsEnabled() const;
+
+   //! @return contents of the block, or null; counts a hit or a miss
+   Data Find( SampleBlockID id );
+
+   //! Like Find, but does not count, nor change the order of use
+   bool Contains( SampleBlockID id ) const;
+
+   //! Remember contents of the block, which become most recently used
+   void Insert( SampleBlockID id, Data data, size_t bytes );
+
+   //! Forget one block, as when it is deleted
+   void Erase( SampleBlockID id );
+
+   Statistics GetStatistics() const;
+   void ResetStatistics();
+
+private:
+   void Evict( size_t budget );
+
+   struct Entry {
+      SampleBlockID id;
+      Data data;
+      size_t bytes;
+   };
+   using List = std::list< Entry >;
+
+   mutable std::mutex mMutex;
+   //! Most recently used entries at the front
+   List mList;
+   std::unordered_map< SampleBlockID, List::iterator > mIndex;
+   size_t mBudget;
+   Statistics mStats;
+};
+
+#endif
@@ -0,0 +1,549 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SampleBlockCodec.cpp
+@brief Implements SampleBlockCodec
+
+**********************************************************************/
+
+#include "SampleBlockCodec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace SampleBlockCodec {
+
+namespace {
+
+// Layout of an encoded blob, all integers little endian:
+//
+//    uint32   count of samples
+//    uint8    log2 of samples per partition
+//    uint8    bytes per sample, as in memory
+//    uint16   reserved, zero
+//    uint32   offset of each partition, relative to the end of this table
+//    ...      partitions, each starting on a byte boundary
+//
+// Each partition begins with two bytes:  the predictor order in the low
+// nibble and the residual coding mode in the high nibble; then the Rice
+// parameter or the raw bit width.  The coded residuals follow, most
+// significant bit first.
+
+constexpr size_t headerBytes = 8;
+constexpr unsigned partitionShift = 12;
+constexpr size_t maxOrder = 3;
+
+enum Mode : unsigned char {
+   modeRice = 0,
+   modeRaw = 1,
+};
+
+inline void PutLE32(unsigned char *p, uint32_t value)
+{
+   p[0] = value & 0xff;
+   p[1] = (value >> 8) & 0xff;
+   p[2] = (value >> 16) & 0xff;
+   p[3] = (value >> 24) & 0xff;
+}
+
+inline uint32_t GetLE32(const unsigned char *p)
+{
+   return uint32_t(p[0])
+      | (uint32_t(p[1]) << 8)
+      | (uint32_t(p[2]) << 16)
+      | (uint32_t(p[3]) << 24);
+}
+
+// Map samples to integers so that nearby values have nearby codes.
+// Float bit patterns are mapped from sign-magnitude to two's complement,
+// keeping negative zero distinct from positive zero.
+inline int64_t FromNative(constSamplePtr src, sampleFormat format)
+{
+   switch (format) {
+   case int16Sample: {
+      int16_t value;
+      memcpy(&value, src, sizeof(value));
+      return value;
+   }
+   case int24Sample: {
+      int32_t value;
+      memcpy(&value, src, sizeof(value));
+      return value;
+   }
+   default: {
+      uint32_t bits;
+      memcpy(&bits, src, sizeof(bits));
+      const int64_t magnitude = bits & 0x7fffffffu;
+      return (bits & 0x80000000u) ? -magnitude - 1 : magnitude;
+   }
+   }
+}
+
+inline void ToNative(int64_t value, samplePtr dest, sampleFormat format)
+{
+   switch (format) {
+   case int16Sample: {
+      const auto sample = static_cast<int16_t>(value);
+      memcpy(dest, &sample, sizeof(sample));
+      break;
+   }
+   case int24Sample: {
+      const auto sample = static_cast<int32_t>(value);
+      memcpy(dest, &sample, sizeof(sample));
+      break;
+   }
+   default: {
+      const uint32_t bits = value < 0
+         ? 0x80000000u | static_cast<uint32_t>(-(value + 1))
+         : static_cast<uint32_t>(value);
+      memcpy(dest, &bits, sizeof(bits));
+      break;
+   }
+   }
+}
+
+// Fixed polynomial predictors, as in FLAC
+inline int64_t Predict(const int64_t *x, size_t j, unsigned order)
+{
+   switch (std::min<size_t>(order, j)) {
+   case 0:
+      return 0;
+   case 1:
+      return x[j - 1];
+   case 2:
+      return 2 * x[j - 1] - x[j - 2];
+   default:
+      return 3 * x[j - 1] - 3 * x[j - 2] + x[j - 3];
+   }
+}
+
+inline uint64_t ZigZag(int64_t value)
+{
+   return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value)
+{
+   return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline unsigned BitWidth(uint64_t value)
+{
+   unsigned width = 0;
+   while (value) {
+      ++width;
+      value >>= 1;
+   }
+   return width;
+}
+
+class BitWriter
+{
+public:
+   explicit BitWriter(std::vector<unsigned char> &out) : mOut{ out } {}
+
+   //! Write the low nBits of value, most significant first
+   void Put(uint64_t value, unsigned nBits)
+   {
+      while (nBits > 32) {
+         nBits -= 32;
+         PutSmall((value >> nBits) & 0xffffffffu, 32);
+      }
+      PutSmall(value & ((uint64_t{ 1 } << nBits) - 1), nBits);
+   }
+
+   //! Write q zero bits followed by a one bit
+   void PutUnary(uint64_t q)
+   {
+      for (; q >= 32; q -= 32)
+         PutSmall(0, 32);
+      PutSmall(1, q + 1);
+   }
+
+   //! Pad to a byte boundary
+   void Flush()
+   {
+      if (mCount > 0)
+         mOut.push_back(static_cast<unsigned char>(mAcc << (8 - mCount)));
+      mAcc = 0;
+      mCount = 0;
+   }
+
+private:
+   void PutSmall(uint64_t value, unsigned nBits)
+   {
+      mAcc = (mAcc << nBits) | value;
+      mCount += nBits;
+      while (mCount >= 8) {
+         mCount -= 8;
+         mOut.push_back(static_cast<unsigned char>(mAcc >> mCount));
+      }
+      mAcc &= (uint64_t{ 1 } << mCount) - 1;
+   }
+
+   std::vector<unsigned char> &mOut;
+   uint64_t mAcc{ 0 };
+   unsigned mCount{ 0 };
+};
+
+class BitReader
+{
+public:
+   BitReader(const unsigned char *begin, const unsigned char *end)
+      : mPtr{ begin }, mEnd{ end }
+   {}
+
+   uint64_t Get(unsigned nBits)
+   {
+      uint64_t result = 0;
+      while (nBits > 0) {
+         if (mCount == 0 && !Refill())
+            return 0;
+         const auto take = std::min(nBits, mCount);
+         mCount -= take;
+         nBits -= take;
+         result = (result << take) |
+            ((mByte >> mCount) & ((1u << take) - 1));
+      }
+      return result;
+   }
+
+   uint64_t GetUnary()
+   {
+      uint64_t q = 0;
+      while (true) {
+         if (mCount == 0 && !Refill())
+            return 0;
+         // Skip whole zero bytes quickly
+         if ((mByte & ((1u << mCount) - 1)) == 0) {
+            q += mCount;
+            mCount = 0;
+            continue;
+         }
+         --mCount;
+         if ((mByte >> mCount) & 1)
+            return q;
+         ++q;
+      }
+   }
+
+   bool Failed() const { return mFailed; }
+
+private:
+   bool Refill()
+   {
+      if (mPtr == mEnd) {
+         mFailed = true;
+         return false;
+      }
+      mByte = *mPtr++;
+      mCount = 8;
+      return true;
+   }
+
+   const unsigned char *mPtr;
+   const unsigned char *const mEnd;
+   unsigned mByte{ 0 };
+   unsigned mCount{ 0 };
+   bool mFailed{ false };
+};
+
+void EncodePartition(const int64_t *x, size_t count,
+   std::vector<uint64_t> &residuals, std::vector<unsigned char> &out)
+{
+   // Choose the predictor order minimizing the sum of absolute residuals
+   uint64_t sums[maxOrder + 1]{};
+   for (size_t j = 0; j < count; ++j)
+      for (unsigned order = 0; order <= maxOrder; ++order) {
+         const auto e = x[j] - Predict(x, j, order);
+         sums[order] += ZigZag(e) >> 1;
+      }
+   const unsigned order = static_cast<unsigned>(
+      std::min_element(sums, sums + maxOrder + 1) - sums);
+
+   residuals.resize(count);
+   uint64_t total = 0, largest = 0;
+   for (size_t j = 0; j < count; ++j) {
+      const auto u = ZigZag(x[j] - Predict(x, j, order));
+      residuals[j] = u;
+      total += u;
+      largest = std::max(largest, u);
+   }
+
+   // Compare exact costs of Rice parameters near the estimate, and of
+   // raw bits
+   const unsigned width = BitWidth(largest);
+   uint64_t bestCost = uint64_t(width) * count;
+   unsigned mode = modeRaw, param = width;
+   const unsigned estimate = BitWidth(total / std::max<size_t>(count, 1));
+   for (unsigned k = estimate > 0 ? estimate - 1 : 0;
+        k <= std::min(estimate + 1, 62u); ++k) {
+      uint64_t cost = uint64_t(k + 1) * count;
+      for (size_t j = 0; j < count && cost < bestCost; ++j)
+         cost += residuals[j] >> k;
+      if (cost < bestCost)
+         bestCost = cost, mode = modeRice, param = k;
+   }
+
+   out.push_back(static_cast<unsigned char>(order | (mode << 4)));
+   out.push_back(static_cast<unsigned char>(param));
+   BitWriter writer{ out };
+   if (mode == modeRice)
+      for (size_t j = 0; j < count; ++j) {
+         writer.PutUnary(residuals[j] >> param);
+         writer.Put(residuals[j], param);
+      }
+   else
+      for (size_t j = 0; j < count; ++j)
+         writer.Put(residuals[j], param);
+   writer.Flush();
+}
+
+//! Decode samples of one partition, passing those with indices in
+//! [first, last) to sink
+template<typename Sink>
+bool DecodePartition(const unsigned char *begin, const unsigned char *end,
+   size_t first, size_t last, int64_t *history, Sink &&sink)
+{
+   if (end - begin < 2)
+      return false;
+   const unsigned order = begin[0] & 0x0f;
+   const unsigned mode = begin[0] >> 4;
+   const unsigned param = begin[1];
+   if (order > maxOrder || mode > modeRaw ||
+       param > (mode == modeRice ? 62u : 64u))
+      return false;
+
+   BitReader reader{ begin + 2, end };
+   for (size_t j = 0; j < last; ++j) {
+      uint64_t u;
+      if (mode == modeRice) {
+         const auto q = reader.GetUnary();
+         u = (q << param) | reader.Get(param);
+      }
+      else
+         u = reader.Get(param);
+      if (reader.Failed())
+         return false;
+
+      // Keep only as much history as the predictor needs
+      const auto slot = std::min<size_t>(j, maxOrder);
+      if (j > maxOrder)
+         std::copy(history + 1, history + maxOrder + 1, history);
+      history[slot] = Predict(history, slot, order) + UnZigZag(u);
+      if (j >= first)
+         sink(j, history[slot]);
+   }
+   return true;
+}
+
+}
+
+bool Encode(constSamplePtr src, sampleFormat format, size_t numsamples,
+   std::vector<unsigned char> &encoded)
+{
+   const size_t sampleSize = SAMPLE_SIZE(format);
+   const size_t rawBytes = numsamples * sampleSize;
+   const size_t partitionSize = size_t{ 1 } << partitionShift;
+   const size_t nPartitions =
+      (numsamples + partitionSize - 1) >> partitionShift;
+   if (numsamples == 0 || numsamples > UINT32_MAX)
+      return false;
+
+   encoded.clear();
+   encoded.resize(headerBytes + 4 * nPartitions);
+   PutLE32(encoded.data(), static_cast<uint32_t>(numsamples));
+   encoded[4] = partitionShift;
+   encoded[5] = static_cast<unsigned char>(sampleSize);
+
+   std::vector<int64_t> x(partitionSize);
+   std::vector<uint64_t> residuals;
+   const size_t dataStart = encoded.size();
+   for (size_t p = 0; p < nPartitions; ++p) {
+      const auto start = p << partitionShift;
+      const auto count = std::min(partitionSize, numsamples - start);
+      for (size_t j = 0; j < count; ++j)
+         x[j] = FromNative(src + (start + j) * sampleSize, format);
+
+      PutLE32(encoded.data() + headerBytes + 4 * p,
+         static_cast<uint32_t>(encoded.size() - dataStart));
+      EncodePartition(x.data(), count, residuals, encoded);
+
+      // Give up early when there is no gain
+      if (encoded.size() >= rawBytes)
+         return false;
+   }
+   return true;
+}
+
+size_t HeaderBytes()
+{
+   return headerBytes;
+}
+
+size_t DecodedSampleCount(const void *blob, size_t blobbytes)
+{
+   if (!blob || blobbytes < headerBytes)
+      return 0;
+   auto p = static_cast<const unsigned char*>(blob);
+   if (p[4] != partitionShift)
+      return 0;
+   return GetLE32(p);
+}
+
+size_t Decode(const void *blob, size_t blobbytes, sampleFormat format,
+   samplePtr dest, sampleFormat destformat,
+   size_t sampleoffset, size_t numsamples)
+{
+   const size_t total = DecodedSampleCount(blob, blobbytes);
+   if (sampleoffset >= total)
+      return 0;
+   numsamples = std::min(numsamples, total - sampleoffset);
+
+   const auto bytes = static_cast<const unsigned char*>(blob);
+   const size_t partitionSize = size_t{ 1 } << partitionShift;
+   const size_t nPartitions = (total + partitionSize - 1) >> partitionShift;
+   const size_t dataStart = headerBytes + 4 * nPartitions;
+   if (blobbytes < dataStart || bytes[5] != SAMPLE_SIZE(format))
+      return 0;
+   const auto data = bytes + dataStart;
+   const auto end = bytes + blobbytes;
+
+   const auto srcSize = SAMPLE_SIZE(format);
+   const auto destSize = SAMPLE_SIZE(destformat);
+   const bool direct = (destformat == format);
+   // Staging area for one partition, only when converting format
+   char chunk[partitionSize * sizeof(float)];
+   int64_t history[maxOrder + 1];
+
+   const size_t stop = sampleoffset + numsamples;
+   size_t written = 0;
+   for (size_t p = sampleoffset >> partitionShift;
+        p < nPartitions && written < numsamples; ++p) {
+      const size_t start = p << partitionShift;
+      const size_t first = std::max(start, sampleoffset) - start;
+      const size_t last = std::min(start + partitionSize, stop) - start;
+      const size_t offset = GetLE32(bytes + headerBytes + 4 * p);
+      const size_t next = (p + 1 < nPartitions)
+         ? GetLE32(bytes + headerBytes + 4 * (p + 1))
+         : end - data;
+      if (offset > next || next > size_t(end - data))
+         break;
+
+      const auto out = dest + written * destSize;
+      bool ok;
+      if (direct)
+         ok = DecodePartition(data + offset, data + next, first, last, history,
+            [&](size_t j, int64_t value){
+               ToNative(value, out + (j - first) * destSize, format); });
+      else
+         ok = DecodePartition(data + offset, data + next, first, last, history,
+            [&](size_t j, int64_t value){
+               ToNative(value, chunk + (j - first) * srcSize, format); });
+      if (!ok)
+         break;
+      if (!direct)
+         CopySamples(chunk, format, out, destformat, last - first);
+      written += last - first;
+   }
+   return written;
+}
+
+namespace {
+
+// Constants and steps of XXH64
+constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t Prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t RotateLeft(uint64_t value, unsigned bits)
+{
+   return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t Read64(const unsigned char *p)
+{
+   uint64_t value;
+   memcpy(&value, p, sizeof(value));
+   return value;
+}
+
+inline uint32_t Read32(const unsigned char *p)
+{
+   uint32_t value;
+   memcpy(&value, p, sizeof(value));
+   return value;
+}
+
+inline uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+   return RotateLeft(accumulator + input * Prime2, 31) * Prime1;
+}
+
+inline uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+{
+   return (accumulator ^ Round(0, value)) * Prime1 + Prime4;
+}
+
+}
+
+uint64_t Checksum(const void *data, size_t bytes)
+{
+   // All sample data is little endian, as are the loads here
+   auto p = static_cast<const unsigned char *>(data);
+   const auto end = p + bytes;
+   uint64_t hash;
+
+   if (bytes >= 32)
+   {
+      // Four independent lanes keep the multipliers busy
+      uint64_t v1 = Prime1 + Prime2;
+      uint64_t v2 = Prime2;
+      uint64_t v3 = 0;
+      uint64_t v4 = 0 - Prime1;
+      const auto limit = end - 32;
+      do
+      {
+         v1 = Round(v1, Read64(p));
+         v2 = Round(v2, Read64(p + 8));
+         v3 = Round(v3, Read64(p + 16));
+         v4 = Round(v4, Read64(p + 24));
+         p += 32;
+      } while (p <= limit);
+
+      hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) +
+         RotateLeft(v3, 12) + RotateLeft(v4, 18);
+      hash = MergeRound(hash, v1);
+      hash = MergeRound(hash, v2);
+      hash = MergeRound(hash, v3);
+      hash = MergeRound(hash, v4);
+   }
+   else
+      hash = Prime5;
+
+   hash += bytes;
+
+   for (; p + 8 <= end; p += 8)
+      hash = RotateLeft(hash ^ Round(0, Read64(p)), 27) * Prime1 + Prime4;
+   if (p + 4 <= end)
+   {
+      hash = RotateLeft(hash ^ (Read32(p) * Prime1), 23) * Prime2 + Prime3;
+      p += 4;
+   }
+   for (; p < end; ++p)
+      hash = RotateLeft(hash ^ (*p * Prime5), 11) * Prime1;
+
+   hash ^= hash >> 33;
+   hash *= Prime2;
+   hash ^= hash >> 29;
+   hash *= Prime3;
+   hash ^= hash >> 32;
+   return hash;
+}
+
+}
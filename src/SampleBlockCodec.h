@@ -0,0 +1,79 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file SampleBlockCodec.h
+@brief Lossless encoding of the samples of a block for storage in the project file
+
+**********************************************************************/
+
+#ifndef __AUDACITY_SAMPLE_BLOCK_CODEC__
+#define __AUDACITY_SAMPLE_BLOCK_CODEC__
+
+#include "SampleFormat.h"
+
+#include <cstdint>
+#include <vector>
+
+//! Lossless compression of sample block contents
+/*!
+ The encoding is in the style of FLAC:  samples are split into fixed size
+ partitions, each independently predicted with a fixed polynomial of order
+ 0 to 3, and the residuals are Rice coded (or stored as raw bits, when that is
+ smaller).  Float samples are coded through their bit patterns, so the
+ reconstruction is exact for all values, including NaNs and signed zeroes.
+
+ Partitions are indexed so that any sub-range of the block can be decoded
+ without decoding the whole block.
+ */
+namespace SampleBlockCodec {
+
+//! Identifies the encoding of the samples column of a row in sampleblocks
+/*! These values persist in saved project files, so must not be changed in
+    later program versions */
+enum ID : int {
+   Raw = 0, //!< Little endian samples, as in projects before codecs existed
+   FixedPredictorRice = 1,
+};
+
+//! Try to encode samples
+/*!
+ @return true, and fills encoded, only if the result is smaller than the raw
+ samples; else the block should be stored as Raw
+ */
+AUDACITY_DLL_API
+bool Encode(constSamplePtr src, sampleFormat format, size_t numsamples,
+   std::vector<unsigned char> &encoded);
+
+//! @return the count of samples encoded in a blob, or 0 if it is malformed
+AUDACITY_DLL_API
+size_t DecodedSampleCount(const void *blob, size_t blobbytes);
+
+//! Number of leading bytes of a blob that DecodedSampleCount needs
+AUDACITY_DLL_API
+size_t HeaderBytes();
+
+//! Decode a range of samples, converting directly into the destination
+/*!
+ Samples are written straight into dest when destformat equals format;
+ otherwise they are converted in short runs with CopySamples, without
+ materializing the whole block.
+
+ @pre destformat == format || destformat == floatSample
+ @return the number of samples written; the caller should clear the
+ remainder of the requested range
+ */
+AUDACITY_DLL_API
+size_t Decode(const void *blob, size_t blobbytes, sampleFormat format,
+   samplePtr dest, sampleFormat destformat,
+   size_t sampleoffset, size_t numsamples);
+
+//! Checksum of the stored bytes of a block, for detecting corruption
+/*! This is XXH64 with seed 0.  The value persists in saved project files,
+    so the algorithm must not be changed in later program versions */
+AUDACITY_DLL_API
+uint64_t Checksum(const void *data, size_t bytes);
+
+}
+
+#endif
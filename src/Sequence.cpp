@@ -40,11 +40,24 @@
 #include <wx/ffile.h>
 #include <wx/log.h>
 
+#include "Dither.h"
 #include "SampleBlock.h"
 #include "InconsistencyException.h"
+#include "WorkerPool.h"
 #include "widgets/AudacityMessageBox.h"
 
 size_t Sequence::sMaxDiskBlockSize = 1048576;
+bool Sequence::sAdaptiveBlockSize = true;
+size_t Sequence::sConversionThreads = 0;
+
+namespace {
+// Edited sequences aim for new blocks of this many seconds, divided by the
+// edits per minute of audio, but not fewer than the minimum
+constexpr double EditedBlockSeconds = 10.0;
+constexpr double MinEditedBlockSeconds = 1.0;
+// Nor less than this fraction of the maximum block size
+constexpr size_t MinBlockFraction = 16;
+}
 
 // Sequence methods
 Sequence::Sequence(
@@ -64,9 +77,20 @@ Sequence::Sequence(
 :  mpFactory(pFactory),
    mSampleFormat(orig.mSampleFormat),
    mMinSamples(orig.mMinSamples),
-   mMaxSamples(orig.mMaxSamples)
+   mMaxSamples(orig.mMaxSamples),
+   mRateHint(orig.mRateHint)
 {
-   Paste(0, &orig);
+   if (pFactory == orig.mpFactory) {
+      // Share the array, as for a snapshot for undo, in constant time
+      mBlock = orig.mBlock;
+      mNumSamples = orig.mNumSamples;
+   }
+   else
+      Paste(0, &orig);
+
+   // The copy continues the history of use of the original
+   mEditCount = orig.mEditCount;
+   mSamplesRead = orig.mSamplesRead.load(std::memory_order_relaxed);
 }
 
 Sequence::~Sequence()
@@ -80,7 +104,28 @@ size_t Sequence::GetMaxBlockSize() const
 
 size_t Sequence::GetIdealBlockSize() const
 {
-   return mMaxSamples;
+   if (!sAdaptiveBlockSize || mRateHint <= 0 || mEditCount == 0)
+      return mMaxSamples;
+
+   // Edits per minute of audio, discounted by the number of times the whole
+   // sequence was read, as in playback.  Each edit rewrites whole blocks
+   // near the edit point, so frequent edits favor small blocks, while
+   // reading favors few large ones.
+   const auto length = std::max(mNumSamples.as_double(), 1.0);
+   const auto minutes = length / mRateHint / 60.0;
+   const auto passes =
+      mSamplesRead.load(std::memory_order_relaxed) / length;
+   const auto editRate = mEditCount / minutes / (1.0 + passes);
+   if (editRate <= 1.0)
+      return mMaxSamples;
+
+   const auto seconds =
+      std::max(MinEditedBlockSeconds, EditedBlockSeconds / editRate);
+   const auto ideal = seconds * mRateHint;
+   const auto minSamples = std::max<size_t>(1, mMaxSamples / MinBlockFraction);
+   if (ideal >= mMaxSamples)
+      return mMaxSamples;
+   return std::max(minSamples, size_t(ideal));
 }
 
 bool Sequence::CloseLock()
@@ -171,38 +216,63 @@ bool Sequence::ConvertToSampleFormat(sampleFormat format,
       (1 + mBlock.size() * ((float)oldMaxSamples / (float)mMaxSamples));
 
    {
-      size_t oldSize = oldMaxSamples;
-      SampleBuffer bufferOld(oldSize, oldFormat);
-      size_t newSize = oldMaxSamples;
-      SampleBuffer bufferNew(newSize, format);
+      // Read and convert several blocks at once on worker threads, then
+      // store them and report progress in order on this thread, so that
+      // cancellation from the progress report leaves nothing half done
+      auto &pool = WorkerPool::Get();
+      const auto nSlots = sConversionThreads > 0
+         ? std::min(sConversionThreads, pool.GetConcurrency())
+         : pool.GetConcurrency();
+      ArrayOf<SampleBuffer> buffersOld{ nSlots }, buffersNew{ nSlots };
+      std::vector<size_t> sizesOld(nSlots, oldMaxSamples),
+         sizesNew(nSlots, oldMaxSamples);
+      for (size_t jj = 0; jj < nSlots; ++jj) {
+         buffersOld[jj].Allocate(oldMaxSamples, oldFormat);
+         buffersNew[jj].Allocate(oldMaxSamples, format);
+      }
+
+      // Narrowing conversions dither, so each slot has a ditherer of its own
+      std::vector<Dither> ditherers(nSlots);
 
-      for (size_t i = 0, nn = mBlock.size(); i < nn; i++)
+      SampleBlockBatch batch{ *mpFactory };
+      for (size_t i = 0, nn = mBlock.size(); i < nn; i += nSlots)
       {
-         SeqBlock &oldSeqBlock = mBlock[i];
-         const auto &oldBlockFile = oldSeqBlock.sb;
-         const auto len = oldBlockFile->GetSampleCount();
-         ensureSampleBufferSize(bufferOld, oldFormat, oldSize, len);
-         Read(bufferOld.ptr(), oldFormat, oldSeqBlock, 0, len, true);
-
-         ensureSampleBufferSize(bufferNew, format, newSize, len);
-         CopySamples(bufferOld.ptr(), oldFormat, bufferNew.ptr(), format, len);
-
-         // Note this fix for http://bugzilla.audacityteam.org/show_bug.cgi?id=451,
-         // using Blockify, allows (len < mMinSamples).
-         // This will happen consistently when going from more bytes per sample to fewer...
-         // This will create a block that's smaller than mMinSamples, which
-         // shouldn't be allowed, but we agreed it's okay for now.
-         //vvv ANSWER-ME: Does this cause any bugs, or failures on write, elsewhere?
-         //    If so, need to special-case (len < mMinSamples) and start combining data
-         //    from the old blocks... Oh no!
-
-         // Using Blockify will handle the cases where len > the NEW mMaxSamples. Previous code did not.
-         const auto blockstart = oldSeqBlock.start;
-         Blockify(*mpFactory, mMaxSamples, mSampleFormat,
-                  newBlockArray, blockstart, bufferNew.ptr(), len);
-
-         if (progressReport)
-            progressReport(len);
+         const auto count = std::min(nSlots, nn - i);
+         pool.Run(count, [&](size_t jj){
+            const SeqBlock &oldSeqBlock = mBlock[i + jj];
+            const auto len = oldSeqBlock.sb->GetSampleCount();
+            ensureSampleBufferSize(
+               buffersOld[jj], oldFormat, sizesOld[jj], len);
+            Read(buffersOld[jj].ptr(), oldFormat, oldSeqBlock, 0, len, true);
+
+            ensureSampleBufferSize(buffersNew[jj], format, sizesNew[jj], len);
+            ditherers[jj].Apply(gHighQualityDither,
+               buffersOld[jj].ptr(), oldFormat,
+               buffersNew[jj].ptr(), format, len);
+         });
+
+         for (size_t jj = 0; jj < count; ++jj)
+         {
+            const SeqBlock &oldSeqBlock = mBlock[i + jj];
+            const auto len = oldSeqBlock.sb->GetSampleCount();
+
+            // Note this fix for http://bugzilla.audacityteam.org/show_bug.cgi?id=451,
+            // using Blockify, allows (len < mMinSamples).
+            // This will happen consistently when going from more bytes per sample to fewer...
+            // This will create a block that's smaller than mMinSamples, which
+            // shouldn't be allowed, but we agreed it's okay for now.
+            //vvv ANSWER-ME: Does this cause any bugs, or failures on write, elsewhere?
+            //    If so, need to special-case (len < mMinSamples) and start combining data
+            //    from the old blocks... Oh no!
+
+            // Using Blockify will handle the cases where len > the NEW mMaxSamples. Previous code did not.
+            const auto blockstart = oldSeqBlock.start;
+            Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+                     newBlockArray, blockstart, buffersNew[jj].ptr(), len);
+
+            if (progressReport)
+               progressReport(len);
+         }
       }
    }
 
@@ -375,6 +445,7 @@ std::unique_ptr<Sequence> Sequence::Copy( const SampleBlockFactoryPtr &pFactory,
 {
    // Make a new Sequence object for the specified factory:
    auto dest = std::make_unique<Sequence>(pFactory, mSampleFormat);
+   dest->mRateHint = mRateHint;
    if (s0 >= s1 || s0 >= mNumSamples || s1 < 0) {
       return dest;
    }
@@ -393,7 +464,16 @@ std::unique_ptr<Sequence> Sequence::Copy( const SampleBlockFactoryPtr &pFactory,
    wxUnusedVar(numBlocks);
    wxASSERT(b0 <= b1);
 
-   dest->mBlock.reserve(b1 - b0 + 1);
+   if (pUseFactory == nullptr && dest->mMaxSamples == mMaxSamples &&
+       s0 <= 0 && s1 >= mNumSamples) {
+      // Copy of all, sharing the array
+      dest->mBlock = mBlock;
+      dest->mNumSamples = mNumSamples;
+      return dest;
+   }
+
+   auto &destBlock = dest->mBlock.Mutable();
+   destBlock.reserve(b1 - b0 + 1);
 
    auto bufferSize = mMaxSamples;
    SampleBuffer buffer(bufferSize, mSampleFormat);
@@ -420,7 +500,7 @@ std::unique_ptr<Sequence> Sequence::Copy( const SampleBlockFactoryPtr &pFactory,
    // If there are blocks in the middle, use the blocks whole
    for (int bb = b0 + 1; bb < b1; ++bb)
       AppendBlock(pUseFactory, mSampleFormat,
-         dest->mBlock, dest->mNumSamples, mBlock[bb]);
+         destBlock, dest->mNumSamples, mBlock[bb]);
       // Increase ref count or duplicate file
 
    // Do the last block
@@ -439,7 +519,7 @@ std::unique_ptr<Sequence> Sequence::Copy( const SampleBlockFactoryPtr &pFactory,
       else
          // Special case of a whole block
          AppendBlock(pUseFactory, mSampleFormat,
-            dest->mBlock, dest->mNumSamples, block);
+            destBlock, dest->mNumSamples, block);
          // Increase ref count or duplicate file
    }
 
@@ -504,7 +584,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
       THROW_INCONSISTENCY_EXCEPTION;
    }
 
-   const BlockArray &srcBlock = src->mBlock;
+   const BlockArray &srcBlock = src->mBlock.Get();
    auto addedLen = src->mNumSamples;
    const unsigned int srcNumBlocks = srcBlock.size();
    auto sampleSize = SAMPLE_SIZE(mSampleFormat);
@@ -512,6 +592,9 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
    if (addedLen == 0 || srcNumBlocks == 0)
       return;
 
+   ++mEditCount;
+   const auto idealSamples = GetIdealBlockSize();
+
    const size_t numBlocks = mBlock.size();
 
    // Decide whether to share sample blocks or make new copies, when whole block
@@ -526,7 +609,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
       // minimum size
 
       // Build and swap a copy so there is a strong exception safety guarantee
-      BlockArray newBlock{ mBlock };
+      BlockArray newBlock{ mBlock.Get() };
       sampleCount samples = mNumSamples;
       for (unsigned int i = 0; i < srcNumBlocks; i++)
          // AppendBlock may throw for limited disk space, if pasting from
@@ -541,17 +624,19 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
    const int b = (s == mNumSamples) ? mBlock.size() - 1 : FindBlock(s);
    wxASSERT((b >= 0) && (b < (int)numBlocks));
-   SeqBlock *const pBlock = &mBlock[b];
+   const SeqBlock *const pBlock = &mBlock[b];
    const auto length = pBlock->sb->GetSampleCount();
    const auto largerBlockLen = addedLen + length;
    // PRL: when insertion point is the first sample of a block,
    // and the following test fails, perhaps we could test
    // whether coalescence with the previous block is possible.
-   if (largerBlockLen <= mMaxSamples) {
+   if (largerBlockLen <= idealSamples) {
       // Special case: we can fit all of the NEW samples inside of
       // one block!
 
-      SeqBlock &block = *pBlock;
+      // Stop sharing the array before changing it in place
+      auto &blocks = mBlock.Mutable();
+      SeqBlock &block = blocks[b];
       // largerBlockLen is not more than mMaxSamples...
       SampleBuffer buffer(largerBlockLen.as_size_t(), mSampleFormat);
 
@@ -577,7 +662,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
       // use No-fail-guarantee in remaining steps
       for (unsigned int i = b + 1; i < numBlocks; i++)
-         mBlock[i].start += addedLen;
+         blocks[i].start += addedLen;
 
       mNumSamples += addedLen;
 
@@ -595,7 +680,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
    newBlock.reserve(numBlocks + srcNumBlocks + 2);
    newBlock.insert(newBlock.end(), mBlock.begin(), mBlock.begin() + b);
 
-   SeqBlock &splitBlock = mBlock[b];
+   const SeqBlock &splitBlock = mBlock[b];
    auto splitLen = splitBlock.sb->GetSampleCount();
    // s lies within splitBlock
    auto splitPoint = ( s - splitBlock.start ).as_size_t();
@@ -616,7 +701,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
            splitBlock, splitPoint,
            splitLen - splitPoint, true);
 
-      Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+      Blockify(*mpFactory, idealSamples, mSampleFormat,
                newBlock, splitBlock.start, sumBuffer.ptr(), sum);
    } else {
 
@@ -643,7 +728,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
       src->Get(0, sampleBuffer.ptr() + splitPoint*sampleSize,
          mSampleFormat, 0, srcFirstTwoLen, true);
 
-      Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+      Blockify(*mpFactory, idealSamples, mSampleFormat,
                newBlock, splitBlock.start, sampleBuffer.ptr(), leftLen);
 
       for (i = 2; i < srcNumBlocks - 2; i++) {
@@ -659,7 +744,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
       Read(sampleBuffer.ptr() + srcLastTwoLen * sampleSize, mSampleFormat,
            splitBlock, splitPoint, rightSplit, true);
 
-      Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+      Blockify(*mpFactory, idealSamples, mSampleFormat,
                newBlock, s + lastStart, sampleBuffer.ptr(), rightLen);
    }
 
@@ -702,14 +787,15 @@ void Sequence::InsertSilence(sampleCount s0, sampleCount len)
    // Could nBlocks overflow a size_t?  Not very likely.  You need perhaps
    // 2 ^ 52 samples which is over 3000 years at 44.1 kHz.
    auto nBlocks = (len + idealSamples - 1) / idealSamples;
-   sTrack.mBlock.reserve(nBlocks.as_size_t());
+   auto &blocks = sTrack.mBlock.Mutable();
+   blocks.reserve(nBlocks.as_size_t());
 
    if (len >= idealSamples) {
       auto silentFile = factory.CreateSilent(
          idealSamples,
          mSampleFormat);
       while (len >= idealSamples) {
-         sTrack.mBlock.push_back(SeqBlock(silentFile, pos));
+         blocks.push_back(SeqBlock(silentFile, pos));
 
          pos += idealSamples;
          len -= idealSamples;
@@ -717,7 +803,7 @@ void Sequence::InsertSilence(sampleCount s0, sampleCount len)
    }
    if (len != 0) {
       // len is not more than idealSamples:
-      sTrack.mBlock.push_back(SeqBlock(
+      blocks.push_back(SeqBlock(
          factory.CreateSilent(len.as_size_t(), mSampleFormat), pos));
       pos += len;
    }
@@ -747,13 +833,15 @@ void Sequence::AppendBlock( SampleBlockFactory *pFactory, sampleFormat format,
    // function gets called in an inner loop.
 }
 
-sampleCount Sequence::GetBlockStart(sampleCount position) const
+sampleCount Sequence::GetBlockStart(sampleCount position,
+   BlockCursor *pCursor) const
 {
-   int b = FindBlock(position);
+   int b = FindBlock(position, pCursor);
    return mBlock[b].start;
 }
 
-size_t Sequence::GetBestBlockSize(sampleCount start) const
+size_t Sequence::GetBestBlockSize(sampleCount start,
+   BlockCursor *pCursor) const
 {
    // This method returns a nice number of samples you should try to grab in
    // one big chunk in order to land on a block boundary, based on the starting
@@ -763,7 +851,7 @@ size_t Sequence::GetBestBlockSize(sampleCount start) const
    if (start < 0 || start >= mNumSamples)
       return mMaxSamples;
 
-   int b = FindBlock(start);
+   int b = FindBlock(start, pCursor);
    int numBlocks = mBlock.size();
 
    const SeqBlock &block = mBlock[b];
@@ -827,7 +915,7 @@ bool Sequence::HandleXMLTag(const wxChar *tag, const wxChar **attrs)
          }
       }
 
-      mBlock.push_back(wb);
+      mBlock.Mutable().push_back(wb);
 
       return true;
    }
@@ -912,7 +1000,7 @@ void Sequence::HandleXMLEndTag(const wxChar *tag)
    sampleCount numSamples = 0;
    for (unsigned b = 0, nn = mBlock.size(); b < nn;  b++)
    {
-      SeqBlock &block = mBlock[b];
+      SeqBlock &block = mBlock.Mutable()[b];
       if (block.start != numSamples)
       {
          wxLogWarning(
@@ -1045,6 +1133,32 @@ int Sequence::FindBlock(sampleCount pos) const
    return rval;
 }
 
+int Sequence::FindBlock(sampleCount pos, BlockCursor *pCursor) const
+{
+   if (!pCursor)
+      return FindBlock(pos);
+
+   int result = -1;
+   if (pCursor->mpSequence == this) {
+      const auto numBlocks = mBlock.size();
+      for (auto b = pCursor->mBlock;
+           b < numBlocks && b <= pCursor->mBlock + 1; ++b) {
+         const auto &block = mBlock[b];
+         if (pos < block.start)
+            break;
+         if (pos < block.start + block.sb->GetSampleCount()) {
+            result = b;
+            break;
+         }
+      }
+   }
+   if (result < 0)
+      result = FindBlock(pos);
+   pCursor->mpSequence = this;
+   pCursor->mBlock = result;
+   return result;
+}
+
 //static
 bool Sequence::Read(samplePtr buffer, sampleFormat format,
                     const SeqBlock &b, size_t blockRelativeStart, size_t len,
@@ -1068,7 +1182,7 @@ bool Sequence::Read(samplePtr buffer, sampleFormat format,
 }
 
 bool Sequence::Get(samplePtr buffer, sampleFormat format,
-   sampleCount start, size_t len, bool mayThrow) const
+   sampleCount start, size_t len, bool mayThrow, BlockCursor *pCursor) const
 {
    if (start == mNumSamples) {
       return len == 0;
@@ -1080,9 +1194,21 @@ bool Sequence::Get(samplePtr buffer, sampleFormat format,
       ClearSamples( buffer, floatSample, 0, len );
       return false;
    }
-   int b = FindBlock(start);
-
-   return Get(b, buffer, format, start, len, mayThrow);
+   int b = FindBlock(start, pCursor);
+
+   mSamplesRead.fetch_add(len, std::memory_order_relaxed);
+   const auto result = Get(b, buffer, format, start, len, mayThrow);
+
+   if (pCursor && len > 0) {
+      // Leave the cursor at the block of the last sample read
+      const auto last = start + len - 1;
+      const auto numBlocks = mBlock.size();
+      size_t bb = b;
+      while (bb + 1 < numBlocks && mBlock[bb + 1].start <= last)
+         ++bb;
+      pCursor->mBlock = bb;
+   }
+   return result;
 }
 
 bool Sequence::Get(int b, samplePtr buffer, sampleFormat format,
@@ -1107,6 +1233,19 @@ bool Sequence::Get(int b, samplePtr buffer, sampleFormat format,
    return result;
 }
 
+void Sequence::Prefetch(sampleCount start, sampleCount len) const
+{
+   auto end = std::min(start + len, mNumSamples);
+   start = std::max(start, sampleCount(0));
+   if (start >= end)
+      return;
+
+   const auto numBlocks = mBlock.size();
+   for (size_t b = FindBlock(start);
+        b < numBlocks && mBlock[b].start < end; ++b)
+      mpFactory->Prefetch(*mBlock[b].sb);
+}
+
 // Pass NULL to set silence
 /*! @excsafety{Strong} */
 void Sequence::SetSamples(constSamplePtr buffer, sampleFormat format,
@@ -1462,7 +1601,7 @@ bool Sequence::GetWaveDisplay(float *min, float *max, float *rms, int* bl,
 size_t Sequence::GetIdealAppendLen() const
 {
    int numBlocks = mBlock.size();
-   const auto max = GetMaxBlockSize();
+   const auto max = GetIdealBlockSize();
 
    if (numBlocks == 0)
       return max;
@@ -1529,9 +1668,15 @@ SeqBlock::SampleBlockPtr Sequence::DoAppend(
    BlockArray newBlock;
    sampleCount newNumSamples = mNumSamples;
 
+   // Share the cost of storing several new blocks
+   const auto idealSamples = GetIdealBlockSize();
+   Optional<SampleBlockBatch> batch;
+   if (len > idealSamples)
+      batch.emplace(factory);
+
    // If the last block is not full, we need to add samples to it
    int numBlocks = mBlock.size();
-   SeqBlock *pLastBlock;
+   const SeqBlock *pLastBlock;
    decltype(pLastBlock->sb->GetSampleCount()) length;
    size_t bufferSize = mMaxSamples;
    SampleBuffer buffer2(bufferSize, mSampleFormat);
@@ -1539,10 +1684,11 @@ SeqBlock::SampleBlockPtr Sequence::DoAppend(
    if (coalesce &&
        numBlocks > 0 &&
        (length =
-        (pLastBlock = &mBlock.back())->sb->GetSampleCount()) < mMinSamples) {
+        (pLastBlock = &mBlock.back())->sb->GetSampleCount()) <
+          std::min(mMinSamples, idealSamples)) {
       // Enlarge a sub-minimum block at the end
       const SeqBlock &lastBlock = *pLastBlock;
-      const auto addLen = std::min(mMaxSamples - length, len);
+      const auto addLen = std::min(idealSamples - length, len);
 
       Read(buffer2.ptr(), mSampleFormat, lastBlock, 0, length, true);
 
@@ -1569,7 +1715,6 @@ SeqBlock::SampleBlockPtr Sequence::DoAppend(
    }
    // Append the rest as NEW blocks
    while (len) {
-      const auto idealSamples = GetIdealBlockSize();
       const auto addedLen = std::min(idealSamples, len);
       SampleBlockPtr pBlock;
       if (format == mSampleFormat) {
@@ -1640,6 +1785,9 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 
    auto &factory = *mpFactory;
 
+   ++mEditCount;
+   const auto idealSamples = GetIdealBlockSize();
+
    const unsigned int numBlocks = mBlock.size();
 
    const unsigned int b0 = FindBlock(start);
@@ -1647,7 +1795,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 
    auto sampleSize = SAMPLE_SIZE(mSampleFormat);
 
-   SeqBlock *pBlock;
+   const SeqBlock *pBlock;
    decltype(pBlock->sb->GetSampleCount()) length;
 
    // One buffer for reuse in various branches here
@@ -1660,7 +1808,9 @@ void Sequence::Delete(sampleCount start, sampleCount len)
    // deletion within this block:
    if (b0 == b1 &&
        (length = (pBlock = &mBlock[b0])->sb->GetSampleCount()) - len >= mMinSamples) {
-      SeqBlock &b = *pBlock;
+      // Stop sharing the array before changing it in place
+      auto &blocks = mBlock.Mutable();
+      SeqBlock &b = blocks[b0];
       // start is within block
       auto pos = ( start - b.start ).as_size_t();
 
@@ -1689,7 +1839,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
       // use No-fail-guarantee in remaining steps
 
       for (unsigned int j = b0 + 1; j < numBlocks; j++)
-         mBlock[j].start -= len;
+         blocks[j].start -= len;
 
       mNumSamples -= len;
 
@@ -1741,7 +1891,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
               preBlock, 0, preBufferLen, true);
 
          newBlock.pop_back();
-         Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+         Blockify(*mpFactory, idealSamples, mSampleFormat,
                   newBlock, prepreBlock.start, scratch.ptr(), sum);
       }
    }
@@ -1773,7 +1923,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 
          newBlock.push_back(SeqBlock(file, start));
       } else {
-         SeqBlock &postpostBlock = mBlock[b1 + 1];
+         const SeqBlock &postpostBlock = mBlock[b1 + 1];
          const auto postpostLen = postpostBlock.sb->GetSampleCount();
          const auto sum = postpostLen + postBufferLen;
 
@@ -1786,7 +1936,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
          Read(scratch.ptr() + (postBufferLen * sampleSize), mSampleFormat,
               postpostBlock, 0, postpostLen, true);
 
-         Blockify(*mpFactory, mMaxSamples, mSampleFormat,
+         Blockify(*mpFactory, idealSamples, mSampleFormat,
                   newBlock, start, scratch.ptr(), sum);
          b1++;
       }
@@ -1804,9 +1954,62 @@ void Sequence::Delete(sampleCount start, sampleCount len)
       (newBlock, mNumSamples - len, wxT("Delete - branch two"));
 }
 
+size_t Sequence::CoalesceBlocks(size_t maxSamples)
+{
+   const auto idealSamples = GetIdealBlockSize();
+   const auto smallSamples = idealSamples / 2;
+   const auto numBlocks = mBlock.size();
+   auto isSmall = [&](size_t b){
+      return mBlock[b].sb->GetSampleCount() < smallSamples; };
+
+   // Find the first two consecutive small blocks
+   size_t b0 = 0;
+   while (b0 + 1 < numBlocks && !(isSmall(b0) && isSmall(b0 + 1)))
+      ++b0;
+   if (b0 + 1 >= numBlocks)
+      return 0;
+
+   // Extend the run as far as the limit allows
+   size_t b1 = b0;
+   size_t sum = 0;
+   while (b1 < numBlocks && isSmall(b1)) {
+      const auto length = mBlock[b1].sb->GetSampleCount();
+      if (b1 - b0 >= 2 && sum + length > maxSamples)
+         break;
+      sum += length;
+      ++b1;
+   }
+
+   SampleBuffer buffer(sum, mSampleFormat);
+   const auto sampleSize = SAMPLE_SIZE(mSampleFormat);
+   size_t pos = 0;
+   for (auto b = b0; b < b1; ++b) {
+      const auto &block = mBlock[b];
+      const auto length = block.sb->GetSampleCount();
+      Read(buffer.ptr() + pos * sampleSize, mSampleFormat, block,
+         0, length, true);
+      pos += length;
+   }
+
+   BlockArray newBlock;
+   newBlock.reserve(numBlocks);
+   newBlock.insert(newBlock.end(), mBlock.begin(), mBlock.begin() + b0);
+   {
+      SampleBlockBatch batch{ *mpFactory };
+      Blockify(*mpFactory, idealSamples, mSampleFormat,
+               newBlock, mBlock[b0].start, buffer.ptr(), sum);
+   }
+   newBlock.insert(newBlock.end(), mBlock.begin() + b1, mBlock.end());
+
+   CommitChangesIfConsistent(newBlock, mNumSamples, wxT("CoalesceBlocks"));
+
+   return sum;
+}
+
 void Sequence::ConsistencyCheck(const wxChar *whereStr, bool mayThrow) const
 {
-   ConsistencyCheck(mBlock, mMaxSamples, 0, mNumSamples, whereStr, mayThrow);
+   ConsistencyCheck(
+      mBlock.Get(), mMaxSamples, 0, mNumSamples, whereStr, mayThrow);
 }
 
 void Sequence::ConsistencyCheck
@@ -1866,7 +2069,7 @@ void Sequence::CommitChangesIfConsistent
    ConsistencyCheck( newBlock, mMaxSamples, 0, numSamples, whereStr ); // may throw
 
    // now commit
-   // use No-fail-guarantee
+   // use Strong-guarantee; only unsharing the array may throw
 
    mBlock.swap(newBlock);
    mNumSamples = numSamples;
@@ -1885,28 +2088,31 @@ void Sequence::AppendBlocksIfConsistent
    bool tmpValid = false;
    SeqBlock tmp;
 
-   if ( replaceLast && ! mBlock.empty() ) {
-      tmp = mBlock.back(), tmpValid = true;
-      mBlock.pop_back();
+   // Stop sharing the array before changing it in place
+   auto &blocks = mBlock.Mutable();
+
+   if ( replaceLast && ! blocks.empty() ) {
+      tmp = blocks.back(), tmpValid = true;
+      blocks.pop_back();
    }
 
-   auto prevSize = mBlock.size();
+   auto prevSize = blocks.size();
 
    bool consistent = false;
    auto cleanup = finally( [&] {
       if ( !consistent ) {
-         mBlock.resize( prevSize );
+         blocks.resize( prevSize );
          if ( tmpValid )
-            mBlock.push_back( tmp );
+            blocks.push_back( tmp );
       }
    } );
 
    std::copy( additionalBlocks.begin(), additionalBlocks.end(),
-              std::back_inserter( mBlock ) );
+              std::back_inserter( blocks ) );
 
    // Check consistency only of the blocks that were added,
    // avoiding quadratic time for repeated checking of repeating appends
-   ConsistencyCheck( mBlock, mMaxSamples, prevSize, numSamples, whereStr ); // may throw
+   ConsistencyCheck( blocks, mMaxSamples, prevSize, numSamples, whereStr ); // may throw
 
    // now commit
    // use No-fail-guarantee
@@ -1955,6 +2161,26 @@ size_t Sequence::GetMaxDiskBlockSize()
    return sMaxDiskBlockSize;
 }
 
+void Sequence::SetAdaptiveBlockSize(bool adaptive)
+{
+   sAdaptiveBlockSize = adaptive;
+}
+
+bool Sequence::GetAdaptiveBlockSize()
+{
+   return sAdaptiveBlockSize;
+}
+
+void Sequence::SetConversionThreads(size_t nThreads)
+{
+   sConversionThreads = nThreads;
+}
+
+size_t Sequence::GetConversionThreads()
+{
+   return sConversionThreads;
+}
+
 bool Sequence::IsValidSampleFormat(const int nValue)
 {
    return (nValue == int16Sample) || (nValue == int24Sample) || (nValue == floatSample);
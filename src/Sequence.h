@@ -12,6 +12,8 @@
 #define __AUDACITY_SEQUENCE__
 
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <functional>
 
@@ -19,6 +21,7 @@
 #include "XMLTagHandler.h"
 
 #include "SampleCount.h"
+#include "BlockCursor.h"
 
 class SampleBlock;
 class SampleBlockFactory;
@@ -49,6 +52,51 @@ class SeqBlock {
 class BlockArray : public std::vector<SeqBlock> {};
 using BlockPtrArray = std::vector<SeqBlock*>; // non-owning pointers
 
+//! A BlockArray that copies share, until one of them is changed
+/*! Copying is constant time, so that snapshots of sequences, as for undo,
+ do not copy the arrays.  The first change to a shared array copies it,
+ which costs no more than the edits of Sequence, which rebuild the array.
+ Only the const members are provided in the manner of std::vector, so that
+ each change must be made through Mutable() */
+class SharedBlockArray {
+public:
+   SharedBlockArray() : mpArray{ std::make_shared<BlockArray>() } {}
+
+   const BlockArray &Get() const { return *mpArray; }
+
+   //! Copy the array first if it is shared
+   BlockArray &Mutable()
+   {
+      if (mpArray.use_count() > 1)
+         mpArray = std::make_shared<BlockArray>(*mpArray);
+      return *mpArray;
+   }
+
+   //! Take the contents of other, which receives the old contents, or
+   //! nothing if they are still shared
+   /*! @excsafety{Strong} -- may throw only in allocating */
+   void swap(BlockArray &other)
+   {
+      if (mpArray.use_count() > 1) {
+         auto pArray = std::make_shared<BlockArray>();
+         pArray->swap(other);
+         mpArray.swap(pArray);
+      }
+      else
+         mpArray->swap(other);
+   }
+
+   size_t size() const { return mpArray->size(); }
+   bool empty() const { return mpArray->empty(); }
+   const SeqBlock &operator [] (size_t ii) const { return (*mpArray)[ii]; }
+   const SeqBlock &back() const { return mpArray->back(); }
+   BlockArray::const_iterator begin() const { return mpArray->begin(); }
+   BlockArray::const_iterator end() const { return mpArray->end(); }
+
+private:
+   std::shared_ptr<BlockArray> mpArray;
+};
+
 // Put extra symbol information in the release build, for the purpose of gathering
 // profiling information (as from Windows Process Monitor), when there otherwise
 // isn't a need for AUDACITY_DLL_API.
@@ -68,6 +116,16 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    static void SetMaxDiskBlockSize(size_t bytes);
    static size_t GetMaxDiskBlockSize();
 
+   //! Whether new blocks are sized by the observed use of each sequence
+   /*! When false, GetIdealBlockSize() always equals GetMaxBlockSize() */
+   static void SetAdaptiveBlockSize(bool adaptive);
+   static bool GetAdaptiveBlockSize();
+
+   //! Most threads that ConvertToSampleFormat() uses; 0 for no limit
+   /*! The number is also limited by WorkerPool::GetConcurrency() */
+   static void SetConversionThreads(size_t nThreads);
+   static size_t GetConversionThreads();
+
    //! true if nValue is one of the sampleFormat enum values
    static bool IsValidSampleFormat(const int nValue);
 
@@ -90,8 +148,17 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
 
    sampleCount GetNumSamples() const { return mNumSamples; }
 
+   //! @param pCursor if not null, is used to find the first block, and is
+   //! updated for a following read
    bool Get(samplePtr buffer, sampleFormat format,
-            sampleCount start, size_t len, bool mayThrow) const;
+            sampleCount start, size_t len, bool mayThrow,
+            BlockCursor *pCursor = nullptr) const;
+
+   //! Hint that samples in the given range will soon be read
+   /*! Passes the overlapping blocks to SampleBlockFactory::Prefetch();
+       out-of-range portions are ignored.  Does not allocate, so may be
+       called in the audio thread. */
+   void Prefetch(sampleCount start, sampleCount len) const;
 
    // Note that len is not size_t, because nullptr may be passed for buffer, in
    // which case, silence is inserted, possibly a large amount.
@@ -128,8 +195,21 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    void SetSilence(sampleCount s0, sampleCount len);
    void InsertSilence(sampleCount s0, sampleCount len);
 
+   //! Rewrite the first run of undersized blocks as blocks of the ideal size
+   /*! Contents are unchanged, and this does not count as an edit.
+    A run is at least two consecutive blocks, each shorter than half of
+    GetIdealBlockSize(), and is longer than maxSamples only when two
+    blocks are.
+    @return the number of samples rewritten, or zero if there is no run
+    @excsafety{Strong} */
+   size_t CoalesceBlocks(size_t maxSamples);
+
    const SampleBlockFactoryPtr &GetFactory() { return mpFactory; }
 
+   //! The sample rate at which the samples are played, used only to choose
+   //! the sizes of new blocks
+   void SetRateHint(double rate) { mRateHint = rate; }
+
    //
    // XMLTagHandler callback methods for loading and saving
    //
@@ -171,11 +251,16 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    //
 
    // This returns a possibly large or negative value
-   sampleCount GetBlockStart(sampleCount position) const;
+   sampleCount GetBlockStart(sampleCount position,
+      BlockCursor *pCursor = nullptr) const;
 
    // These return a nonnegative number of samples meant to size a memory buffer
-   size_t GetBestBlockSize(sampleCount start) const;
+   size_t GetBestBlockSize(sampleCount start,
+      BlockCursor *pCursor = nullptr) const;
    size_t GetMaxBlockSize() const;
+   //! Preferred length of new blocks, not more than GetMaxBlockSize()
+   /*! With adaptive block sizes, it shrinks toward a few seconds of audio
+       as the sequence is edited more often than it is read through */
    size_t GetIdealBlockSize() const;
 
    //
@@ -183,8 +268,9 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    // you're doing!
    //
 
-   BlockArray &GetBlockArray() { return mBlock; }
-   const BlockArray &GetBlockArray() const { return mBlock; }
+   //! Stops sharing the array with copies of the sequence
+   BlockArray &GetBlockArray() { return mBlock.Mutable(); }
+   const BlockArray &GetBlockArray() const { return mBlock.Get(); }
 
  private:
 
@@ -193,6 +279,8 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    //
 
    static size_t    sMaxDiskBlockSize;
+   static bool      sAdaptiveBlockSize;
+   static size_t    sConversionThreads;
 
    //
    // Private variables
@@ -200,7 +288,7 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
 
    SampleBlockFactoryPtr mpFactory;
 
-   BlockArray    mBlock;
+   SharedBlockArray mBlock;
    sampleFormat  mSampleFormat;
 
    // Not size_t!  May need to be large:
@@ -209,6 +297,12 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    size_t   mMinSamples; // min samples per block
    size_t   mMaxSamples; // max samples per block
 
+   // Observed use, to choose the sizes of new blocks
+   double   mRateHint{ 0 };
+   size_t   mEditCount{ 0 };
+   // Counted in Get(), which other threads may call
+   mutable std::atomic<unsigned long long> mSamplesRead{ 0 };
+
    bool          mErrorOpening{ false };
 
    //
@@ -216,6 +310,9 @@ class PROFILE_DLL_API Sequence final : public XMLTagHandler{
    //
 
    int FindBlock(sampleCount pos) const;
+   //! Check the block of the cursor and the next, before searching; then
+   //! leave the cursor at the found block
+   int FindBlock(sampleCount pos, BlockCursor *pCursor) const;
 
    SeqBlock::SampleBlockPtr DoAppend(
       constSamplePtr buffer, sampleFormat format, size_t len, bool coalesce);
@@ -11,9 +11,21 @@ Paul Licameli -- split from SampleBlock.cpp and SampleBlock.h
 #include <float.h>
 #include <sqlite3.h>
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "DBConnection.h"
+#include "Prefs.h"
 #include "ProjectFileIO.h"
+#include "SampleBlockCache.h"
+#include "SampleBlockCodec.h"
 #include "SampleFormat.h"
+#include "SummaryKernels.h"
 #include "XMLTagHandler.h"
 
 #include "SampleBlock.h" // to inherit
@@ -23,6 +35,21 @@ Paul Licameli -- split from SampleBlock.cpp and SampleBlock.h
 
 class SqliteSampleBlockFactory;
 
+BoolSetting CompressSampleBlocks{
+   L"/FileFormats/CompressSampleBlocks", false };
+
+BoolSetting LazySampleBlockSummaries{
+   L"/Performance/LazySampleBlockSummaries", false };
+
+//! Whether new blocks with the same samples as existing blocks share them
+static BoolSetting DeduplicateSampleBlocks{
+   L"/Performance/DeduplicateSampleBlocks", false };
+
+//! Whether uncompressed samples are read through incremental blob handles,
+//! straight into the destination
+static BoolSetting DirectSampleReads{
+   L"/Performance/DirectSampleReads", true };
+
 ///\brief Implementation of @ref SampleBlock using Sqlite database
 class SqliteSampleBlock final : public SampleBlock
 {
@@ -51,6 +78,7 @@ public:
                        size_t numsamples) override;
    sampleFormat GetSampleFormat() const;
    size_t GetSampleCount() const override;
+   View GetView() override;
 
    bool GetSummary256(float *dest, size_t frameoffset, size_t numframes) override;
    bool GetSummary64k(float *dest, size_t frameoffset, size_t numframes) override;
@@ -69,7 +97,18 @@ public:
 
 private:
    bool IsSilent() const { return mBlockID <= 0; }
+   //! Read samples from the contents cache when it holds the block
+   /*! @param mayFill whether a miss reading the whole block should read it
+    into the cache; other misses read only the requested range */
+   size_t ReadCached(samplePtr dest,
+                     sampleFormat destformat,
+                     size_t sampleoffset,
+                     size_t numsamples,
+                     bool mayFill);
+   //! Read the whole contents, and remember them in the cache
+   View LoadContents(sqlite3_stmt *stmt);
    void Load(SampleBlockID sbid);
+   size_t ReadEncodedSampleCount();
    bool GetSummary(float *dest,
                    size_t frameoffset,
                    size_t numframes,
@@ -77,10 +116,28 @@ private:
                    const char *sql);
    size_t GetBlob(void *dest,
                   sampleFormat destformat,
+                  DBConnection::StatementID id,
                   sqlite3_stmt *stmt,
                   sampleFormat srcformat,
                   size_t srcoffset,
-                  size_t srcbytes);
+                  size_t srcbytes,
+                  SampleBlockCodec::ID codec = SampleBlockCodec::Raw,
+                  size_t *pBlobBytes = nullptr);
+   //! Read samples by the configured path, counting the bytes moved
+   size_t ReadSamples(void *dest,
+                      sampleFormat destformat,
+                      sqlite3_stmt *stmt,
+                      size_t srcoffset,
+                      size_t srcbytes);
+   //! Read uncompressed samples through a blob handle, without the copy of
+   //! the whole blob that sqlite3_column_blob makes
+   /*! Only the requested range is read; misses of the contents cache read
+       whole blocks only to fill it (see ReadCached()) */
+   size_t ReadBlob(void *dest,
+                   sampleFormat destformat,
+                   size_t srcoffset,
+                   size_t srcbytes,
+                   unsigned long long &staged);
 
    enum {
       fields = 3, /* min, max, rms */
@@ -88,6 +145,10 @@ private:
    };
    Sizes SetSizes( size_t numsamples, sampleFormat srcformat );
    void CalcSummary(Sizes sizes);
+   //! Compute deferred summaries from the samples, if not done yet
+   void EnsureSummaries();
+   //! Write computed summaries into the row; non-throwing, true for success
+   bool StoreSummaries(Sizes sizes);
 
 private:
    //! This must never be called for silent blocks
@@ -110,12 +171,22 @@ private:
    size_t mSampleBytes;
    size_t mSampleCount;
    sampleFormat mSampleFormat;
+   //! Encoding of the samples column; mSampleBytes is always the decoded size
+   SampleBlockCodec::ID mCodec{ SampleBlockCodec::Raw };
 
    ArrayOf<char> mSummary256;
    ArrayOf<char> mSummary64k;
    double mSumMin;
    double mSumMax;
    double mSumRms;
+   //! False while the summaries in the row are missing; then they are
+   //! computed on demand, and held in mSummary256 and mSummary64k only if
+   //! they could not be stored
+   bool mSummarized{ true };
+   //! Digest of format and samples, as stored in the hash column; meaningful
+   //! only if mHashed
+   uint64_t mHash{ 0 };
+   bool mHashed{ false };
 
 #if defined(WORDS_BIGENDIAN)
 #error All sample block data is little endian...big endian not yet supported
@@ -132,6 +203,7 @@ static std::map< SampleBlockID, std::shared_ptr<SqliteSampleBlock> >
 class SqliteSampleBlockFactory final
    : public SampleBlockFactory
    , public std::enable_shared_from_this<SqliteSampleBlockFactory>
+   , private PrefsListener
 {
 public:
    explicit SqliteSampleBlockFactory( AudacityProject &project );
@@ -155,10 +227,73 @@ public:
    BlockDeletionCallback SetBlockDeletionCallback(
       BlockDeletionCallback callback ) override;
 
+   void Prefetch( const SampleBlock &block ) override;
+
+   PrefetchStatistics GetPrefetchStatistics() const override;
+
+   ReadStatistics GetReadStatistics() const override;
+
+   void BeginBatch() override;
+   void EndBatch() override;
+
 private:
+   void UpdatePrefs() override;
+
+   //! Called by each block before its insertion, to open the transaction of
+   //! a batch lazily
+   void BatchBeforeInsert( DBConnection &connection );
+   //! Called by each block after its insertion
+   void BatchAfterInsert( size_t bytes );
+   //! Commit the transaction of the batch, if any
+   bool ReleaseBatch();
+
+   //! What the read-ahead thread needs to know about a block, without
+   //! sharing ownership of it
+   struct PrefetchRequest {
+      SampleBlockID id;
+      sampleFormat format;
+      SampleBlockCodec::ID codec;
+      size_t bytes;
+   };
+   //! Pass a request to the read-ahead thread, without locking
+   /*! @return false if there is no room */
+   bool PushPrefetch( const PrefetchRequest &request );
+   //! Called only in the read-ahead thread
+   bool PopPrefetch( PrefetchRequest &request );
+   void PrefetchThread();
+   //! Read one block using the private connection, opening it if needed
+   bool ReadPrefetch( const PrefetchRequest &request, samplePtr dest );
+   //! Require mPrefetchDBMutex
+   bool OpenPrefetchConnection();
+   void ClosePrefetchConnection();
+   //! Follow the opening and closing of connections for the project
+   void OnOpenClose( DBConnection &connection, bool opened );
+   //! Called on a synchronous read of a block missing from the cache
+   void CountPrefetchStall(SampleBlockID id);
+
+   //! Find a live block with the given digest and exactly the given samples
+   std::shared_ptr<SqliteSampleBlock> FindDuplicate( uint64_t hash,
+      constSamplePtr src, size_t numsamples, sampleFormat srcformat );
+   //! Make the block findable by its digest, if it has one
+   void IndexHash( const SqliteSampleBlock &block );
+   //! Called by each block with a digest when destroyed
+   void ForgetHash( const SqliteSampleBlock &block );
+
    friend SqliteSampleBlock;
 
    const std::shared_ptr<ConnectionPtr> mppConnection;
+   const std::shared_ptr<SampleBlockCache> mpCache;
+
+   // Preferences are read in the main thread, but blocks may be created in
+   // others, as when recording
+   std::atomic<bool> mCompress{ false };
+   std::atomic<bool> mLazySummaries{ false };
+   std::atomic<bool> mDeduplicate{ false };
+   std::atomic<bool> mDirectReads{ true };
+
+   // Counters for GetReadStatistics(); reads happen in several threads
+   std::atomic<unsigned long long> mBytesStaged{ 0 };
+   std::atomic<unsigned long long> mBytesDelivered{ 0 };
 
    // Track all blocks that this factory has created, but don't control
    // their lifetimes (so use weak_ptr)
@@ -168,27 +303,219 @@ private:
       std::map< SampleBlockID, std::weak_ptr< SqliteSampleBlock > >;
    AllBlocksMap mAllBlocks;
 
+   // Ids of blocks in mAllBlocks with known digests, by digest.  Only live
+   // blocks can be shared, because the row of a block is deleted with it.
+   std::unordered_multimap< uint64_t, SampleBlockID > mBlocksByHash;
+   //! Blocks not made because an equal block was shared instead
+   size_t mDuplicatesFound{ 0 };
+
    BlockDeletionCallback mCallback;
+
+   // Read-ahead into the cache, with a private database connection
+
+   //! Requests pass to the read-ahead thread through a bounded queue without
+   //! locks, in which each slot counts the turns of its producers and consumer
+   struct PrefetchSlot {
+      std::atomic<size_t> sequence{ 0 };
+      PrefetchRequest request{};
+   };
+   static constexpr size_t PrefetchSlots = 256;
+   std::array<PrefetchSlot, PrefetchSlots> mPrefetchSlots;
+   std::atomic<size_t> mPrefetchPushed{ 0 };
+   //! Used only by the read-ahead thread
+   size_t mPrefetchPopped{ 0 };
+
+   std::thread mPrefetchThread;
+   std::mutex mPrefetchWakeMutex;
+   std::condition_variable mPrefetchCondition;
+   std::atomic<bool> mPrefetchStop{ false };
+   //! Whether the read-ahead thread waits, or is about to, for Prefetch()
+   std::atomic<bool> mPrefetchIdle{ false };
+
+   mutable std::mutex mPrefetchMutex;
+   //! Ids queued by the read-ahead thread or being read
+   std::unordered_set<SampleBlockID> mPrefetchPending;
+   PrefetchStatistics mPrefetchStats;
+
+   //! Guards the private connection, which closes before the project's
+   std::mutex mPrefetchDBMutex;
+   sqlite3 *mPrefetchDB{};
+   sqlite3_stmt *mPrefetchStmt{};
+   //! A connection for the project that is closing, or for whose file the
+   //! private connection failed to open; don't open for it (again)
+   const DBConnection *mNoPrefetchConnection{};
+   size_t mOpenCloseHookKey{};
+
+   // Batched insertion
+   int mBatchDepth{ 0 };
+   Optional<TransactionScope> mBatchScope;
+   DBConnection *mBatchConnection{};
+   //! Blocks and bytes inserted in the current transaction
+   size_t mBatchBlocks{ 0 };
+   size_t mBatchBytes{ 0 };
+   //! Totals for the outermost batch, for measurement
+   size_t mBatchTotalBlocks{ 0 };
+   size_t mBatchTotalBytes{ 0 };
+   size_t mBatchTransactions{ 0 };
+   std::chrono::steady_clock::time_point mBatchStart;
 };
 
+// The transaction of a batch is committed after so many blocks or bytes, so
+// that the write-ahead log can be checkpointed during a long import
+static constexpr size_t MaxBatchBlocks = 256;
+static constexpr size_t MaxBatchBytes = 16 * 1024 * 1024;
+
 SqliteSampleBlockFactory::SqliteSampleBlockFactory( AudacityProject &project )
    : mppConnection{ ConnectionPtr::Get(project).shared_from_this() }
+   , mpCache{ SampleBlockCache::Get(project).shared_from_this() }
 {
-   
+   UpdatePrefs();
+
+   for (size_t ii = 0; ii < PrefetchSlots; ++ii)
+      mPrefetchSlots[ii].sequence.store(ii, std::memory_order_relaxed);
+   mOpenCloseHookKey = mppConnection->AddOpenCloseHook(
+      [this](DBConnection &connection, bool opened){
+         OnOpenClose(connection, opened); });
+   // Start now, so that Prefetch() never has to; it sleeps until the first
+   // request
+   mPrefetchThread = std::thread([this]{ PrefetchThread(); });
 }
 
-SqliteSampleBlockFactory::~SqliteSampleBlockFactory() = default;
+SqliteSampleBlockFactory::~SqliteSampleBlockFactory()
+{
+   {
+      std::lock_guard<std::mutex> guard(mPrefetchWakeMutex);
+      mPrefetchStop = true;
+   }
+   mPrefetchCondition.notify_one();
+   if (mPrefetchThread.joinable())
+      mPrefetchThread.join();
+   mppConnection->RemoveOpenCloseHook(mOpenCloseHookKey);
+   {
+      std::lock_guard<std::mutex> guard(mPrefetchDBMutex);
+      ClosePrefetchConnection();
+   }
+
+   if (mDuplicatesFound > 0)
+      wxLogDebug(wxT("SqliteSampleBlockFactory - %llu duplicate blocks shared"),
+         (unsigned long long)mDuplicatesFound);
+}
+
+void SqliteSampleBlockFactory::UpdatePrefs()
+{
+   mCompress = CompressSampleBlocks.Read();
+   mLazySummaries = LazySampleBlockSummaries.Read();
+   mDeduplicate = DeduplicateSampleBlocks.Read();
+   mDirectReads = DirectSampleReads.Read();
+   mpCache->SetBudget(
+      std::max(0, SampleBlockCacheSize.Read()) * size_t(1024 * 1024));
+}
+
+// A 64 bit digest of samples, stable across sessions and platforms (all
+// sample data is little endian), consuming eight bytes at a step
+static uint64_t HashSamples(
+   constSamplePtr src, size_t numsamples, sampleFormat format )
+{
+   constexpr uint64_t prime = 0x100000001b3ULL;
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   auto mix = [&](uint64_t word){
+      hash = (hash ^ word) * prime;
+      hash ^= hash >> 29;
+   };
+   mix(format);
+   mix(numsamples);
+
+   const auto bytes = numsamples * SAMPLE_SIZE(format);
+   size_t ii = 0;
+   for (; ii + sizeof(uint64_t) <= bytes; ii += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, src + ii, sizeof(word));
+      mix(word);
+   }
+   if (ii < bytes) {
+      uint64_t word = 0;
+      memcpy(&word, src + ii, bytes - ii);
+      mix(word);
+   }
+   return hash;
+}
 
 SampleBlockPtr SqliteSampleBlockFactory::DoCreate(
    constSamplePtr src, size_t numsamples, sampleFormat srcformat )
 {
+   // Repeated content, as from loops or generators, may share one row
+   Optional<uint64_t> hash;
+   if (mDeduplicate) {
+      hash.emplace(HashSamples(src, numsamples, srcformat));
+      if (auto pBlock = FindDuplicate(*hash, src, numsamples, srcformat)) {
+         ++mDuplicatesFound;
+         return pBlock;
+      }
+   }
+
    auto sb = std::make_shared<SqliteSampleBlock>(shared_from_this());
+   if (hash) {
+      sb->mHash = *hash;
+      sb->mHashed = true;
+   }
    sb->SetSamples(src, numsamples, srcformat);
    // block id has now been assigned
    mAllBlocks[ sb->GetBlockID() ] = sb;
+   IndexHash(*sb);
    return sb;
 }
 
+std::shared_ptr<SqliteSampleBlock> SqliteSampleBlockFactory::FindDuplicate(
+   uint64_t hash,
+   constSamplePtr src, size_t numsamples, sampleFormat srcformat )
+{
+   ArrayOf<char> buffer;
+   const auto range = mBlocksByHash.equal_range(hash);
+   for (auto it = range.first; it != range.second; ++it) {
+      const auto iter = mAllBlocks.find(it->second);
+      if (iter == mAllBlocks.end())
+         continue;
+      const auto pBlock = iter->second.lock();
+      if (!pBlock ||
+          pBlock->mSampleFormat != srcformat ||
+          pBlock->mSampleCount != numsamples)
+         continue;
+
+      // Digests may collide, so compare the samples; a failure to read
+      // counts as a difference
+      const auto bytes = numsamples * SAMPLE_SIZE(srcformat);
+      if (const auto view = pBlock->GetView()) {
+         if (memcmp(view->get(), src, bytes) == 0)
+            return pBlock;
+         continue;
+      }
+      if (!buffer)
+         buffer.reinit(bytes);
+      if (pBlock->GetSamples(buffer.get(), srcformat, 0, numsamples, false)
+            == numsamples &&
+          memcmp(buffer.get(), src, bytes) == 0)
+         return pBlock;
+   }
+   return nullptr;
+}
+
+void SqliteSampleBlockFactory::IndexHash( const SqliteSampleBlock &block )
+{
+   if (block.mHashed)
+      mBlocksByHash.emplace(block.mHash, block.mBlockID);
+}
+
+void SqliteSampleBlockFactory::ForgetHash( const SqliteSampleBlock &block )
+{
+   const auto range = mBlocksByHash.equal_range(block.mHash);
+   for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == block.mBlockID) {
+         mBlocksByHash.erase(it);
+         break;
+      }
+   }
+}
+
 auto SqliteSampleBlockFactory::GetActiveBlockIDs() -> SampleBlockIDs
 {
    SampleBlockIDs result;
@@ -267,6 +594,7 @@ SampleBlockPtr SqliteSampleBlockFactory::DoCreateFromXML(
                // This may throw database errors
                // It initializes the rest of the fields
                ssb->Load((SampleBlockID) nValue);
+               IndexHash(*ssb);
             }
          }
          found++;
@@ -290,6 +618,326 @@ auto SqliteSampleBlockFactory::SetBlockDeletionCallback(
    return result;
 }
 
+void SqliteSampleBlockFactory::Prefetch( const SampleBlock &block )
+{
+   auto pSqliteBlock = dynamic_cast<const SqliteSampleBlock*>(&block);
+   if (!pSqliteBlock || pSqliteBlock->mpFactory.get() != this ||
+       pSqliteBlock->IsSilent() || !pSqliteBlock->mValid)
+      return;
+
+   // The read-ahead thread checks the cache and the budget; when the queue is
+   // full, the block is just read when needed
+   // Wake the thread only if it sleeps, or is about to.  Don't lock the
+   // mutex:  this may be called in the audio thread.  The notification may
+   // then, rarely, reach the read-ahead thread just before it waits; then
+   // the request waits for the next one.
+   if (PushPrefetch({ pSqliteBlock->mBlockID, pSqliteBlock->mSampleFormat,
+         pSqliteBlock->mCodec, pSqliteBlock->mSampleBytes }) &&
+       mPrefetchIdle.load())
+      mPrefetchCondition.notify_one();
+}
+
+bool SqliteSampleBlockFactory::PushPrefetch( const PrefetchRequest &request )
+{
+   auto pos = mPrefetchPushed.load(std::memory_order_relaxed);
+   while (true) {
+      auto &slot = mPrefetchSlots[pos % PrefetchSlots];
+      const auto sequence = slot.sequence.load(std::memory_order_acquire);
+      const auto difference = std::ptrdiff_t(sequence - pos);
+      if (difference == 0) {
+         // The slot is free in this turn; claim it
+         if (mPrefetchPushed.compare_exchange_weak(
+               pos, pos + 1, std::memory_order_relaxed)) {
+            slot.request = request;
+            slot.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+         }
+      }
+      else if (difference < 0)
+         // The consumer has not yet emptied the slot from the last turn
+         return false;
+      else
+         // Another producer claimed the slot
+         pos = mPrefetchPushed.load(std::memory_order_relaxed);
+   }
+}
+
+bool SqliteSampleBlockFactory::PopPrefetch( PrefetchRequest &request )
+{
+   auto &slot = mPrefetchSlots[mPrefetchPopped % PrefetchSlots];
+   if (slot.sequence.load(std::memory_order_acquire) != mPrefetchPopped + 1)
+      return false;
+   request = slot.request;
+   slot.sequence.store(
+      mPrefetchPopped + PrefetchSlots, std::memory_order_release);
+   ++mPrefetchPopped;
+   return true;
+}
+
+auto SqliteSampleBlockFactory::GetPrefetchStatistics() const
+   -> PrefetchStatistics
+{
+   std::lock_guard<std::mutex> guard(mPrefetchMutex);
+   return mPrefetchStats;
+}
+
+auto SqliteSampleBlockFactory::GetReadStatistics() const -> ReadStatistics
+{
+   return { mBytesStaged.load(), mBytesDelivered.load() };
+}
+
+void SqliteSampleBlockFactory::CountPrefetchStall(SampleBlockID id)
+{
+   std::lock_guard<std::mutex> guard(mPrefetchMutex);
+   if (mPrefetchPending.count(id))
+      ++mPrefetchStats.stalls;
+}
+
+void SqliteSampleBlockFactory::BeginBatch()
+{
+   if (mBatchDepth++ == 0) {
+      mBatchTotalBlocks = mBatchTotalBytes = mBatchTransactions = 0;
+      mBatchStart = std::chrono::steady_clock::now();
+   }
+}
+
+void SqliteSampleBlockFactory::EndBatch()
+{
+   if (mBatchDepth <= 0) {
+      wxASSERT(false);
+      return;
+   }
+   if (--mBatchDepth > 0)
+      return;
+
+   if (!ReleaseBatch())
+      // Do not throw; the error was already recorded in the connection
+      wxLogMessage("Failed to commit a batch of sample blocks");
+
+   if (mBatchTotalBlocks > 1) {
+      const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+         std::chrono::steady_clock::now() - mBatchStart).count();
+      wxLogDebug(
+         "Inserted %lu sample blocks (%.1f MB) in %lu transactions, %lld ms",
+         (unsigned long) mBatchTotalBlocks, mBatchTotalBytes / 1048576.0,
+         (unsigned long) mBatchTransactions, (long long) ms);
+   }
+}
+
+void SqliteSampleBlockFactory::BatchBeforeInsert( DBConnection &connection )
+{
+   if (mBatchDepth == 0 || mBatchScope)
+      return;
+   mBatchScope.emplace(connection, "SampleBlockBatch");
+   mBatchConnection = &connection;
+   ++mBatchTransactions;
+}
+
+void SqliteSampleBlockFactory::BatchAfterInsert( size_t bytes )
+{
+   if (!mBatchScope)
+      return;
+
+   ++mBatchTotalBlocks;
+   mBatchTotalBytes += bytes;
+   ++mBatchBlocks;
+   mBatchBytes += bytes;
+
+   // If the batch is nested in another transaction, releasing it would not
+   // commit anything, so wait for EndBatch()
+   if ((mBatchBlocks >= MaxBatchBlocks || mBatchBytes >= MaxBatchBytes) &&
+       mBatchConnection->GetTransactionDepth() == 1 &&
+       !ReleaseBatch())
+      mBatchConnection->ThrowException( true );
+}
+
+bool SqliteSampleBlockFactory::ReleaseBatch()
+{
+   bool result = true;
+   if (mBatchScope) {
+      // TransactionScope::Commit() returns true when still in the transaction
+      result = !mBatchScope->Commit();
+      mBatchScope.reset();
+   }
+   mBatchConnection = nullptr;
+   mBatchBlocks = mBatchBytes = 0;
+   return result;
+}
+
+void SqliteSampleBlockFactory::PrefetchThread()
+{
+   std::deque<PrefetchRequest> queue;
+   size_t queuedBytes = 0;
+
+   // Whether a request waits in the slots; only this thread pops them
+   const auto ready = [this]{
+      auto &slot = mPrefetchSlots[mPrefetchPopped % PrefetchSlots];
+      return slot.sequence.load(std::memory_order_acquire) ==
+         mPrefetchPopped + 1;
+   };
+
+   while (true)
+   {
+      if (queue.empty())
+      {
+         // Sleep, without waking periodically, until there is work or the
+         // stop signal
+         std::unique_lock<std::mutex> lock(mPrefetchWakeMutex);
+         mPrefetchIdle = true;
+         mPrefetchCondition.wait(lock,
+            [&]{ return mPrefetchStop.load() || ready(); });
+         mPrefetchIdle = false;
+      }
+
+      // Requested to stop, so bail
+      if (mPrefetchStop)
+         break;
+
+      // Reading ahead fills the cache, so it must not push out more than half
+      // of it, or it would evict the very blocks it read
+      const auto limit = mpCache->GetBudget() / 2;
+
+      {
+         std::lock_guard<std::mutex> guard(mPrefetchMutex);
+         PrefetchRequest request;
+         while (PopPrefetch(request)) {
+            if (queuedBytes + request.bytes > limit ||
+                mPrefetchPending.count(request.id) ||
+                mpCache->Contains(request.id))
+               continue;
+            mPrefetchPending.insert(request.id);
+            queue.push_back(request);
+            queuedBytes += request.bytes;
+            ++mPrefetchStats.requested;
+         }
+         mPrefetchStats.depth = queue.size();
+         mPrefetchStats.maxDepth =
+            std::max(mPrefetchStats.maxDepth, mPrefetchStats.depth);
+      }
+
+      if (queue.empty())
+         continue;
+      const auto request = queue.front();
+      queue.pop_front();
+
+      auto data = std::make_shared<ArrayOf<char>>(request.bytes);
+      const bool loaded = ReadPrefetch(request, data->get());
+      // The block may have been deleted meanwhile; then its id is never
+      // reused, and the entry will just age out of the cache
+      if (loaded)
+         mpCache->Insert(request.id, data, request.bytes);
+
+      std::lock_guard<std::mutex> guard(mPrefetchMutex);
+      mPrefetchPending.erase(request.id);
+      queuedBytes -= request.bytes;
+      mPrefetchStats.depth = queue.size();
+      if (loaded)
+         ++mPrefetchStats.completed;
+   }
+}
+
+bool SqliteSampleBlockFactory::ReadPrefetch(
+   const PrefetchRequest &request, samplePtr dest)
+{
+   std::lock_guard<std::mutex> guard(mPrefetchDBMutex);
+   if (!mPrefetchStmt && !OpenPrefetchConnection())
+      return false;
+   const auto stmt = mPrefetchStmt;
+
+   bool result = false;
+   if (sqlite3_bind_int64(stmt, 1, request.id) == SQLITE_OK &&
+       sqlite3_step(stmt) == SQLITE_ROW)
+   {
+      auto src = (constSamplePtr) sqlite3_column_blob(stmt, 0);
+      size_t blobbytes = (size_t) sqlite3_column_bytes(stmt, 0);
+      const auto size = SAMPLE_SIZE(request.format);
+
+      size_t copied;
+      if (request.codec == SampleBlockCodec::Raw)
+      {
+         copied = std::min(blobbytes, request.bytes);
+         memcpy(dest, src, copied);
+      }
+      else
+         copied = size * SampleBlockCodec::Decode(src, blobbytes,
+            request.format, dest, request.format, 0, request.bytes / size);
+
+      if (request.bytes - copied)
+         memset(dest + copied, 0, request.bytes - copied);
+      result = true;
+   }
+
+   // Clear statement bindings and rewind statement
+   sqlite3_clear_bindings(stmt);
+   sqlite3_reset(stmt);
+
+   return result;
+}
+
+bool SqliteSampleBlockFactory::OpenPrefetchConnection()
+{
+   // Use a connection of our own, so that reading ahead never contends
+   // with the main connection's prepared statements.  It is closed before
+   // the project's connection, and reopened to the file of the project's
+   // current connection, as after Save As.
+   const auto pConnection = mppConnection->mpConnection.get();
+   if (!pConnection || pConnection == mNoPrefetchConnection)
+      return false;
+
+   // Empty for an in-memory database, which can't be shared
+   const char *path = sqlite3_db_filename(pConnection->DB(), "main");
+   if (!path || !*path)
+      return false;
+
+   // Reading ahead never writes
+   int rc = sqlite3_open_v2(path, &mPrefetchDB, SQLITE_OPEN_READONLY, nullptr);
+   if (rc == SQLITE_OK)
+      rc = sqlite3_busy_timeout(mPrefetchDB, 5000);
+   if (rc == SQLITE_OK)
+      rc = sqlite3_prepare_v2(mPrefetchDB,
+         "SELECT samples FROM sampleblocks WHERE blockid = ?1;",
+         -1, &mPrefetchStmt, nullptr);
+   if (rc != SQLITE_OK)
+   {
+      wxLogMessage("Failed to open prefetch connection to %s: %d, %s\n",
+         path, rc, sqlite3_errstr(rc));
+      ClosePrefetchConnection();
+      mNoPrefetchConnection = pConnection;
+      return false;
+   }
+   return true;
+}
+
+void SqliteSampleBlockFactory::ClosePrefetchConnection()
+{
+   if (mPrefetchStmt)
+      // No need to check return code
+      sqlite3_finalize(mPrefetchStmt);
+   mPrefetchStmt = nullptr;
+   if (mPrefetchDB)
+      sqlite3_close(mPrefetchDB);
+   mPrefetchDB = nullptr;
+}
+
+void SqliteSampleBlockFactory::OnOpenClose(
+   DBConnection &connection, bool opened)
+{
+   std::lock_guard<std::mutex> guard(mPrefetchDBMutex);
+   if (opened)
+   {
+      // A new connection may reuse the address of a closed one
+      if (mNoPrefetchConnection == &connection)
+         mNoPrefetchConnection = nullptr;
+   }
+   else
+   {
+      // Don't hold the file open when the project is closed, compacted, or
+      // saved elsewhere
+      ClosePrefetchConnection();
+      mNoPrefetchConnection = &connection;
+   }
+}
+
 SqliteSampleBlock::SqliteSampleBlock(
    const std::shared_ptr<SqliteSampleBlockFactory> &pFactory)
 :  mpFactory(pFactory)
@@ -309,6 +957,10 @@ SqliteSampleBlock::~SqliteSampleBlock()
       auto &callback = mpFactory->mCallback;
       if (callback)
          GuardedCall( [&]{ callback( *this ); } );
+      if (!IsSilent())
+         mpFactory->mpCache->Erase(mBlockID);
+      if (mHashed)
+         mpFactory->ForgetHash(*this);
    }
 
    if (IsSilent()) {
@@ -377,6 +1029,15 @@ size_t SqliteSampleBlock::DoGetSamples(samplePtr dest,
                                      sampleFormat destformat,
                                      size_t sampleoffset,
                                      size_t numsamples)
+{
+   return ReadCached(dest, destformat, sampleoffset, numsamples, true);
+}
+
+size_t SqliteSampleBlock::ReadCached(samplePtr dest,
+                                     sampleFormat destformat,
+                                     size_t sampleoffset,
+                                     size_t numsamples,
+                                     bool mayFill)
 {
    if (IsSilent()) {
       auto size = SAMPLE_SIZE(destformat);
@@ -388,12 +1049,175 @@ size_t SqliteSampleBlock::DoGetSamples(samplePtr dest,
    sqlite3_stmt *stmt = Conn()->Prepare(DBConnection::GetSamples,
       "SELECT samples FROM sampleblocks WHERE blockid = ?1;");
 
-   return GetBlob(dest,
-                  destformat,
-                  stmt,
-                  mSampleFormat,
-                  sampleoffset * SAMPLE_SIZE(mSampleFormat),
-                  numsamples * SAMPLE_SIZE(mSampleFormat)) / SAMPLE_SIZE(mSampleFormat);
+   if (!mValid)
+   {
+      Load(mBlockID);
+   }
+
+   auto &cache = *mpFactory->mpCache;
+   if (cache.IsEnabled())
+   {
+      // Repeated reads, as in scrubbing or redrawing, don't go back to the
+      // database
+      auto data = cache.Find(mBlockID);
+      if (!data)
+      {
+         mpFactory->CountPrefetchStall(mBlockID);
+         // Playback and export read whole blocks through WaveTrackCache, in
+         // sequence, and prefetch the following ones; only such reads fill
+         // the cache, so that small reads of many blocks, as in drawing,
+         // don't evict them
+         if (mayFill && sampleoffset == 0 && numsamples >= mSampleCount)
+            data = LoadContents(stmt);
+      }
+
+      if (data)
+      {
+         const auto start = std::min(sampleoffset, mSampleCount);
+         const auto count = std::min(numsamples, mSampleCount - start);
+         const auto src = data->get() + start * SAMPLE_SIZE(mSampleFormat);
+         if (destformat == mSampleFormat)
+            // Skip the dispatch in CopySamples
+            memcpy(dest, src, count * SAMPLE_SIZE(mSampleFormat));
+         else
+            CopySamples(src, mSampleFormat, dest, destformat, count);
+         ClearSamples(dest, destformat, count, numsamples - count);
+         return numsamples;
+      }
+   }
+
+   return ReadSamples(dest,
+                      destformat,
+                      stmt,
+                      sampleoffset * SAMPLE_SIZE(mSampleFormat),
+                      numsamples * SAMPLE_SIZE(mSampleFormat))
+      / SAMPLE_SIZE(mSampleFormat);
+}
+
+auto SqliteSampleBlock::LoadContents(sqlite3_stmt *stmt) -> View
+{
+   auto contents = std::make_shared<ArrayOf<char>>(mSampleBytes);
+   ReadSamples(contents->get(),
+               mSampleFormat,
+               stmt,
+               0,
+               mSampleBytes);
+   mpFactory->mpCache->Insert(mBlockID, contents, mSampleBytes);
+   return contents;
+}
+
+auto SqliteSampleBlock::GetView() -> View
+{
+   if (IsSilent())
+      return {};
+
+   // Don't read the database to make a view, which would copy the whole block
+   auto &cache = *mpFactory->mpCache;
+   if (!cache.IsEnabled() || !cache.Contains(mBlockID))
+      return {};
+   return cache.Find(mBlockID);
+}
+
+size_t SqliteSampleBlock::ReadSamples(void *dest,
+                                      sampleFormat destformat,
+                                      sqlite3_stmt *stmt,
+                                      size_t srcoffset,
+                                      size_t srcbytes)
+{
+   if (!mValid)
+   {
+      Load(mBlockID);
+   }
+
+   unsigned long long staged = 0;
+   size_t result;
+   if (mCodec == SampleBlockCodec::Raw && mpFactory->mDirectReads)
+      result = ReadBlob(dest, destformat, srcoffset, srcbytes, staged);
+   else
+   {
+      // The statement copies the whole blob, whatever range is wanted
+      size_t blobBytes = 0;
+      result = GetBlob(dest, destformat, DBConnection::GetSamples, stmt,
+         mSampleFormat,
+         srcoffset, srcbytes, mCodec, &blobBytes);
+      staged = blobBytes;
+   }
+
+   mpFactory->mBytesStaged += staged;
+   mpFactory->mBytesDelivered +=
+      srcbytes / SAMPLE_SIZE(mSampleFormat) * SAMPLE_SIZE(destformat);
+   return result;
+}
+
+size_t SqliteSampleBlock::ReadBlob(void *dest,
+                                   sampleFormat destformat,
+                                   size_t srcoffset,
+                                   size_t srcbytes,
+                                   unsigned long long &staged)
+{
+   const auto pConn = Conn();
+   auto db = pConn->DB();
+
+   wxASSERT(!IsSilent());
+   wxASSERT(destformat == floatSample || destformat == mSampleFormat);
+
+   // The handle is kept for the thread, and only moved to this row
+   sqlite3_blob *blob = nullptr;
+   int rc = pConn->AcquireBlob(mBlockID, &blob);
+   auto cleanup = finally([&]
+   {
+      pConn->ReleaseBlob(blob, rc != SQLITE_OK);
+   });
+
+   const auto size = SAMPLE_SIZE(mSampleFormat);
+   const auto numsamples = srcbytes / size;
+   size_t available = 0;
+   if (rc == SQLITE_OK)
+   {
+      const size_t blobbytes = sqlite3_blob_bytes(blob);
+      srcoffset = std::min(srcoffset, blobbytes);
+      available = std::min(srcbytes, blobbytes - srcoffset) / size;
+
+      const auto pDest = static_cast<samplePtr>(dest);
+      if (destformat == mSampleFormat)
+         // Payload is copied once, from the pages of the database (which may
+         // be mapped into memory; see DBConnection) into dest
+         rc = sqlite3_blob_read(blob, pDest, available * size, srcoffset);
+      else
+      {
+         // Convert through a small buffer that stays in the processor cache
+         alignas(float) char buffer[16384];
+         const auto chunk = sizeof(buffer) / size;
+         const auto destsize = SAMPLE_SIZE(destformat);
+         for (size_t done = 0; rc == SQLITE_OK && done < available;)
+         {
+            const auto count = std::min(chunk, available - done);
+            rc = sqlite3_blob_read(blob, buffer, count * size,
+               srcoffset + done * size);
+            if (rc == SQLITE_OK)
+               CopySamples(buffer, mSampleFormat,
+                  pDest + done * destsize, destformat, count);
+            staged += count * size;
+            done += count;
+         }
+      }
+   }
+
+   if (rc != SQLITE_OK)
+   {
+      ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
+      ADD_EXCEPTION_CONTEXT("sqlite3.context", "SqliteSampleBlock::ReadBlob");
+
+      wxLogDebug(wxT("SqliteSampleBlock::ReadBlob - SQLITE error %s"),
+         sqlite3_errmsg(db));
+
+      Conn()->ThrowException( false );
+   }
+
+   ClearSamples(static_cast<samplePtr>(dest), destformat,
+      available, numsamples - available);
+
+   return srcbytes;
 }
 
 void SqliteSampleBlock::SetSamples(constSamplePtr src,
@@ -404,7 +1228,12 @@ void SqliteSampleBlock::SetSamples(constSamplePtr src,
    mSamples.reinit(mSampleBytes);
    memcpy(mSamples.get(), src, mSampleBytes);
 
-   CalcSummary( sizes );
+   // Summaries may be deferred until first drawn, saving their computation
+   // for blocks that are soon replaced, as during repeated edits; but a
+   // legacy file can't record that they are missing
+   mSummarized = !mpFactory->mLazySummaries || Conn()->IsLegacySchema();
+   if (mSummarized)
+      CalcSummary( sizes );
 
    Commit( sizes );
 }
@@ -436,12 +1265,30 @@ bool SqliteSampleBlock::GetSummary(float *dest,
    if (!silent) {
       // Not a silent block
       try {
+         EnsureSummaries();
+         if (!mSummarized) {
+            // Computed, but not stored
+            const auto sizes = SetSizes(mSampleCount, mSampleFormat);
+            const bool is256 = (id == DBConnection::GetSummary256);
+            const auto &summary = is256 ? mSummary256 : mSummary64k;
+            const size_t bytes = is256 ? sizes.first : sizes.second;
+            const size_t offset = frameoffset * bytesPerFrame;
+            const size_t copied = offset < bytes
+               ? std::min(bytes - offset, numframes * bytesPerFrame)
+               : 0;
+            memcpy(dest, summary.get() + offset, copied);
+            memset((char*)dest + copied, 0,
+               numframes * bytesPerFrame - copied);
+            return true;
+         }
+
          // Prepare and cache statement...automatically finalized at DB close
          auto stmt = Conn()->Prepare(id, sql);
          // Note GetBlob returns a size_t, not a bool
          // REVIEW: An error in GetBlob() will throw an exception.
          GetBlob(dest,
                      floatSample,
+                     id,
                      stmt,
                      floatSample,
                      frameoffset * fields * SAMPLE_SIZE(floatSample),
@@ -481,9 +1328,7 @@ MinMaxRMS SqliteSampleBlock::DoGetMinMaxRMS(size_t start, size_t len)
    if (IsSilent())
       return {};
 
-   float min = FLT_MAX;
-   float max = -FLT_MAX;
-   float sumsq = 0;
+   SummaryKernels::Result result;
 
    if (!mValid)
    {
@@ -495,29 +1340,15 @@ MinMaxRMS SqliteSampleBlock::DoGetMinMaxRMS(size_t start, size_t len)
       len = std::min(len, mSampleCount - start);
 
       // TODO: actually use summaries
-      SampleBuffer blockData(len, floatSample);
-      float *samples = (float *) blockData.ptr();
-
-      size_t copied = DoGetSamples((samplePtr) samples, floatSample, start, len);
-      for (size_t i = 0; i < copied; ++i, ++samples)
-      {
-         float sample = *samples;
+      // Read in the stored format, which the kernels take without conversion
+      SampleBuffer blockData(len, mSampleFormat);
 
-         if (sample > max)
-         {
-            max = sample;
-         }
-
-         if (sample < min)
-         {
-            min = sample;
-         }
-
-         sumsq += (sample * sample);
-      }
+      size_t copied =
+         ReadCached(blockData.ptr(), mSampleFormat, start, len, false);
+      result = SummaryKernels::Compute(blockData.ptr(), mSampleFormat, copied);
    }
 
-   return { min, max, (float) sqrt(sumsq / len) };
+   return { result.min, result.max, (float) sqrt(result.sumsq / len) };
 }
 
 /// Retrieves the minimum, maximum, and maximum RMS of this entire
@@ -525,6 +1356,10 @@ MinMaxRMS SqliteSampleBlock::DoGetMinMaxRMS(size_t start, size_t len)
 /// these values are already computed.
 MinMaxRMS SqliteSampleBlock::DoGetMinMaxRMS() const
 {
+   if (!mSummarized && !mSummary256)
+      // Computing deferred summaries does not change the contents, so
+      // this remains logically const
+      const_cast<SqliteSampleBlock*>(this)->EnsureSummaries();
    return { (float) mSumMin, (float) mSumMax, (float) mSumRms };
 }
 
@@ -538,10 +1373,13 @@ size_t SqliteSampleBlock::GetSpaceUsage() const
 
 size_t SqliteSampleBlock::GetBlob(void *dest,
                                   sampleFormat destformat,
+                                  DBConnection::StatementID id,
                                   sqlite3_stmt *stmt,
                                   sampleFormat srcformat,
                                   size_t srcoffset,
-                                  size_t srcbytes)
+                                  size_t srcbytes,
+                                  SampleBlockCodec::ID codec,
+                                  size_t *pBlobBytes)
 {
    auto db = DB();
 
@@ -568,7 +1406,7 @@ size_t SqliteSampleBlock::GetBlob(void *dest,
    }
 
    // Execute the statement
-   rc = sqlite3_step(stmt);
+   rc = Conn()->Step(id, stmt);
    if (rc != SQLITE_ROW)
    {
       ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
@@ -595,6 +1433,32 @@ size_t SqliteSampleBlock::GetBlob(void *dest,
    // Retrieve returned data
    samplePtr src = (samplePtr) sqlite3_column_blob(stmt, 0);
    size_t blobbytes = (size_t) sqlite3_column_bytes(stmt, 0);
+   if (pBlobBytes)
+      *pBlobBytes = blobbytes;
+
+   if (codec != SampleBlockCodec::Raw)
+   {
+      // Decode straight from the statement's copy of the blob into dest,
+      // without first reconstructing the whole block
+      wxASSERT(destformat == floatSample || destformat == srcformat);
+      const auto size = SAMPLE_SIZE(srcformat);
+      const auto destsize = SAMPLE_SIZE(destformat);
+      const auto numsamples = srcbytes / size;
+      const auto decoded = SampleBlockCodec::Decode(src, blobbytes, srcformat,
+         (samplePtr) dest, destformat, srcoffset / size, numsamples);
+
+      if (numsamples - decoded)
+      {
+         memset((samplePtr) dest + decoded * destsize, 0,
+            (numsamples - decoded) * destsize);
+      }
+
+      // Clear statement bindings and rewind statement
+      sqlite3_clear_bindings(stmt);
+      sqlite3_reset(stmt);
+
+      return srcbytes;
+   }
 
    srcoffset = std::min(srcoffset, blobbytes);
    minbytes = std::min(srcbytes, blobbytes - srcoffset);
@@ -677,7 +1541,7 @@ void SqliteSampleBlock::Load(SampleBlockID sbid)
    // Prepare and cache statement...automatically finalized at DB close
    sqlite3_stmt *stmt = Conn()->Prepare(DBConnection::LoadSampleBlock,
       "SELECT sampleformat, summin, summax, sumrms,"
-      "       length(samples)"
+      "       length(samples), codec, summaries, hash"
       "  FROM sampleblocks WHERE blockid = ?1;");
 
    // Bind statement parameters
@@ -693,7 +1557,7 @@ void SqliteSampleBlock::Load(SampleBlockID sbid)
    }
 
    // Execute the statement
-   rc = sqlite3_step(stmt);
+   rc = Conn()->Step(DBConnection::LoadSampleBlock, stmt);
    if (rc != SQLITE_ROW)
    {
 
@@ -719,15 +1583,58 @@ void SqliteSampleBlock::Load(SampleBlockID sbid)
    mSumMax = sqlite3_column_double(stmt, 2);
    mSumRms = sqlite3_column_double(stmt, 3);
    mSampleBytes = sqlite3_column_int(stmt, 4);
+   mCodec = (SampleBlockCodec::ID) sqlite3_column_int(stmt, 5);
+   mSummarized = (sqlite3_column_int(stmt, 6) != 0);
+   mHashed = (sqlite3_column_type(stmt, 7) != SQLITE_NULL);
+   mHash = mHashed ? uint64_t(sqlite3_column_int64(stmt, 7)) : 0;
    mSampleCount = mSampleBytes / SAMPLE_SIZE(mSampleFormat);
 
    // Clear statement bindings and rewind statement
    sqlite3_clear_bindings(stmt);
    sqlite3_reset(stmt);
 
+   if (mCodec != SampleBlockCodec::Raw)
+   {
+      // The length of the blob is not the length of the samples; read only
+      // the header of the encoding, not the whole blob
+      mSampleCount = ReadEncodedSampleCount();
+      mSampleBytes = mSampleCount * SAMPLE_SIZE(mSampleFormat);
+   }
+
    mValid = true;
 }
 
+size_t SqliteSampleBlock::ReadEncodedSampleCount()
+{
+   const auto pConn = Conn();
+   auto db = pConn->DB();
+
+   ArrayOf<char> header{ SampleBlockCodec::HeaderBytes() };
+   sqlite3_blob *blob = nullptr;
+   int rc = pConn->AcquireBlob(mBlockID, &blob);
+   auto cleanup = finally([&]
+   {
+      pConn->ReleaseBlob(blob, rc != SQLITE_OK);
+   });
+   if (rc == SQLITE_OK)
+      rc = sqlite3_blob_read(blob, header.get(),
+         SampleBlockCodec::HeaderBytes(), 0);
+   if (rc != SQLITE_OK)
+   {
+      ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
+      ADD_EXCEPTION_CONTEXT("sqlite3.context",
+         "SqliteSampleBlock::ReadEncodedSampleCount");
+
+      wxLogDebug(wxT("SqliteSampleBlock::ReadEncodedSampleCount - SQLITE error %s"),
+         sqlite3_errmsg(db));
+
+      Conn()->ThrowException( false );
+   }
+
+   return SampleBlockCodec::DecodedSampleCount(
+      header.get(), SampleBlockCodec::HeaderBytes());
+}
+
 void SqliteSampleBlock::Commit(Sizes sizes)
 {
    const auto mSummary256Bytes = sizes.first;
@@ -736,22 +1643,65 @@ void SqliteSampleBlock::Commit(Sizes sizes)
    auto db = DB();
    int rc;
 
+   // A legacy file stores only raw samples and no digests
+   const bool legacy = Conn()->IsLegacySchema();
+
+   // Compress the samples if enabled and worthwhile
+   std::vector<unsigned char> encoded;
+   const void *samples = mSamples.get();
+   size_t samplesBytes = mSampleBytes;
+   mCodec = SampleBlockCodec::Raw;
+   if (mpFactory->mCompress && !legacy &&
+       SampleBlockCodec::Encode(
+         mSamples.get(), mSampleFormat, mSampleCount, encoded))
+   {
+      mCodec = SampleBlockCodec::FixedPredictorRice;
+      samples = encoded.data();
+      samplesBytes = encoded.size();
+   }
+
+   mpFactory->BatchBeforeInsert( *Conn() );
+
    // Prepare and cache statement...automatically finalized at DB close
-   sqlite3_stmt *stmt = Conn()->Prepare(DBConnection::InsertSampleBlock,
-      "INSERT INTO sampleblocks (sampleformat, summin, summax, sumrms,"
-      "                          summary256, summary64k, samples)"
-      "                         VALUES(?1,?2,?3,?4,?5,?6,?7);");
+   const auto statementID = legacy
+      ? DBConnection::InsertLegacySampleBlock
+      : DBConnection::InsertSampleBlock;
+   sqlite3_stmt *stmt = legacy
+      ? Conn()->Prepare(statementID,
+         "INSERT INTO main.sampleblocks (sampleformat, summin, summax, sumrms,"
+         "                               summary256, summary64k, samples)"
+         "                              VALUES(?1,?2,?3,?4,?5,?6,?7);")
+      : Conn()->Prepare(statementID,
+         "INSERT INTO sampleblocks (sampleformat, summin, summax, sumrms,"
+         "                          summary256, summary64k, samples, codec,"
+         "                          summaries, hash, checksum)"
+         "                         VALUES(?1,?2,?3,?4,?5,?6,?7,?8,?9,?10,?11);");
 
    // Bind statement parameters
    // Might return SQLITE_MISUSE which means it's our mistake that we violated
    // preconditions; should return SQL_OK which is 0
+   // Deferred summaries are left null
    if (sqlite3_bind_int(stmt, 1, mSampleFormat) ||
-       sqlite3_bind_double(stmt, 2, mSumMin) ||
-       sqlite3_bind_double(stmt, 3, mSumMax) ||
-       sqlite3_bind_double(stmt, 4, mSumRms) ||
-       sqlite3_bind_blob(stmt, 5, mSummary256.get(), mSummary256Bytes, SQLITE_STATIC) ||
-       sqlite3_bind_blob(stmt, 6, mSummary64k.get(), mSummary64kBytes, SQLITE_STATIC) ||
-       sqlite3_bind_blob(stmt, 7, mSamples.get(), mSampleBytes, SQLITE_STATIC))
+       (mSummarized
+          ? (sqlite3_bind_double(stmt, 2, mSumMin) ||
+             sqlite3_bind_double(stmt, 3, mSumMax) ||
+             sqlite3_bind_double(stmt, 4, mSumRms) ||
+             sqlite3_bind_blob(stmt, 5, mSummary256.get(), mSummary256Bytes, SQLITE_STATIC) ||
+             sqlite3_bind_blob(stmt, 6, mSummary64k.get(), mSummary64kBytes, SQLITE_STATIC))
+          : (sqlite3_bind_null(stmt, 2) ||
+             sqlite3_bind_null(stmt, 3) ||
+             sqlite3_bind_null(stmt, 4) ||
+             sqlite3_bind_null(stmt, 5) ||
+             sqlite3_bind_null(stmt, 6))) ||
+       sqlite3_bind_blob(stmt, 7, samples, samplesBytes, SQLITE_STATIC) ||
+       (!legacy &&
+          (sqlite3_bind_int(stmt, 8, mCodec) ||
+           sqlite3_bind_int(stmt, 9, mSummarized ? 1 : 0) ||
+           (mHashed
+              ? sqlite3_bind_int64(stmt, 10, sqlite3_int64(mHash))
+              : sqlite3_bind_null(stmt, 10)) ||
+           sqlite3_bind_int64(stmt, 11, sqlite3_int64(
+              SampleBlockCodec::Checksum(samples, samplesBytes))))))
    {
 
       ADD_EXCEPTION_CONTEXT(
@@ -763,7 +1713,7 @@ void SqliteSampleBlock::Commit(Sizes sizes)
    }
  
    // Execute the statement
-   rc = sqlite3_step(stmt);
+   rc = Conn()->Step(statementID, stmt);
    if (rc != SQLITE_DONE)
    {
       ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
@@ -783,6 +1733,8 @@ void SqliteSampleBlock::Commit(Sizes sizes)
    // Retrieve returned data
    mBlockID = sqlite3_last_insert_rowid(db);
 
+   mpFactory->BatchAfterInsert( samplesBytes );
+
    // Reset local arrays
    mSamples.reset();
    mSummary256.reset();
@@ -804,7 +1756,7 @@ void SqliteSampleBlock::Delete()
 
    // Prepare and cache statement...automatically finalized at DB close
    sqlite3_stmt *stmt = Conn()->Prepare(DBConnection::DeleteSampleBlock,
-      "DELETE FROM sampleblocks WHERE blockid = ?1;");
+      "DELETE FROM main.sampleblocks WHERE blockid = ?1;");
 
    // Bind statement parameters
    // Might return SQLITE_MISUSE which means it's our mistake that we violated
@@ -819,7 +1771,7 @@ void SqliteSampleBlock::Delete()
    }
 
    // Execute the statement
-   rc = sqlite3_step(stmt);
+   rc = Conn()->Step(DBConnection::DeleteSampleBlock, stmt);
    if (rc != SQLITE_DONE)
    {
       ADD_EXCEPTION_CONTEXT("sqlite3.rc", std::to_string(rc));
@@ -868,21 +1820,10 @@ void SqliteSampleBlock::CalcSummary(Sizes sizes)
    const auto mSummary256Bytes = sizes.first;
    const auto mSummary64kBytes = sizes.second;
 
-   Floats samplebuffer;
-   float *samples;
+   // The kernels read samples of any format without converting them first
+   constSamplePtr samples = mSamples.get();
+   const auto sampleSize = SAMPLE_SIZE(mSampleFormat);
 
-   if (mSampleFormat == floatSample)
-   {
-      samples = (float *) mSamples.get();
-   }
-   else
-   {
-      samplebuffer.reinit((unsigned) mSampleCount);
-      SamplesToFloats(mSamples.get(), mSampleFormat,
-         samplebuffer.get(), mSampleCount);
-      samples = samplebuffer.get();
-   }
-   
    mSummary256.reinit(mSummary256Bytes);
    mSummary64k.reinit(mSummary64kBytes);
 
@@ -901,10 +1842,6 @@ void SqliteSampleBlock::CalcSummary(Sizes sizes)
 
    for (int i = 0; i < sumLen; ++i)
    {
-      min = samples[i * 256];
-      max = samples[i * 256];
-      sumsq = min * min;
-
       int jcount = 256;
       if (jcount > mSampleCount - i * 256)
       {
@@ -912,27 +1849,15 @@ void SqliteSampleBlock::CalcSummary(Sizes sizes)
          fraction = 1.0 - (jcount / 256.0);
       }
 
-      for (int j = 1; j < jcount; ++j)
-      {
-         float f1 = samples[i * 256 + j];
-         sumsq += f1 * f1;
-
-         if (f1 < min)
-         {
-            min = f1;
-         }
-         else if (f1 > max)
-         {
-            max = f1;
-         }
-      }
+      const auto result = SummaryKernels::Compute(
+         samples + i * 256 * sampleSize, mSampleFormat, jcount);
 
-      totalSquares += sumsq;
+      totalSquares += result.sumsq;
 
-      summary256[i * fields] = min;
-      summary256[i * fields + 1] = max;
+      summary256[i * fields] = result.min;
+      summary256[i * fields + 1] = result.max;
       // The rms is correct, but this may be for less than 256 samples in last loop.
-      summary256[i * fields + 2] = (float) sqrt(sumsq / jcount);
+      summary256[i * fields + 2] = (float) sqrt(result.sumsq / jcount);
    }
 
    for (int i = sumLen, frames256 = mSummary256Bytes / bytesPerFrame;
@@ -1016,6 +1941,72 @@ void SqliteSampleBlock::CalcSummary(Sizes sizes)
    mSumMax = max;
 }
 
+void SqliteSampleBlock::EnsureSummaries()
+{
+   if (IsSilent())
+      return;
+
+   if (!mValid)
+      Load(mBlockID);
+
+   if (mSummarized || mSummary256)
+      return;
+
+   const auto sizes = SetSizes(mSampleCount, mSampleFormat);
+   mSamples.reinit(mSampleBytes);
+   auto cleanup = finally([this]{ mSamples.reset(); });
+   // A one-time read, which should not displace blocks in the cache
+   ReadCached(mSamples.get(), mSampleFormat, 0, mSampleCount, false);
+   CalcSummary(sizes);
+
+   // Store the summaries, so that they are not computed again when the
+   // project is reopened; keep them in memory only if that fails
+   if (StoreSummaries(sizes)) {
+      mSummarized = true;
+      mSummary256.reset();
+      mSummary64k.reset();
+   }
+}
+
+bool SqliteSampleBlock::StoreSummaries(Sizes sizes)
+{
+   try {
+      auto db = DB();
+
+      // Prepare and cache statement...automatically finalized at DB close
+      sqlite3_stmt *stmt = Conn()->Prepare(
+         DBConnection::UpdateSampleBlockSummaries,
+         "UPDATE sampleblocks SET summin = ?1, summax = ?2, sumrms = ?3,"
+         "                        summary256 = ?4, summary64k = ?5,"
+         "                        summaries = 1"
+         "  WHERE blockid = ?6;");
+
+      int rc;
+      if ((rc = sqlite3_bind_double(stmt, 1, mSumMin)) ||
+          (rc = sqlite3_bind_double(stmt, 2, mSumMax)) ||
+          (rc = sqlite3_bind_double(stmt, 3, mSumRms)) ||
+          (rc = sqlite3_bind_blob(stmt, 4, mSummary256.get(), sizes.first, SQLITE_STATIC)) ||
+          (rc = sqlite3_bind_blob(stmt, 5, mSummary64k.get(), sizes.second, SQLITE_STATIC)) ||
+          (rc = sqlite3_bind_int64(stmt, 6, mBlockID)))
+         wxASSERT_MSG(false, wxT("Binding failed...bug!!!"));
+      else
+         rc = Conn()->Step(DBConnection::UpdateSampleBlockSummaries, stmt);
+
+      if (rc != SQLITE_DONE)
+         wxLogDebug(wxT("SqliteSampleBlock::StoreSummaries - SQLITE error %s"),
+            sqlite3_errmsg(db));
+
+      // Clear statement bindings and rewind statement
+      sqlite3_clear_bindings(stmt);
+      sqlite3_reset(stmt);
+
+      return rc == SQLITE_DONE;
+   }
+   catch ( const AudacityException & ) {
+      return false;
+   }
+}
+
 // Inject our database implementation at startup
 static struct Injector
 {
@@ -124,6 +124,7 @@ WaveClip::WaveClip(const SampleBlockFactoryPtr &factory,
    mRate = rate;
    mColourIndex = colourIndex;
    mSequence = std::make_unique<Sequence>(factory, format);
+   mSequence->SetRateHint(rate);
 
    mEnvelope = std::make_unique<Envelope>(true, 1e-7, 2.0, 1.0);
 
@@ -220,9 +221,15 @@ void WaveClip::SetOffset(double offset)
 }
 
 bool WaveClip::GetSamples(samplePtr buffer, sampleFormat format,
-                   sampleCount start, size_t len, bool mayThrow) const
+                   sampleCount start, size_t len, bool mayThrow,
+                   BlockCursor *pCursor) const
 {
-   return mSequence->Get(buffer, format, start, len, mayThrow);
+   return mSequence->Get(buffer, format, start, len, mayThrow, pCursor);
+}
+
+void WaveClip::Prefetch(sampleCount start, sampleCount len) const
+{
+   mSequence->Prefetch(start, len);
 }
 
 /*! @excsafety{Strong} */
@@ -1673,6 +1680,7 @@ void WaveClip::CloseLock()
 void WaveClip::SetRate(int rate)
 {
    mRate = rate;
+   mSequence->SetRateHint(rate);
    auto newLength = mSequence->GetNumSamples().as_double() / mRate;
    mEnvelope->RescaleTimes( newLength );
    MarkChanged();
@@ -1700,6 +1708,7 @@ void WaveClip::Resample(int rate, ProgressDialog *progress)
 
    auto newSequence =
       std::make_unique<Sequence>(mSequence->GetFactory(), mSequence->GetSampleFormat());
+   newSequence->SetRateHint(rate);
 
    /**
     * We want to keep going as long as we have something to feed the resampler
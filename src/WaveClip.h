@@ -23,6 +23,7 @@
 #include <functional>
 
 class BlockArray;
+class BlockCursor;
 class Envelope;
 class ProgressDialog;
 class sampleCount;
@@ -235,8 +236,12 @@ public:
    bool AfterClip(double t) const;
    bool IsClipStartAfterClip(double t) const;
 
+   //! @param pCursor see Sequence::Get()
    bool GetSamples(samplePtr buffer, sampleFormat format,
-                   sampleCount start, size_t len, bool mayThrow = true) const;
+                   sampleCount start, size_t len, bool mayThrow = true,
+                   BlockCursor *pCursor = nullptr) const;
+   //! Hint that samples will soon be read; start is relative to the clip
+   void Prefetch(sampleCount start, sampleCount len) const;
    void SetSamples(constSamplePtr buffer, sampleFormat format,
                    sampleCount start, size_t len);
 
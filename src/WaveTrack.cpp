@@ -59,6 +59,7 @@ from the project that will own the track.
 #include "prefs/WaveformSettings.h"
 
 #include "InconsistencyException.h"
+#include "WorkerPool.h"
 
 #include "tracks/ui/TrackView.h"
 #include "tracks/ui/TrackControls.h"
@@ -1635,20 +1636,23 @@ bool WaveTrack::Append(constSamplePtr buffer, sampleFormat format,
    return RightmostOrNewClip()->Append(buffer, format, len, stride);
 }
 
-sampleCount WaveTrack::GetBlockStart(sampleCount s) const
+sampleCount WaveTrack::GetBlockStart(sampleCount s,
+   BlockCursor *pCursor) const
 {
    for (const auto &clip : mClips)
    {
       const auto startSample = (sampleCount)floor(0.5 + clip->GetStartTime()*mRate);
       const auto endSample = startSample + clip->GetNumSamples();
       if (s >= startSample && s < endSample)
-         return startSample + clip->GetSequence()->GetBlockStart(s - startSample);
+         return startSample +
+            clip->GetSequence()->GetBlockStart(s - startSample, pCursor);
    }
 
    return -1;
 }
 
-size_t WaveTrack::GetBestBlockSize(sampleCount s) const
+size_t WaveTrack::GetBestBlockSize(sampleCount s,
+   BlockCursor *pCursor) const
 {
    auto bestBlockSize = GetMaxBlockSize();
 
@@ -1658,7 +1662,8 @@ size_t WaveTrack::GetBestBlockSize(sampleCount s) const
       auto endSample = startSample + clip->GetNumSamples();
       if (s >= startSample && s < endSample)
       {
-         bestBlockSize = clip->GetSequence()->GetBestBlockSize(s - startSample);
+         bestBlockSize =
+            clip->GetSequence()->GetBestBlockSize(s - startSample, pCursor);
          break;
       }
    }
@@ -1992,7 +1997,8 @@ float WaveTrack::GetRMS(double t0, double t1, bool mayThrow) const
 
 bool WaveTrack::Get(samplePtr buffer, sampleFormat format,
                     sampleCount start, size_t len, fillFormat fill,
-                    bool mayThrow, sampleCount * pNumWithinClips) const
+                    bool mayThrow, sampleCount * pNumWithinClips,
+                    BlockCursor *pCursor) const
 {
    // Simple optimization: When this buffer is completely contained within one clip,
    // don't clear anything (because we won't have to). Otherwise, just clear
@@ -2061,7 +2067,8 @@ bool WaveTrack::Get(samplePtr buffer, sampleFormat format,
                (samplePtr)(((char*)buffer) +
                            startDelta.as_size_t() *
                            SAMPLE_SIZE(format)),
-               format, inclipDelta, samplesToCopy.as_size_t(), mayThrow ))
+               format, inclipDelta, samplesToCopy.as_size_t(), mayThrow,
+               pCursor ))
             result = false;
          else
             samplesCopied += samplesToCopy;
@@ -2620,6 +2627,19 @@ void WaveTrack::ClearWaveCaches()
       clip->ClearWaveCache();
 }
 
+void WaveTrack::Prefetch(sampleCount start, sampleCount len) const
+{
+   // Iterate the clips.  They are not necessarily sorted by time.
+   for (const auto &clip: mClips)
+   {
+      auto clipStart = clip->GetStartSample();
+      auto clipEnd = clip->GetEndSample();
+
+      if (clipEnd > start && clipStart < start + len)
+         clip->Prefetch(start - clipStart, len);
+   }
+}
+
 WaveTrackCache::~WaveTrackCache()
 {
 }
@@ -2640,9 +2660,29 @@ void WaveTrackCache::SetTrack(const std::shared_ptr<const WaveTrack> &pTrack)
          Free();
       mPTrack = pTrack;
       mNValidBuffers = 0;
+      mPrefetchEnd = 0;
+      mCursor.Reset();
    }
 }
 
+void WaveTrackCache::Prefetch()
+{
+   // How many buffers' worth to read ahead of the buffers
+   constexpr size_t PrefetchBuffers = 2;
+
+   if (mNValidBuffers < 1)
+      return;
+   const auto end = mBuffers[mNValidBuffers - 1].end();
+   const auto len = sampleCount(PrefetchBuffers * mBufferSize);
+   if (end + len >= mPrefetchEnd &&
+       end + sampleCount(mBufferSize) <= mPrefetchEnd)
+      // Still at least a buffer ahead since the last request, and there was
+      // no seek backwards
+      return;
+   mPTrack->Prefetch(end, len);
+   mPrefetchEnd = end + len;
+}
+
 const float *WaveTrackCache::GetFloats(
    sampleCount start, size_t len, bool mayThrow)
 {
@@ -2691,13 +2731,13 @@ const float *WaveTrackCache::GetFloats(
 
       // Refill buffers as needed
       if (fillFirst) {
-         const auto start0 = mPTrack->GetBlockStart(start);
+         const auto start0 = mPTrack->GetBlockStart(start, &mCursor);
          if (start0 >= 0) {
-            const auto len0 = mPTrack->GetBestBlockSize(start0);
+            const auto len0 = mPTrack->GetBestBlockSize(start0, &mCursor);
             wxASSERT(len0 <= mBufferSize);
             if (!mPTrack->GetFloats(
                   mBuffers[0].data.get(), start0, len0,
-                  fillZero, mayThrow))
+                  fillZero, mayThrow, nullptr, &mCursor))
                return nullptr;
             mBuffers[0].start = start0;
             mBuffers[0].len = len0;
@@ -2719,11 +2759,12 @@ const float *WaveTrackCache::GetFloats(
          mNValidBuffers = 1;
          const auto end0 = mBuffers[0].end();
          if (end > end0) {
-            const auto start1 = mPTrack->GetBlockStart(end0);
+            const auto start1 = mPTrack->GetBlockStart(end0, &mCursor);
             if (start1 == end0) {
-               const auto len1 = mPTrack->GetBestBlockSize(start1);
+               const auto len1 = mPTrack->GetBestBlockSize(start1, &mCursor);
                wxASSERT(len1 <= mBufferSize);
-               if (!mPTrack->GetFloats(mBuffers[1].data.get(), start1, len1, fillZero, mayThrow))
+               if (!mPTrack->GetFloats(mBuffers[1].data.get(), start1, len1,
+                     fillZero, mayThrow, nullptr, &mCursor))
                   return nullptr;
                mBuffers[1].start = start1;
                mBuffers[1].len = len1;
@@ -2733,6 +2774,11 @@ const float *WaveTrackCache::GetFloats(
       }
       wxASSERT(mNValidBuffers < 2 || mBuffers[0].end() == mBuffers[1].start);
 
+      if (fillFirst || fillSecond)
+         // Sequential consumers such as playback and export will want the
+         // following blocks next
+         Prefetch();
+
       samplePtr buffer = nullptr; // will point into mOverlapBuffer
       auto remaining = len;
 
@@ -2823,6 +2869,51 @@ const float *WaveTrackCache::GetFloats(
    }
 }
 
+bool WaveTrackCache::Holds(sampleCount start, size_t len) const
+{
+   return mNValidBuffers > 0 &&
+      start >= mBuffers[0].start &&
+      start + len <= mBuffers[mNValidBuffers - 1].end();
+}
+
+bool WaveTrackCache::GetFloats(WaveTrackCache caches[], size_t nCaches,
+   const sampleCount starts[], const size_t lens[], const float *results[],
+   bool mayThrow)
+{
+   // Which caches must read their tracks
+   std::vector<size_t> misses;
+   for (size_t ii = 0; ii < nCaches; ++ii) {
+      auto &cache = caches[ii];
+      const auto len = lens[ii];
+      if (len > 0 && cache.mPTrack && !cache.Holds(starts[ii], len)) {
+         misses.push_back(ii);
+         // Request the blocks of all tracks before reading any, so that
+         // the factories can queue them together
+         cache.mPTrack->Prefetch(starts[ii], std::max<sampleCount>(len,
+            sampleCount(2 * cache.mBufferSize)));
+      }
+   }
+
+   // Fill those caches in parallel; then the rest take little time
+   WorkerPool::Get().Run(misses.size(), [&](size_t jj){
+      const auto ii = misses[jj];
+      results[ii] = caches[ii].GetFloats(starts[ii], lens[ii], mayThrow);
+   });
+   bool result = true;
+   for (size_t ii = 0, jj = 0; ii < nCaches; ++ii) {
+      if (jj < misses.size() && misses[jj] == ii)
+         ++jj;
+      else if (lens[ii] == 0) {
+         results[ii] = nullptr;
+         continue;
+      }
+      else
+         results[ii] = caches[ii].GetFloats(starts[ii], lens[ii], mayThrow);
+      result = result && results[ii];
+   }
+   return result;
+}
+
 void WaveTrackCache::Free()
 {
    mBuffers[0].Free();
@@ -19,6 +19,7 @@
 #include <wx/longlong.h>
 
 #include "WaveTrackLocation.h"
+#include "BlockCursor.h"
 
 class ProgressDialog;
 
@@ -261,14 +262,16 @@ private:
     @param mayThrow if false, fill buffer with zeros when there is failure to retrieve samples; else throw
     @param[out] pNumWithinClips Report how many samples were copied from within clips, rather
        than filled according to fillFormat; but these were not necessarily one contiguous range.
+    @param pCursor if not null, lets sequential reads skip the search for their first block
     */
    bool GetFloats(float *buffer, sampleCount start, size_t len,
       fillFormat fill = fillZero, bool mayThrow = true,
-      sampleCount * pNumWithinClips = nullptr) const
+      sampleCount * pNumWithinClips = nullptr,
+      BlockCursor *pCursor = nullptr) const
    {
       //! Cast the pointer to pass it to Get() which handles multiple destination formats
       return Get(reinterpret_cast<samplePtr>(buffer),
-         floatSample, start, len, fill, mayThrow, pNumWithinClips);
+         floatSample, start, len, fill, mayThrow, pNumWithinClips, pCursor);
    }
 
    //! Retrieve samples from a track in a specified format
@@ -283,11 +286,16 @@ private:
       // Report how many samples were copied from within clips, rather than
       // filled according to fillFormat; but these were not necessarily one
       // contiguous range.
-      sampleCount * pNumWithinClips = nullptr) const;
+      sampleCount * pNumWithinClips = nullptr,
+      BlockCursor *pCursor = nullptr) const;
 
    void Set(constSamplePtr buffer, sampleFormat format,
                    sampleCount start, size_t len);
 
+   //! Hint that samples in the range will soon be read, as by playback
+   /*! Does not wait for any reads */
+   void Prefetch(sampleCount start, sampleCount len) const;
+
    // Fetch envelope values corresponding to uniformly separated sample times
    // starting at the given time.
    void GetEnvelopeValues(double *buffer, size_t bufferLen,
@@ -317,10 +325,13 @@ private:
    //
 
    // This returns a possibly large or negative value
-   sampleCount GetBlockStart(sampleCount t) const;
+   //! @param pCursor if not null, lets sequential calls skip searches
+   sampleCount GetBlockStart(sampleCount t,
+      BlockCursor *pCursor = nullptr) const;
 
    // These return a nonnegative number of samples meant to size a memory buffer
-   size_t GetBestBlockSize(sampleCount t) const;
+   size_t GetBestBlockSize(sampleCount t,
+      BlockCursor *pCursor = nullptr) const;
    size_t GetMaxBlockSize() const;
    size_t GetIdealBlockSize();
 
@@ -657,9 +668,25 @@ public:
    */
    const float *GetFloats(sampleCount start, size_t len, bool mayThrow);
 
+   //! Retrieve samples as floats from many tracks in one call
+   /*! Has the effect of results[ii] = caches[ii].GetFloats(starts[ii],
+    lens[ii], mayThrow) for each ii below nCaches, or of results[ii] = null
+    where lens[ii] is zero.  But the block reads of all tracks
+    are requested of the sample block factories before any is made, and
+    then the caches that must read are filled on several threads.
+    The caches must hold distinct tracks.
+    @return false if any result for a nonzero length is null
+   */
+   static bool GetFloats(WaveTrackCache caches[], size_t nCaches,
+      const sampleCount starts[], const size_t lens[], const float *results[],
+      bool mayThrow);
+
 private:
    void Free();
 
+   //! Whether GetFloats(start, len) will not read the track
+   bool Holds(sampleCount start, size_t len) const;
+
    struct Buffer {
       Floats data;
       sampleCount start;
@@ -677,11 +704,17 @@ private:
       }
    };
 
+   //! Ask the track to read ahead, if the buffers have moved forward
+   void Prefetch();
+
    std::shared_ptr<const WaveTrack> mPTrack;
    size_t mBufferSize;
    Buffer mBuffers[2];
    GrowableSampleBuffer mOverlapBuffer;
    int mNValidBuffers;
+   //! End of the range already passed to WaveTrack::Prefetch
+   sampleCount mPrefetchEnd{ 0 };
+   BlockCursor mCursor;
 };
 
 #include <unordered_set>
@@ -0,0 +1,150 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file WorkerPool.cpp
+@brief Implements WorkerPool
+
+**********************************************************************/
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <exception>
+
+struct WorkerPool::Job
+{
+   Job( size_t count_, const Task &task_ )
+      : count{ count_ }, task{ task_ }
+   {}
+
+   //! Call the task for unclaimed indices until there are none, or until
+   //! *pUrgent becomes nonzero
+   void Work( const std::atomic<size_t> *pUrgent = nullptr )
+   {
+      size_t done = 0;
+      for (size_t ii; (ii = next++) < count;) {
+         try { task(ii); }
+         catch ( ... ) {
+            std::lock_guard<std::mutex> guard{ mutex };
+            if (!exception)
+               exception = std::current_exception();
+         }
+         ++done;
+         // The remaining indices are left for other threads, and at least
+         // for the caller of Run()
+         if (pUrgent && pUrgent->load( std::memory_order_relaxed ) > 0)
+            break;
+      }
+      if (done > 0) {
+         std::lock_guard<std::mutex> guard{ mutex };
+         if ((finished += done) == count)
+            condition.notify_all();
+      }
+   }
+
+   bool Exhausted() const { return next >= count; }
+
+   const size_t count;
+   //! Used only while some index remains unfinished, and so outlived by
+   //! the caller of Run()
+   const Task &task;
+   std::atomic<size_t> next{ 0 };
+
+   std::mutex mutex;
+   std::condition_variable condition;
+   size_t finished{ 0 };
+   std::exception_ptr exception;
+};
+
+WorkerPool &WorkerPool::Get()
+{
+   // Leave a core for the thread that calls Run()
+   static WorkerPool pool{ std::min( 7u,
+      std::max( 1u, std::thread::hardware_concurrency() ) - 1 ) };
+   return pool;
+}
+
+WorkerPool::WorkerPool( size_t nWorkers )
+{
+   mThreads.reserve( nWorkers );
+   for (size_t ii = 0; ii < nWorkers; ++ii)
+      mThreads.emplace_back( [this]{ Work(); } );
+}
+
+WorkerPool::~WorkerPool()
+{
+   {
+      std::lock_guard<std::mutex> guard{ mMutex };
+      mStop = true;
+   }
+   mCondition.notify_all();
+   for (auto &thread : mThreads)
+      thread.join();
+}
+
+void WorkerPool::Run( size_t count, const Task &task, Priority priority )
+{
+   if (count == 0)
+      return;
+   if (count == 1 || mThreads.empty()) {
+      Job job{ count, task };
+      job.Work();
+      if (job.exception)
+         std::rethrow_exception( job.exception );
+      return;
+   }
+
+   const bool urgent = (priority == Priority::Urgent);
+   auto &jobs = urgent ? mUrgentJobs : mJobs;
+   auto pJob = std::make_shared<Job>( count, task );
+   {
+      std::lock_guard<std::mutex> guard{ mMutex };
+      jobs.push_back( pJob );
+      mUrgentCount = mUrgentJobs.size();
+   }
+   mCondition.notify_all();
+
+   pJob->Work();
+
+   {
+      std::unique_lock<std::mutex> lock{ pJob->mutex };
+      pJob->condition.wait( lock, [&]{ return pJob->finished == count; } );
+   }
+   {
+      // Workers drop exhausted jobs, but maybe none looked since
+      std::lock_guard<std::mutex> guard{ mMutex };
+      auto end = jobs.end(), iter = std::find( jobs.begin(), end, pJob );
+      if (iter != end)
+         jobs.erase( iter );
+      mUrgentCount = mUrgentJobs.size();
+   }
+
+   if (pJob->exception)
+      std::rethrow_exception( pJob->exception );
+}
+
+void WorkerPool::Work()
+{
+   while (true) {
+      std::shared_ptr<Job> pJob;
+      bool urgent;
+      {
+         std::unique_lock<std::mutex> lock{ mMutex };
+         mCondition.wait( lock, [this]{
+            return mStop || !mUrgentJobs.empty() || !mJobs.empty(); } );
+         if (mStop)
+            return;
+         urgent = !mUrgentJobs.empty();
+         auto &jobs = urgent ? mUrgentJobs : mJobs;
+         pJob = jobs.front();
+         if (pJob->Exhausted()) {
+            jobs.pop_front();
+            mUrgentCount = mUrgentJobs.size();
+            continue;
+         }
+      }
+      // Other jobs yield to urgent ones between iterations
+      pJob->Work( urgent ? nullptr : &mUrgentCount );
+   }
+}
@@ -0,0 +1,77 @@
+/*!********************************************************************
+
+Audacity: A Digital Audio Editor
+
+@file WorkerPool.h
+@brief Declare WorkerPool, which runs independent tasks on a few threads
+
+**********************************************************************/
+
+#ifndef __AUDACITY_WORKER_POOL__
+#define __AUDACITY_WORKER_POOL__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! A fixed set of threads, started on first use, that share out the
+//! iterations of loops whose iterations are independent
+/*!
+ The thread that calls Run() works too, so that a pool without workers
+ still makes progress, and Run() may be called from several threads at
+ once.  Threads are kept for the life of the program, so that per-thread
+ resources that tasks acquire, such as prepared database statements, are
+ reused.
+
+ Urgent jobs, such as mixing for playback, which has a deadline, are taken
+ by the workers before other jobs, and workers busy with other jobs leave
+ them between iterations to take urgent ones.
+ */
+class AUDACITY_DLL_API WorkerPool final
+{
+public:
+   //! The pool shared by the whole program
+   static WorkerPool &Get();
+
+   //! Task receives an index less than the count passed to Run()
+   using Task = std::function< void(size_t) >;
+
+   enum class Priority { Normal, Urgent };
+
+   explicit WorkerPool( size_t nWorkers );
+   WorkerPool( const WorkerPool & ) PROHIBITED;
+   WorkerPool &operator=( const WorkerPool & ) PROHIBITED;
+   ~WorkerPool();
+
+   //! Number of threads, including the calling thread, that Run() can use
+   size_t GetConcurrency() const { return mThreads.size() + 1; }
+
+   //! Call task once for each index below count, in no particular order,
+   //! and return when all calls have returned
+   /*! If any call throws, the other calls still run, and then the first
+    exception is rethrown */
+   void Run( size_t count, const Task &task,
+      Priority priority = Priority::Normal );
+
+private:
+   struct Job;
+
+   void Work();
+
+   std::vector<std::thread> mThreads;
+   std::mutex mMutex;
+   std::condition_variable mCondition;
+   std::deque< std::shared_ptr<Job> > mJobs;
+   std::deque< std::shared_ptr<Job> > mUrgentJobs;
+   //! Size of mUrgentJobs, read without the lock by workers between
+   //! iterations of other jobs
+   std::atomic<size_t> mUrgentCount{ 0 };
+   bool mStop{ false };
+};
+
+#endif
@@ -1595,6 +1595,9 @@ bool Effect::ProcessTrack(int count,
    decltype(mBufferSize) outputBufferCnt = 0;
    bool cleared = false;
 
+   // Input is read in order, so each read can continue from the last block
+   BlockCursor leftCursor, rightCursor;
+
    auto chans = std::min<unsigned>(mNumAudioOut, mNumChannels);
 
    std::shared_ptr<WaveTrack> genLeft, genRight;
@@ -1638,10 +1641,12 @@ bool Effect::ProcessTrack(int count,
                limitSampleBufferSize( mBufferSize, inputRemaining );
 
             // Fill the input buffers
-            left->GetFloats(inBuffer[0].get(), inPos, inputBufferCnt);
+            left->GetFloats(inBuffer[0].get(), inPos, inputBufferCnt,
+               fillZero, true, nullptr, &leftCursor);
             if (right)
             {
-               right->GetFloats(inBuffer[1].get(), inPos, inputBufferCnt);
+               right->GetFloats(inBuffer[1].get(), inPos, inputBufferCnt,
+                  fillZero, true, nullptr, &rightCursor);
             }
 
             // Reset the input buffer positions
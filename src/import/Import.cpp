@@ -53,6 +53,7 @@ ImportLOF.cpp, and ImportAUP.cpp.
 #include "FileNames.h"
 #include "../ShuttleGui.h"
 #include "Project.h"
+#include "../SampleBlock.h"
 #include "../WaveTrack.h"
 
 #include "Prefs.h"
@@ -627,7 +628,12 @@ bool Importer::Import( AudacityProject &project,
          else
             inFile->SetStreamUsage(0,TRUE);
 
-         auto res = inFile->Import(trackFactory, tracks, tags);
+         ProgressResult res;
+         {
+            // Store the many new sample blocks in few transactions
+            SampleBlockBatch batch{ *trackFactory->GetSampleBlockFactory() };
+            res = inFile->Import(trackFactory, tracks, tags);
+         }
 
          if (res == ProgressResult::Success || res == ProgressResult::Stopped)
          {
@@ -30,6 +30,7 @@ and sample size to help you importing data of an unknown format.
 #include "../FileFormats.h"
 #include "Prefs.h"
 #include "ProjectRate.h"
+#include "../SampleBlock.h"
 #include "../SelectFile.h"
 #include "../ShuttleGui.h"
 #include "UserException.h"
@@ -209,6 +210,9 @@ void ImportRaw(const AudacityProject &project, wxWindow *parent, const wxString
       /* i18n-hint: 'Raw' means 'unprocessed' here and should usually be translated.*/
       ProgressDialog progress(XO("Import Raw"), msg);
 
+      // Store the many new sample blocks in few transactions
+      SampleBlockBatch batch{ *trackFactory->GetSampleBlockFactory() };
+
       size_t block;
       do {
          block =
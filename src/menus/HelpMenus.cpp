@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <unordered_set>
 #include <wx/app.h>
 #include <wx/bmpbuttn.h>
 #include <wx/textctrl.h>
@@ -9,18 +11,25 @@
 #include "AudioIOBase.h"
 #include "../CommonCommandFlags.h"
 #include "../CrashReport.h" // for HAS_CRASH_REPORT
+#include "../DBConnection.h"
 #include "FileNames.h"
 #include "../HelpText.h"
 #include "../LogWindow.h"
 #include "../Menus.h"
 #include "Prefs.h"
 #include "Project.h"
+#include "../ProjectFileIO.h"
 #include "../ProjectSelectionManager.h"
 #include "../ProjectWindows.h"
+#include "../SampleBlock.h"
+#include "../SampleBlockCache.h"
 #include "../SelectFile.h"
+#include "../Sequence.h"
 #include "../ShuttleGui.h"
 #include "../SplashDialog.h"
 #include "../Theme.h"
+#include "../WaveClip.h"
+#include "../WaveTrack.h"
 #include "../commands/CommandContext.h"
 #include "../commands/CommandManager.h"
 #include "../prefs/PrefsDialog.h"
@@ -342,6 +351,128 @@ void OnMidiDeviceInfo(const CommandContext &context)
 }
 #endif
 
+void OnVerifyProject(const CommandContext &context)
+{
+   auto &project = context.project;
+   auto &projectFileIO = ProjectFileIO::Get( project );
+
+   ProjectFileIO::VerifyResult result;
+   if (!projectFileIO.VerifyBlocks(result)) {
+      AudacityMessageBox(
+         XO("The project could not be verified.\n\n%s")
+            .Format( projectFileIO.GetLastError() ),
+         XO("Verify Project Integrity"),
+         wxOK | wxICON_ERROR,
+         &GetProjectFrame( project ) );
+      return;
+   }
+
+   wxString info;
+   info += XO("Checked %llu blocks, %.1f MB in %.1f seconds (%.1f MB/s)\n")
+      .Format( (unsigned long long) result.blocks,
+         result.bytes / 1048576.0,
+         result.seconds,
+         result.bytes / 1048576.0 / std::max(result.seconds, 0.001) )
+      .Translation();
+   if (result.cancelled)
+      info += XO("Verification was stopped before checking all blocks.\n")
+         .Translation();
+   if (result.unverified)
+      info += XO(
+"%llu blocks were saved by an older version and have no checksum.\n")
+         .Format( (unsigned long long) result.unverified )
+         .Translation();
+
+   if (result.damaged.empty())
+      info += XO("No damaged blocks were found.\n").Translation();
+   else {
+      info += XO("%llu damaged blocks were found.\n")
+         .Format( (unsigned long long) result.damaged.size() )
+         .Translation();
+
+      // Find where the damaged blocks are used by the tracks, which may
+      // share a block among several clips
+      const std::unordered_set<SampleBlockID> damaged{
+         result.damaged.begin(), result.damaged.end() };
+      std::unordered_set<SampleBlockID> referenced;
+      wxString uses;
+      for (auto track : TrackList::Get( project ).Any< const WaveTrack >()) {
+         for (auto clip : track->GetAllClips()) {
+            const double rate = clip->GetRate();
+            for (const auto &block : clip->GetSequence()->GetBlockArray()) {
+               const auto id = block.sb->GetBlockID();
+               if (!damaged.count(id))
+                  continue;
+               referenced.insert(id);
+               const double t0 =
+                  clip->GetOffset() + block.start.as_double() / rate;
+               const double t1 = t0 + block.sb->GetSampleCount() / rate;
+               uses += XO("   block %lld: track \"%s\", %.3f to %.3f seconds\n")
+                  .Format( (long long) id, track->GetName(), t0, t1 )
+                  .Translation();
+            }
+         }
+      }
+      info += uses;
+      for (auto id : result.damaged)
+         if (!referenced.count(id))
+            info += XO(
+"   block %lld: not used by the tracks, only by Undo history\n")
+               .Format( (long long) id )
+               .Translation();
+   }
+
+   ShowDiagnostics( project, info,
+      XO("Project Integrity"), wxT("integrity.txt") );
+}
+
+void OnDatabaseStatistics(const CommandContext &context)
+{
+   auto &project = context.project;
+   auto &projectFileIO = ProjectFileIO::Get( project );
+
+   wxString info;
+   if (!projectFileIO.HasConnection())
+      info = wxT("The project has no open database connection.\n");
+   else {
+      auto &connection = projectFileIO.GetConnection();
+
+      info += wxT("Prepared statements, summed over threads:\n\n");
+      info += wxString::Format(wxT("%-28s %8s %10s %9s %10s %10s %10s %9s\n"),
+         wxT("Statement"), wxT("Prepared"), wxT("Acquired"), wxT("Contended"),
+         wxT("Steps"), wxT("Rows"), wxT("Total ms"), wxT("us/step"));
+      for (const auto &stats : connection.GetStatementStatistics())
+         info += wxString::Format(
+            wxT("%-28s %8llu %10llu %9llu %10llu %10llu %10.1f %9.1f\n"),
+            stats.name, stats.prepares, stats.acquisitions,
+            stats.contentions, stats.steps, stats.rows,
+            stats.stepMilliseconds,
+            stats.steps ? 1000 * stats.stepMilliseconds / stats.steps : 0.0);
+
+      const auto checkpoints = connection.GetCheckpointStatistics();
+      info += wxString::Format(
+         wxT("\nCheckpoints: %llu, %llu log resets; log %d pages, %d not")
+         wxT(" checkpointed, at most %d;\nlast %.1f ms, longest %.1f ms\n"),
+         checkpoints.checkpoints, checkpoints.truncations,
+         checkpoints.walPages, checkpoints.backlogPages,
+         checkpoints.maxWalPages,
+         checkpoints.lastMilliseconds, checkpoints.maxMilliseconds);
+   }
+
+   const auto cache = SampleBlockCache::Get( project ).GetStatistics();
+   const auto lookups = cache.hits + cache.misses;
+   info += wxString::Format(
+      wxT("\nSample block cache: %llu hits, %llu misses (%.1f%% hits),")
+      wxT(" %llu evictions;\n%llu blocks, %.1f of %.1f MB\n"),
+      cache.hits, cache.misses,
+      lookups ? 100.0 * cache.hits / lookups : 0.0,
+      cache.evictions, (unsigned long long)cache.entries,
+      cache.bytes / 1048576.0, cache.budget / 1048576.0);
+
+   ShowDiagnostics( project, info,
+      XO("Database Statistics"), wxT("dbstatistics.txt"), true );
+}
+
 void OnShowLog( const CommandContext &context )
 {
    LogWindow::Show();
@@ -540,6 +671,13 @@ BaseItemSharedPtr HelpMenu()
                FN(OnMidiDeviceInfo),
                AudioIONotBusyFlag() ),
       #endif
+            Command( wxT("VerifyProject"), XXO("&Verify Project Integrity..."),
+               FN(OnVerifyProject),
+               AudioIONotBusyFlag() ),
+            Command( wxT("DatabaseStatistics"),
+               XXO("Data&base Statistics..."),
+               FN(OnDatabaseStatistics),
+               AlwaysEnabledFlag ),
             Command( wxT("Log"), XXO("Show &Log..."), FN(OnShowLog),
                AlwaysEnabledFlag ),
       #if defined(HAS_CRASH_REPORT)